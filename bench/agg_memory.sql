@@ -0,0 +1,57 @@
+--
+-- json_agg_plain memory use by number of rows aggregated
+--
+-- psql -X -f bench/agg_memory.sql
+--
+-- Every step runs in a fresh backend and prints its peak resident memory
+-- (VmHWM, so the server has to run on this host). Groups are aggregated one
+-- at a time, 10000 rows each, and the sort spills to disk past work_mem,
+-- so the peak must stay about the same from one to eight million rows.
+--
+
+\set ON_ERROR_STOP 1
+
+DROP FUNCTION IF EXISTS bench_agg_memory( int );
+DROP TYPE IF EXISTS bench_mem_item;
+CREATE TYPE bench_mem_item AS ( sku text, qty int4, price numeric, tags text[] );
+
+CREATE OR REPLACE FUNCTION bench_agg_memory( nrows int ) RETURNS bigint AS $$
+	SELECT sum(length(j))
+	FROM (SELECT json_agg_plain(t, 'rows') j
+		  FROM (SELECT i / 10000 AS g, i AS id, md5(i::text) AS note,
+					   ROW('sku' || i, i % 10, i * 0.01, ARRAY['a', 'b' || i])::bench_mem_item AS item,
+					   ARRAY[i, i + 1, i + 2] AS refs
+				FROM generate_series(1, nrows) i) t
+		  GROUP BY g) s
+$$ LANGUAGE sql;
+
+\c
+SET enable_hashagg = off;
+SELECT pg_backend_pid() AS pid \gset
+\setenv BENCH_PID :pid
+SELECT bench_agg_memory( 1000000 );
+\! grep VmHWM /proc/$BENCH_PID/status
+
+\c
+SET enable_hashagg = off;
+SELECT pg_backend_pid() AS pid \gset
+\setenv BENCH_PID :pid
+SELECT bench_agg_memory( 2000000 );
+\! grep VmHWM /proc/$BENCH_PID/status
+
+\c
+SET enable_hashagg = off;
+SELECT pg_backend_pid() AS pid \gset
+\setenv BENCH_PID :pid
+SELECT bench_agg_memory( 4000000 );
+\! grep VmHWM /proc/$BENCH_PID/status
+
+\c
+SET enable_hashagg = off;
+SELECT pg_backend_pid() AS pid \gset
+\setenv BENCH_PID :pid
+SELECT bench_agg_memory( 8000000 );
+\! grep VmHWM /proc/$BENCH_PID/status
+
+DROP FUNCTION bench_agg_memory( int );
+DROP TYPE bench_mem_item;
@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# to_json_cached against to_json on a small set of hot rows of bench_wide
+# (run bench/run.sh or setup.sql first), read by primary key from many
+# clients at once. The server needs serializer in shared_preload_libraries
+# and json_serializer.cache_size large enough for the hot rows (a few MB).
+# Output is CSV:
+#
+#	scenario,impl,tps
+#
+# followed by json_serializer_cache_stats(). The updates scenario changes
+# one row in ten reads, so a share of lookups miss and insert anew.
+#
+# Settings: DURATION seconds per run (30), CLIENTS (64), THREADS for
+# pgbench (8), HOT rows (1000), SCHEMA holding the serializer functions
+# (public).
+#
+
+set -e
+
+DURATION=${DURATION:-30}
+CLIENTS=${CLIENTS:-64}
+THREADS=${THREADS:-8}
+HOT=${HOT:-1000}
+SCHEMA=${SCHEMA:-public}
+
+PSQL="psql -X -q -At -v ON_ERROR_STOP=1"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+$PSQL <<-SQL
+	DROP TABLE IF EXISTS bench_hot;
+	CREATE TABLE bench_hot AS SELECT * FROM bench_wide WHERE id <= $HOT;
+	ALTER TABLE bench_hot ADD PRIMARY KEY (id);
+	VACUUM ANALYZE bench_hot;
+	SELECT $SCHEMA.json_serializer_cache_reset();
+SQL
+
+# scenario impl query [update]
+run()
+{
+	{
+		echo "\\set id random(1, $HOT)"
+		echo "$3;"
+	} > "$TMP/read.sql"
+
+	if [ -n "$4" ]; then
+		{
+			echo "\\set id random(1, $HOT)"
+			echo "$4;"
+		} > "$TMP/write.sql"
+		scripts="-f $TMP/read.sql@9 -f $TMP/write.sql@1"
+	else
+		scripts="-f $TMP/read.sql"
+	fi
+
+	tps=$(pgbench -n -M prepared -T "$DURATION" -c "$CLIENTS" -j "$THREADS" $scripts 2> /dev/null |
+		  sed -n 's/^tps = \([0-9.]*\).*/\1/p' | tail -n 1)
+
+	echo "$1,$2,${tps:-0}"
+}
+
+echo "scenario,impl,tps"
+
+run hot to_json "SELECT $SCHEMA.to_json(t) FROM bench_hot t WHERE id = :id"
+run hot to_json_cached "SELECT $SCHEMA.to_json_cached('bench_hot', ctid) FROM bench_hot WHERE id = :id"
+
+run updates to_json "SELECT $SCHEMA.to_json(t) FROM bench_hot t WHERE id = :id" \
+	"UPDATE bench_hot SET i3 = i3 + 1 WHERE id = :id"
+run updates to_json_cached "SELECT $SCHEMA.to_json_cached('bench_hot', ctid) FROM bench_hot WHERE id = :id" \
+	"UPDATE bench_hot SET i3 = i3 + 1 WHERE id = :id"
+
+echo
+$PSQL -F , -c "SELECT * FROM $SCHEMA.json_serializer_cache_stats()"
+
+$PSQL -c "DROP TABLE bench_hot"
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# json_export against piping to_json through psql, on the tables of
+# bench/setup.sql (run bench/run.sh or setup.sql first)
+#
+# The server must run on this host: json_export writes into EXPORT_DIR
+# (a temporary directory by default), which the server needs to be able to
+# write to, and the file sizes are read from there. Output is CSV:
+#
+#	scenario,impl,seconds,mb_per_s
+#
+# mb_per_s is the size of the file each implementation wrote, compressed
+# for lz4 and zstd. Settings: SCHEMA holding the serializer functions
+# (public), EXPORT_DIR, COMPRESSION list (none lz4 zstd); compressions the
+# extension was not built with are skipped.
+#
+
+set -e
+
+SCHEMA=${SCHEMA:-public}
+COMPRESSION=${COMPRESSION:-none lz4 zstd}
+EXPORT_DIR=${EXPORT_DIR:-$(mktemp -d)}
+PSQL="psql -X -q -At -v ON_ERROR_STOP=1"
+
+chmod 777 "$EXPORT_DIR"
+trap 'rm -f "$EXPORT_DIR"/bench_export.*' EXIT
+
+now()
+{
+	date +%s.%N
+}
+
+# scenario impl start bytes
+report()
+{
+	awk -v s="$1" -v i="$2" -v t0="$3" -v t1="$(now)" -v b="$4" \
+		'BEGIN { printf "%s,%s,%.2f,%.1f\n", s, i, t1 - t0, b / (t1 - t0) / 1048576 }'
+}
+
+echo "scenario,impl,seconds,mb_per_s"
+
+for table in bench_narrow bench_wide bench_nested; do
+	start=$(now)
+	$PSQL -c "COPY (SELECT $SCHEMA.to_json(t) FROM $table t) TO STDOUT" > "$EXPORT_DIR/bench_export.psql"
+	report "$table" psql_copy "$start" "$(wc -c < "$EXPORT_DIR/bench_export.psql")"
+
+	for c in $COMPRESSION; do
+		start=$(now)
+		if $PSQL -c "SELECT $SCHEMA.json_export('SELECT * FROM $table', '$EXPORT_DIR/bench_export.$c', 'lines', '$c')" > /dev/null 2>&1; then
+			report "$table" "json_export_$c" "$start" "$(wc -c < "$EXPORT_DIR/bench_export.$c")"
+		fi
+	done
+done
@@ -0,0 +1,429 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer microbenchmark of the escape, number
+* formatting and structural index kernels
+*
+* Built and run by "make bench". Every kernel is first checked against a
+* reference implementation on the same corpus, then timed. Results are
+* printed as CSV: scenario,rows_per_s,mb_per_s,peak_kb
+*/
+
+#include "postgres_fe.h"
+
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "json_escape.h"
+#include "json_numfmt.h"
+#include "json_structural.h"
+
+#define CORPUS_BYTES	(32 * 1024 * 1024)
+#define NUMBERS			(4 * 1024 * 1024)
+#define REPEATS			3
+#define DOCUMENT_BYTES	(64 * 1024 * 1024)
+
+typedef struct Corpus
+{
+	const char *name;
+	char	   *data;
+	size_t	   *offsets;		/* string i is data[offsets[i]..offsets[i + 1]) */
+	size_t		nstrings;
+} Corpus;
+
+static double now_seconds( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_kb( void )
+{
+	struct rusage ru;
+
+	getrusage( RUSAGE_SELF, &ru );
+	return ru.ru_maxrss;
+}
+
+static void report( const char *scenario, const char *variant, double rows, double bytes, double seconds )
+{
+	printf( "%s_%s,%.0f,%.1f,%ld\n", scenario, variant,
+			rows / seconds, bytes / seconds / (1024.0 * 1024.0), peak_kb() );
+}
+
+/*
+ * The escaper as it was before the vector kernel: one byte at a time
+ */
+static size_t legacy_escape( char *dst, const char *str, size_t len )
+{
+	static const char hex[] = "0123456789abcdef";
+	char	   *out = dst;
+	size_t		i;
+
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = (unsigned char) str[ i ];
+
+		switch (c)
+		{
+			case '\b': *out++ = '\\'; *out++ = 'b'; break;
+			case '\n': *out++ = '\\'; *out++ = 'n'; break;
+			case '\r': *out++ = '\\'; *out++ = 'r'; break;
+			case '\t': *out++ = '\\'; *out++ = 't'; break;
+			case '"': *out++ = '\\'; *out++ = '"'; break;
+			case '\\': *out++ = '\\'; *out++ = '\\'; break;
+			default:
+				if (c < ' ')
+				{
+					out += sprintf( out, "\\u00%c%c", hex[ c >> 4 ], hex[ c & 0xf ] );
+				}
+				else
+					*out++ = (char) c;
+		}
+	}
+
+	return out - dst;
+}
+
+/* the new kernel with the vector scan replaced by the scalar one */
+static size_t scalar_escape( char *dst, const char *str, size_t len )
+{
+	char	   *out = dst;
+
+	while (len > 0)
+	{
+		size_t		clean = json_escape_clean_prefix_scalar( str, len );
+
+		memcpy( out, str, clean );
+		out += clean;
+		str += clean;
+		len -= clean;
+
+		if (len == 0)
+			break;
+
+		out += json_escape_char( (unsigned char) *str, out );
+		str++;
+		len--;
+	}
+
+	return out - dst;
+}
+
+static void make_corpus( Corpus *corpus, const char *name, int kind )
+{
+	size_t		pos = 0;
+	size_t		allocated = 1024;
+
+	corpus->name = name;
+	corpus->data = malloc( CORPUS_BYTES );
+	corpus->offsets = malloc( allocated * sizeof( size_t ) );
+	corpus->nstrings = 0;
+
+	while (pos < CORPUS_BYTES - 1024)
+	{
+		size_t		len = 16 + random() % 496;
+		size_t		i = 0;
+
+		if (corpus->nstrings + 1 >= allocated)
+		{
+			allocated *= 2;
+			corpus->offsets = realloc( corpus->offsets, allocated * sizeof( size_t ) );
+		}
+		corpus->offsets[ corpus->nstrings++ ] = pos;
+
+		while (i < len)
+		{
+			int			r = random() % 100;
+
+			if (kind == 1 && r < 12)
+			{
+				/* escape heavy: quotes, backslashes, newlines, control bytes */
+				static const char special[] = "\"\\\n\t\r\001\037";
+
+				corpus->data[ pos + i++ ] = special[ random() % (sizeof( special ) - 1) ];
+			}
+			else if (kind == 2 && r < 30 && i + 3 <= len)
+			{
+				/* UTF-8: a mix of two and three byte sequences */
+				if (r < 15)
+				{
+					corpus->data[ pos + i++ ] = (char) (0xC3);
+					corpus->data[ pos + i++ ] = (char) (0xA0 + random() % 16);
+				}
+				else
+				{
+					corpus->data[ pos + i++ ] = (char) (0xE2);
+					corpus->data[ pos + i++ ] = (char) (0x82);
+					corpus->data[ pos + i++ ] = (char) (0xAC);
+				}
+			}
+			else
+			{
+				char		c = (char) (' ' + random() % 95);
+
+				if (c == '"' || c == '\\')
+					c = 'x';
+				corpus->data[ pos + i++ ] = c;
+			}
+		}
+
+		pos += len;
+	}
+
+	corpus->offsets[ corpus->nstrings ] = pos;
+}
+
+static void bench_escape( Corpus *corpus )
+{
+	char	   *out = malloc( 512 * JSON_ESCAPE_MAX_SEQ );
+	char	   *ref = malloc( 512 * JSON_ESCAPE_MAX_SEQ );
+	size_t		bytes = corpus->offsets[ corpus->nstrings ];
+	size_t		i;
+	double		start;
+	volatile size_t sink = 0;
+	struct
+	{
+		const char *variant;
+		size_t		(*fn) ( char *, const char *, size_t );
+	}			variants[] = {
+		{ "legacy", legacy_escape },
+		{ "scalar", scalar_escape },
+		{ "vector", json_escape_buf }
+	};
+	int			v;
+
+	/* differential check before timing anything */
+	for (i = 0; i < corpus->nstrings; i++)
+	{
+		const char *s = corpus->data + corpus->offsets[ i ];
+		size_t		len = corpus->offsets[ i + 1 ] - corpus->offsets[ i ];
+		size_t		reflen = legacy_escape( ref, s, len );
+
+		for (v = 1; v < 3; v++)
+		{
+			size_t		outlen = variants[ v ].fn( out, s, len );
+
+			if (outlen != reflen || memcmp( out, ref, reflen ) != 0)
+			{
+				fprintf( stderr, "escape mismatch: %s on %s string %zu\n",
+						 variants[ v ].variant, corpus->name, i );
+				exit( 1 );
+			}
+		}
+	}
+
+	for (v = 0; v < 3; v++)
+	{
+		char		scenario[ 64 ];
+		double		best = 0;
+		int			rep;
+
+		/* best of a few passes, the corpus is shared by all variants */
+		for (rep = 0; rep < REPEATS; rep++)
+		{
+			double		elapsed;
+
+			start = now_seconds();
+			for (i = 0; i < corpus->nstrings; i++)
+			{
+				const char *s = corpus->data + corpus->offsets[ i ];
+
+				sink += variants[ v ].fn( out, s, corpus->offsets[ i + 1 ] - corpus->offsets[ i ] );
+			}
+
+			elapsed = now_seconds() - start;
+			if (rep == 0 || elapsed < best)
+				best = elapsed;
+		}
+
+		snprintf( scenario, sizeof( scenario ), "escape_%s", corpus->name );
+		report( scenario, variants[ v ].variant, corpus->nstrings, bytes, best );
+	}
+
+	free( out );
+	free( ref );
+}
+
+static void bench_numbers( void )
+{
+	int64	   *ints = malloc( NUMBERS * sizeof( int64 ) );
+	double	   *doubles = malloc( NUMBERS * sizeof( double ) );
+	char		buf[ JSON_NUMFMT_BUFLEN ];
+	double		start;
+	size_t		bytes;
+	int			i;
+
+	for (i = 0; i < NUMBERS; i++)
+	{
+		/* a spread of magnitudes, like ids, counters and amounts */
+		ints[ i ] = ((int64) random() << 31 | random()) >> (random() % 62);
+		if (random() % 4 == 0)
+			ints[ i ] = -ints[ i ];
+		doubles[ i ] = (random() - RAND_MAX / 2) / (double) (1 + random() % 100000);
+	}
+
+	for (i = 0; i < NUMBERS; i++)
+	{
+		int			len = json_format_double( buf, doubles[ i ] );
+
+		if (len < 0 || strtod( (buf[ len ] = '\0', buf), NULL ) != doubles[ i ])
+		{
+			fprintf( stderr, "float8 round trip failed for %.17g\n", doubles[ i ] );
+			exit( 1 );
+		}
+	}
+
+	bytes = 0;
+	start = now_seconds();
+	for (i = 0; i < NUMBERS; i++)
+		bytes += snprintf( buf, sizeof( buf ), INT64_FORMAT, ints[ i ] );
+	report( "int8", "snprintf", NUMBERS, bytes, now_seconds() - start );
+
+	bytes = 0;
+	start = now_seconds();
+	for (i = 0; i < NUMBERS; i++)
+		bytes += json_format_int64( buf, ints[ i ] );
+	report( "int8", "kernel", NUMBERS, bytes, now_seconds() - start );
+
+	bytes = 0;
+	start = now_seconds();
+	for (i = 0; i < NUMBERS; i++)
+		bytes += snprintf( buf, sizeof( buf ), "%.17g", doubles[ i ] );
+	report( "float8", "snprintf", NUMBERS, bytes, now_seconds() - start );
+
+	bytes = 0;
+	start = now_seconds();
+	for (i = 0; i < NUMBERS; i++)
+		bytes += json_format_double( buf, doubles[ i ] );
+	report( "float8", "kernel", NUMBERS, bytes, now_seconds() - start );
+
+	free( ints );
+	free( doubles );
+}
+
+/*
+ * A document shaped like twitter.json: pretty printed objects with many
+ * short strings, some escapes and non-ASCII text, a few ids and counts
+ */
+static size_t make_tweets( char *doc, size_t size )
+{
+	static const char *words[] = { "the", "json", "caf\\u00e9", "\\\"quoted\\\"", "\\u3053\\u3093",
+		"https:\\/\\/t.co\\/x", "\\u00fcber", "a\\\\b", "RT", "@user" };
+	size_t		pos = 0;
+	long		id = 505874924095815681L;
+
+	pos += sprintf( doc + pos, "{\n  \"statuses\": [\n" );
+
+	while (pos < size - 4096)
+	{
+		int			i;
+
+		pos += sprintf( doc + pos, "    {\n      \"id\": %ld,\n      \"id_str\": \"%ld\",\n      \"text\": \"", id, id );
+		for (i = 0; i < 8 + random() % 12; i++)
+			pos += sprintf( doc + pos, "%s%s", i > 0 ? " " : "", words[ random() % 10 ] );
+		pos += sprintf( doc + pos, "\",\n      \"truncated\": false,\n      \"in_reply_to_status_id\": null,\n"
+						"      \"user\": {\n        \"screen_name\": \"user%ld\",\n"
+						"        \"followers_count\": %ld,\n        \"verified\": %s\n      },\n"
+						"      \"retweet_count\": %ld,\n      \"lang\": \"ja\"\n    },\n",
+						random() % 100000, random() % 10000, random() % 2 ? "true" : "false", random() % 1000 );
+		id += 1 + random() % 1000;
+	}
+
+	pos += sprintf( doc + pos, "    {}\n  ]\n}\n" );
+	return pos;
+}
+
+/* compact rows of numbers, like an exported measurement table */
+static size_t make_numeric( char *doc, size_t size )
+{
+	size_t		pos = 0;
+
+	doc[ pos++ ] = '[';
+
+	while (pos < size - 256)
+		pos += sprintf( doc + pos, "[%ld,%.6f,%.3e,-%ld,%d],", random(),
+						random() / 1e6, random() / 3.0, random() % 1000, (int) (random() % 2) );
+
+	pos += sprintf( doc + pos, "[]]" );
+	return pos;
+}
+
+static void bench_structural( const char *scenario, char *doc, size_t len )
+{
+	uint32_t   *out = malloc( (len + JSON_STRUCTURAL_BLOCK) * sizeof( uint32_t ) );
+	uint32_t   *ref = malloc( (len + JSON_STRUCTURAL_BLOCK) * sizeof( uint32_t ) );
+	JsonStructuralState state;
+	size_t		nref;
+	size_t		n;
+	int			v;
+
+	memset( &state, 0, sizeof( state ) );
+	nref = json_structural_index_scalar( &state, doc, len, 0, ref );
+
+	memset( &state, 0, sizeof( state ) );
+	n = json_structural_index( &state, doc, len, 0, out );
+
+	if (n != nref || memcmp( out, ref, n * sizeof( uint32_t ) ) != 0)
+	{
+		fprintf( stderr, "structural index mismatch on %s\n", scenario );
+		exit( 1 );
+	}
+
+	/* rows are token starts */
+	for (v = 0; v < 2; v++)
+	{
+		double		best = 0;
+		int			rep;
+
+		for (rep = 0; rep < REPEATS; rep++)
+		{
+			double		start = now_seconds();
+			double		elapsed;
+
+			memset( &state, 0, sizeof( state ) );
+			if (v == 0)
+				json_structural_index_scalar( &state, doc, len, 0, out );
+			else
+				json_structural_index( &state, doc, len, 0, out );
+
+			elapsed = now_seconds() - start;
+			if (rep == 0 || elapsed < best)
+				best = elapsed;
+		}
+
+		report( scenario, v == 0 ? "scalar" : "vector", nref, len, best );
+	}
+
+	free( out );
+	free( ref );
+}
+
+int main( int argc, char **argv )
+{
+	Corpus		ascii, escapes, utf8;
+	char	   *document;
+
+	srandom( 42 );
+
+	make_corpus( &ascii, "ascii", 0 );
+	make_corpus( &escapes, "escapes", 1 );
+	make_corpus( &utf8, "utf8", 2 );
+
+	printf( "scenario,rows_per_s,mb_per_s,peak_kb\n" );
+
+	bench_escape( &ascii );
+	bench_escape( &escapes );
+	bench_escape( &utf8 );
+
+	bench_numbers();
+
+	document = malloc( DOCUMENT_BYTES );
+	bench_structural( "structural_tweets", document, make_tweets( document, DOCUMENT_BYTES ) );
+	bench_structural( "structural_numeric", document, make_numeric( document, DOCUMENT_BYTES ) );
+	free( document );
+
+	return 0;
+}
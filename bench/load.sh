@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Loading bench_narrow back from JSON: json_load and json_load_file
+# against COPY FROM and against INSERT ... SELECT from from_json row by
+# row, into a plain table and into one with a primary key. Uses the tables
+# of bench/setup.sql (run bench/run.sh or setup.sql first).
+#
+# json_load_file reads a file json_export writes into LOAD_DIR (a
+# temporary directory by default), so the server must run on this host
+# and be able to write there. Output is CSV:
+#
+#	scenario,impl,seconds,rows_per_s
+#
+# Settings: SCHEMA holding the serializer functions (public), LOAD_DIR.
+#
+
+set -e
+
+SCHEMA=${SCHEMA:-public}
+LOAD_DIR=${LOAD_DIR:-$(mktemp -d)}
+PSQL="psql -X -q -At -v ON_ERROR_STOP=1"
+
+chmod 777 "$LOAD_DIR"
+trap 'rm -f "$LOAD_DIR"/bench_load.*' EXIT
+
+now()
+{
+	date +%s.%N
+}
+
+# scenario impl sql
+run()
+{
+	$PSQL -c "TRUNCATE bench_load" -c "CHECKPOINT" > /dev/null
+	start=$(now)
+	$PSQL -c "$3" > /dev/null
+	awk -v s="$1" -v i="$2" -v t0="$start" -v t1="$(now)" -v r="$rows" \
+		'BEGIN { printf "%s,%s,%.2f,%.0f\n", s, i, t1 - t0, r / (t1 - t0) }'
+}
+
+rows=$($PSQL -c "SELECT count(*) FROM bench_narrow")
+
+$PSQL -c "COPY bench_narrow TO STDOUT" > "$LOAD_DIR/bench_load.tsv"
+$PSQL -c "SELECT $SCHEMA.json_export('SELECT * FROM bench_narrow', '$LOAD_DIR/bench_load.json', 'array')" > /dev/null
+
+echo "scenario,impl,seconds,rows_per_s"
+
+for scenario in plain indexed; do
+	$PSQL -c "DROP TABLE IF EXISTS bench_load" -c "CREATE TABLE bench_load (LIKE bench_narrow)" > /dev/null
+	if [ "$scenario" = indexed ]; then
+		$PSQL -c "ALTER TABLE bench_load ADD PRIMARY KEY (id)" > /dev/null
+	fi
+
+	run "$scenario" copy "\\copy bench_load FROM '$LOAD_DIR/bench_load.tsv'"
+	run "$scenario" json_load "SELECT sum($SCHEMA.json_load('bench_load', doc)) FROM bench_docs WHERE kind = 'pretty'"
+	run "$scenario" json_load_file "SELECT $SCHEMA.json_load_file('bench_load', '$LOAD_DIR/bench_load.json')"
+	run "$scenario" from_json "INSERT INTO bench_load SELECT r.* FROM bench_narrow_json,
+		$SCHEMA.from_json('bench_narrow'::regtype, j) AS r(id int, name text, amount numeric(12,2), created timestamptz, flag boolean)"
+done
+
+$PSQL -c "DROP TABLE bench_load" > /dev/null
@@ -0,0 +1,61 @@
+--
+-- json_agg_maintain: reading a group's document against aggregating it,
+-- and what the triggers add to writes
+--
+-- psql -X -v rows=1000000 -v groups=100 -f bench/maintained.sql
+--
+
+\set ON_ERROR_STOP 1
+
+\if :{?rows}
+\else
+\set rows 1000000
+\endif
+\if :{?groups}
+\else
+\set groups 100
+\endif
+
+DROP TABLE IF EXISTS bench_events_plain, bench_events;
+CREATE TABLE bench_events AS
+	SELECT i AS id, i % :groups AS account_id, now() - i * interval '1 second' AS created,
+		   md5(i::text) AS payload, (random() * 1000)::numeric(12,2) AS amount
+	FROM generate_series(1, :rows) i;
+ALTER TABLE bench_events ADD PRIMARY KEY (id);
+CREATE INDEX ON bench_events (account_id);
+CREATE TABLE bench_events_plain AS SELECT * FROM bench_events;
+ALTER TABLE bench_events_plain ADD PRIMARY KEY (id);
+CREATE INDEX ON bench_events_plain (account_id);
+ANALYZE bench_events, bench_events_plain;
+
+\timing on
+
+SELECT json_agg_maintain( 'bench_events', 'account_id', 'events', 'bench_events_json' );
+
+-- one group, aggregated from scratch and read back
+SELECT octet_length( json_agg( t, 'events' ) ) FROM bench_events t WHERE account_id = 7;
+SELECT octet_length( doc ) FROM bench_events_json WHERE group_key = 7;
+
+-- the same 1000 writes with and without maintenance
+UPDATE bench_events_plain SET amount = amount + 1 WHERE id <= 1000;
+UPDATE bench_events SET amount = amount + 1 WHERE id <= 1000;
+
+INSERT INTO bench_events_plain SELECT i, i % :groups, now(), md5(i::text), 1 FROM generate_series(:rows + 1, :rows + 1000) i;
+INSERT INTO bench_events SELECT i, i % :groups, now(), md5(i::text), 1 FROM generate_series(:rows + 1, :rows + 1000) i;
+
+DELETE FROM bench_events_plain WHERE id > :rows;
+DELETE FROM bench_events WHERE id > :rows;
+
+\timing off
+
+-- the patched documents must hold the same rows as a fresh aggregation,
+-- updated rows keep their place so only the order may differ
+SELECT count(*) AS mismatched_groups
+FROM bench_events_json d
+FULL JOIN (SELECT account_id, json_agg( t, 'events' )::jsonb -> 'events' AS rows FROM bench_events t GROUP BY account_id) a
+  ON a.account_id = d.group_key
+WHERE NOT coalesce( (d.doc::jsonb -> 'events') @> a.rows AND a.rows @> (d.doc::jsonb -> 'events') AND
+					jsonb_array_length( d.doc::jsonb -> 'events' ) = jsonb_array_length( a.rows ), false );
+
+SELECT json_agg_unmaintain( 'bench_events_json' );
+DROP TABLE bench_events_plain, bench_events;
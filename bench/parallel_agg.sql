@@ -0,0 +1,47 @@
+--
+-- json_agg_plain scaling by number of parallel workers
+--
+-- psql -X -v rows=5000000 -f bench/parallel_agg.sql
+--
+-- The server needs max_worker_processes (and max_parallel_workers) of at
+-- least 8 for the last step to get all of its workers.
+--
+
+\set ON_ERROR_STOP 1
+
+\if :{?rows}
+\else
+\set rows 5000000
+\endif
+
+DROP TABLE IF EXISTS bench_fact;
+CREATE TABLE bench_fact AS
+	SELECT i AS id, i % 1000 AS customer_id, now() - i * interval '1 second' AS created,
+		   (random() * 1000)::numeric(12,2) AS amount, md5(i::text) AS note
+	FROM generate_series(1, :rows) i;
+ANALYZE bench_fact;
+
+-- make the planner pick a parallel plan whenever workers are allowed
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+
+\timing on
+
+SET max_parallel_workers_per_gather = 0;
+SELECT length( json_agg_plain( f, 'rows' ) ) FROM bench_fact f;
+
+SET max_parallel_workers_per_gather = 1;
+SELECT length( json_agg_plain( f, 'rows' ) ) FROM bench_fact f;
+
+SET max_parallel_workers_per_gather = 2;
+SELECT length( json_agg_plain( f, 'rows' ) ) FROM bench_fact f;
+
+SET max_parallel_workers_per_gather = 4;
+SELECT length( json_agg_plain( f, 'rows' ) ) FROM bench_fact f;
+
+SET max_parallel_workers_per_gather = 8;
+SELECT length( json_agg_plain( f, 'rows' ) ) FROM bench_fact f;
+
+\timing off
+
+DROP TABLE bench_fact;
@@ -0,0 +1,46 @@
+--
+-- from_json_set scaling by json_serializer.parallel_workers
+--
+-- psql -X -v rows=2000000 -f bench/parallel_parse.sql
+--
+-- The document is a single pretty-printed array of about 150 bytes per row.
+-- The server needs max_worker_processes of at least 8 (plus whatever else
+-- runs) for the last step to get all of its workers.
+--
+
+\set ON_ERROR_STOP 1
+
+\if :{?rows}
+\else
+\set rows 2000000
+\endif
+
+DROP TABLE IF EXISTS bench_parse_doc;
+CREATE TABLE bench_parse_doc AS
+	SELECT jsonb_pretty( jsonb_agg( n ) ) AS doc
+	FROM (SELECT i AS id, md5(i::text) AS name, (random() * 10000)::numeric(12,2) AS amount,
+				 now() - i * interval '1 minute' AS created, i % 3 = 0 AS flag
+		  FROM generate_series(1, :rows) i) n;
+
+CREATE TYPE bench_parse_row AS ( id int, name text, amount numeric(12,2), created timestamptz, flag boolean );
+
+SELECT pg_size_pretty( octet_length( doc )::bigint ) AS doc_size FROM bench_parse_doc;
+
+\timing on
+
+SET json_serializer.parallel_workers = 0;
+SELECT count(*) FROM bench_parse_doc, from_json_set( NULL::bench_parse_row, doc );
+
+SET json_serializer.parallel_workers = 2;
+SELECT count(*) FROM bench_parse_doc, from_json_set( NULL::bench_parse_row, doc );
+
+SET json_serializer.parallel_workers = 4;
+SELECT count(*) FROM bench_parse_doc, from_json_set( NULL::bench_parse_row, doc );
+
+SET json_serializer.parallel_workers = 8;
+SELECT count(*) FROM bench_parse_doc, from_json_set( NULL::bench_parse_row, doc );
+
+\timing off
+
+DROP TABLE bench_parse_doc;
+DROP TYPE bench_parse_row;
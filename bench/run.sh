@@ -0,0 +1,112 @@
+#!/bin/sh
+#
+# pgbench-driven serializer benchmark, run by "make bench"
+#
+# Connects with the usual PG* environment variables to a database where
+# install.sql was run. Every scenario runs once with this project's function
+# and once with the built-in one it replaces. Output is CSV:
+#
+#	scenario,impl,rows_per_s,mb_per_s,peak_kb
+#
+# mb_per_s counts the JSON text produced (or parsed, for from_json). peak_kb
+# is the VmHWM of a backend that ran the scenario once, so it is only filled
+# in when the server runs on this host.
+#
+# Settings: DURATION seconds per run (10), CLIENTS for pgbench (1), SCALE of
+# the generated tables (1), SCHEMA holding the serializer functions (public),
+# SETUP=0 to reuse the tables of a previous run.
+#
+
+set -e
+
+DURATION=${DURATION:-10}
+CLIENTS=${CLIENTS:-1}
+SCALE=${SCALE:-1}
+SCHEMA=${SCHEMA:-public}
+SETUP=${SETUP:-1}
+
+BENCH_DIR=$(dirname "$0")
+PSQL="psql -X -q -At -v ON_ERROR_STOP=1"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+if [ "$SETUP" = 1 ]; then
+	$PSQL -v scale="$SCALE" -f "$BENCH_DIR/setup.sql" > /dev/null
+fi
+
+# scenario impl rows query, the query returns the number of JSON bytes
+run()
+{
+	echo "$4;" > "$TMP/query.sql"
+
+	tps=$(pgbench -n -T "$DURATION" -c "$CLIENTS" -f "$TMP/query.sql" 2> /dev/null |
+		  sed -n 's/^tps = \([0-9.]*\).*/\1/p' | tail -n 1)
+
+	: > "$TMP/hwm"
+	bytes=$($PSQL <<-SQL
+		SELECT pg_backend_pid() AS pid \gset
+		\setenv BENCH_PID :pid
+		$4;
+		\! sed -n 's/^VmHWM: *\([0-9]*\).*/\1/p' /proc/\$BENCH_PID/status > "$TMP/hwm" 2> /dev/null
+	SQL
+	)
+
+	awk -v s="$1" -v i="$2" -v r="$3" -v t="${tps:-0}" -v b="$bytes" -v m="$(cat "$TMP/hwm")" \
+		'BEGIN { printf "%s,%s,%.0f,%.1f,%s\n", s, i, t * r, t * b / 1048576, m }'
+}
+
+rows()
+{
+	$PSQL -c "SELECT count(*) FROM $1"
+}
+
+echo "scenario,impl,rows_per_s,mb_per_s,peak_kb"
+
+n=$(rows bench_narrow)
+run narrow serializer "$n" "SELECT sum(octet_length($SCHEMA.to_json(t)::text)) FROM bench_narrow t"
+run narrow builtin "$n" "SELECT sum(octet_length(row_to_json(t)::text)) FROM bench_narrow t"
+
+n=$(rows bench_wide)
+run wide serializer "$n" "SELECT sum(octet_length($SCHEMA.to_json(t)::text)) FROM bench_wide t"
+run wide builtin "$n" "SELECT sum(octet_length(row_to_json(t)::text)) FROM bench_wide t"
+run wide_columns serializer "$n" "SELECT sum(octet_length($SCHEMA.to_json(t, '{id,i3,t5,f7,t11}')::text)) FROM bench_wide t"
+run wide_columns builtin "$n" "SELECT sum(octet_length(json_build_object('id', id, 'i3', i3, 't5', t5, 'f7', f7, 't11', t11)::text)) FROM bench_wide t"
+
+n=$(rows bench_nested)
+run nested serializer "$n" "SELECT sum(octet_length($SCHEMA.to_json(t)::text)) FROM bench_nested t"
+run nested builtin "$n" "SELECT sum(octet_length(row_to_json(t)::text)) FROM bench_nested t"
+
+n=$(rows bench_arrays)
+run arrays serializer "$n" "SELECT sum(octet_length($SCHEMA.to_json(t)::text)) FROM bench_arrays t"
+run arrays builtin "$n" "SELECT sum(octet_length(row_to_json(t)::text)) FROM bench_arrays t"
+
+n=$(rows bench_large)
+run large serializer "$n" "SELECT sum(octet_length($SCHEMA.to_json(t)::text)) FROM bench_large t"
+run large builtin "$n" "SELECT sum(octet_length(row_to_json(t)::text)) FROM bench_large t"
+
+n=$(rows bench_nested)
+run nested_jsonb serializer "$n" "SELECT sum(octet_length($SCHEMA.to_jsonb(t)::text)) FROM bench_nested t"
+run nested_jsonb text_cast "$n" "SELECT sum(octet_length($SCHEMA.to_json(t)::jsonb::text)) FROM bench_nested t"
+run nested_jsonb builtin "$n" "SELECT sum(octet_length(pg_catalog.to_jsonb(t)::text)) FROM bench_nested t"
+
+n=$(rows bench_groups)
+run json_agg serializer "$n" "SELECT sum(octet_length(j::text)) FROM (SELECT $SCHEMA.json_agg_plain(t, 'rows') j FROM bench_groups t GROUP BY g) s"
+run json_agg builtin "$n" "SELECT sum(octet_length(j::text)) FROM (SELECT json_agg(t) j FROM bench_groups t GROUP BY g) s"
+run jsonb_agg serializer "$n" "SELECT sum(octet_length(j::text)) FROM (SELECT $SCHEMA.jsonb_agg_plain(t) j FROM bench_groups t GROUP BY g) s"
+run jsonb_agg builtin "$n" "SELECT sum(octet_length(j::text)) FROM (SELECT pg_catalog.jsonb_agg(t) j FROM bench_groups t GROUP BY g) s"
+
+n=$(rows bench_orders)
+run nested_agg serializer "$n" "SELECT octet_length($SCHEMA.json_agg_nested(t, '{order_id,line_id,tax_id}', '{lines,taxes}' ORDER BY order_id, line_id, tax_id)) FROM (SELECT o.order_id, o.customer, o.created, l.line_id, l.sku, l.qty, l.price, x.tax_id, x.kind, x.rate FROM bench_orders o JOIN bench_lines l USING (order_id) LEFT JOIN bench_taxes x USING (line_id)) t"
+run nested_agg subqueries "$n" "SELECT octet_length(json_agg(d ORDER BY order_id)::text) FROM (SELECT o.*, (SELECT json_agg(l2 ORDER BY line_id) FROM (SELECT l.*, (SELECT json_agg(x ORDER BY tax_id) FROM bench_taxes x WHERE x.line_id = l.line_id) AS taxes FROM bench_lines l WHERE l.order_id = o.order_id) l2) AS lines FROM bench_orders o) d"
+
+n=$(rows bench_narrow_json)
+run from_json serializer "$n" "SELECT sum(octet_length(j)) FROM bench_narrow_json WHERE $SCHEMA.from_json('bench_narrow'::regtype, j) IS NOT NULL"
+run from_json builtin "$n" "SELECT sum(octet_length(j)) FROM bench_narrow_json WHERE json_populate_record(NULL::bench_narrow, j::json) IS NOT NULL"
+
+n=$(rows bench_narrow)
+run from_json_set_pretty serializer "$n" "SELECT sum(octet_length(doc)) FROM bench_docs WHERE kind = 'pretty' AND (SELECT count(*) FROM $SCHEMA.from_json_set(NULL::bench_narrow, doc)) > 0"
+run from_json_set_pretty builtin "$n" "SELECT sum(octet_length(doc)) FROM bench_docs WHERE kind = 'pretty' AND (SELECT count(*) FROM json_populate_recordset(NULL::bench_narrow, doc::json)) > 0"
+
+n=$((100000 * SCALE))
+run from_json_set_numeric serializer "$n" "SELECT sum(octet_length(doc)) FROM bench_docs WHERE kind = 'numeric' AND (SELECT count(*) FROM $SCHEMA.from_json_set(NULL::bench_point, doc)) > 0"
+run from_json_set_numeric builtin "$n" "SELECT sum(octet_length(doc)) FROM bench_docs WHERE kind = 'numeric' AND (SELECT count(*) FROM json_populate_recordset(NULL::bench_point, doc::json)) > 0"
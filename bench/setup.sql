@@ -0,0 +1,107 @@
+--
+-- Tables for bench/run.sh
+--
+-- psql -X -v scale=1 -f bench/setup.sql
+--
+-- scale multiplies the row counts, the defaults take a few seconds per
+-- scenario on a laptop.
+--
+
+\set ON_ERROR_STOP 1
+
+\if :{?scale}
+\else
+\set scale 1
+\endif
+
+DROP TABLE IF EXISTS bench_narrow, bench_narrow_json, bench_wide, bench_nested, bench_arrays, bench_groups, bench_docs, bench_large, bench_orders, bench_lines, bench_taxes;
+DROP TYPE IF EXISTS bench_person, bench_address, bench_point;
+
+-- a handful of scalar columns, the common case
+CREATE TABLE bench_narrow AS
+	SELECT i AS id, md5(i::text) AS name, (random() * 10000)::numeric(12,2) AS amount,
+		   now() - i * interval '1 minute' AS created, i % 3 = 0 AS flag
+	FROM generate_series(1, 100000 * :scale) i;
+
+-- the same rows as JSON text, input of the deserializer scenarios
+CREATE TABLE bench_narrow_json AS
+	SELECT row_to_json(n)::text AS j FROM bench_narrow n;
+
+-- 48 columns of mixed types
+SELECT 'CREATE TABLE bench_wide AS SELECT i AS id, ' ||
+	   string_agg( CASE c % 3
+					   WHEN 0 THEN format( 'i * %s AS i%s', c, c )
+					   WHEN 1 THEN format( 'i / %s.0::float8 AS f%s', c, c )
+					   ELSE format( 'md5((i + %s)::text) AS t%s', c, c )
+				   END, ', ' ) ||
+	   format( ' FROM generate_series(1, %s) i', 20000 * :scale ) AS ddl
+FROM generate_series(1, 47) c \gset
+:ddl;
+
+-- composites nested two levels deep, with an array inside
+CREATE TYPE bench_address AS ( street text, city text, zip text );
+CREATE TYPE bench_person AS ( name text, born date, address bench_address, tags text[] );
+
+CREATE TABLE bench_nested AS
+	SELECT i AS id,
+		   ROW( md5(i::text), date '1970-01-01' + i % 20000,
+				ROW( i || ' Main St', 'City ' || i % 100, lpad( (i % 99999)::text, 5, '0' ) )::bench_address,
+				ARRAY[ 'a' || i % 7, 'b' || i % 11, 'c "quoted"' ] )::bench_person AS person,
+		   ROW( i || ' Billing Rd', 'Town', '00000' )::bench_address AS billing
+	FROM generate_series(1, 50000 * :scale) i;
+
+-- one and two dimensional arrays of 100 elements
+CREATE TABLE bench_arrays AS
+	SELECT i AS id,
+		   ARRAY( SELECT (i + k)::int4 FROM generate_series(1, 100) k ) AS ints,
+		   ARRAY( SELECT (i + k) / 7.0::float8 FROM generate_series(1, 100) k ) AS floats,
+		   ARRAY( SELECT ARRAY[ k, k * 2, k * 3, k * 4 ] FROM generate_series(1, 25) k ) AS matrix,
+		   ARRAY( SELECT 'label ' || k FROM generate_series(1, 10) k ) AS labels
+	FROM generate_series(1, 20000 * :scale) i;
+
+-- ten groups of 100000 rows for the aggregates
+CREATE TABLE bench_groups AS
+	SELECT i AS id, i % 10 AS g, md5(i::text) AS note, i * 0.5 AS value
+	FROM generate_series(1, 1000000 * :scale) i;
+
+-- large documents for from_json_set: pretty printed narrow rows, and compact
+-- numeric rows, 10000 rows per document
+CREATE TYPE bench_point AS ( id int8, x float8, y float8, z numeric );
+
+CREATE TABLE bench_docs AS
+	SELECT 'pretty'::text AS kind, jsonb_pretty( jsonb_agg( n ) ) AS doc
+	FROM bench_narrow n
+	GROUP BY n.id / 10000
+	UNION ALL
+	SELECT 'numeric', json_agg( ROW( i, i / 7.0, sqrt(i), i * 0.01 )::bench_point )::text
+	FROM generate_series(1, 100000 * :scale) i
+	GROUP BY i / 10000;
+
+-- a few rows with 16MB text and 4MB bytea values, stored out of line and
+-- uncompressed so they can be read in slices
+CREATE TABLE bench_large ( id int, doc text, blob bytea );
+ALTER TABLE bench_large ALTER COLUMN doc SET STORAGE EXTERNAL, ALTER COLUMN blob SET STORAGE EXTERNAL;
+INSERT INTO bench_large
+	SELECT i, repeat( md5(i::text) || E' "quoted"\n', 16 * 1024 * 1024 / 42 ),
+		   decode( repeat( md5((i + 1)::text), 4 * 1024 * 1024 / 16 ), 'hex' )
+	FROM generate_series(1, 8 * :scale) i;
+
+-- orders with five lines of two taxes each, for the nested aggregate
+CREATE TABLE bench_orders AS
+	SELECT i AS order_id, md5(i::text) AS customer, now() - i * interval '1 minute' AS created
+	FROM generate_series(1, 10000 * :scale) i;
+
+CREATE TABLE bench_lines AS
+	SELECT o * 10 + k AS line_id, o AS order_id, 'sku' || (o * k % 997) AS sku, k AS qty,
+		   (k * 9.99)::numeric(12,2) AS price
+	FROM generate_series(1, 10000 * :scale) o, generate_series(1, 5) k;
+
+CREATE TABLE bench_taxes AS
+	SELECT l.line_id * 10 + k AS tax_id, l.line_id, 'tax' || k AS kind, k * 0.05 AS rate
+	FROM bench_lines l, generate_series(1, 2) k;
+
+CREATE INDEX ON bench_lines (order_id);
+CREATE INDEX ON bench_taxes (line_id);
+
+VACUUM ANALYZE bench_narrow, bench_narrow_json, bench_wide, bench_nested, bench_arrays, bench_groups, bench_docs, bench_large,
+	bench_orders, bench_lines, bench_taxes;
@@ -11,182 +11,154 @@
 #include "utils/lsyscache.h"
 #include "catalog/pg_type.h"
 #include "utils/typcache.h"
-#include "executor/spi.h"
 #include "funcapi.h"
+#include "miscadmin.h"
 #include "utils/array.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
 
 #include <string.h>
-#include <ctype.h>
 
 #include "common.h"
-
-#ifdef		OPTION_WITH_DESERIALIZER
-
-#define NDEBUG
-#include <libjson/libjson.h>
-
+#include "deserializer.h"
+#include "json_parallel.h"
 
 Datum deserialize_record( PG_FUNCTION_ARGS );
 Datum deserialize_array( PG_FUNCTION_ARGS );
+Datum deserialize_record_set( PG_FUNCTION_ARGS );
+Datum deserialize_record_set_typed( PG_FUNCTION_ARGS );
 
-Datum ConvertFromText( char *value, Oid column_type, MemoryContext fn_mcxt, int4 typmod );
+/*
+ * Elements of a (possibly multidimensional) array being read. Nested JSON
+ * arrays are dimensions, they must all have the same length per level.
+ */
+typedef struct ArrayReadState
+{
+	JsonTypeInfo *element;
+	int32		typmod;			/* of the array column, applies to elements */
+	bool		nested_values;	/* json element type: nested arrays are values */
 
-Datum deserialize_record_internal( Oid type_oid, JSONNODE *json_obj, MemoryContext fn_mcxt );
-Datum deserialize_array_internal( Oid type_oid, JSONNODE *json_obj, MemoryContext fn_mcxt );
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int			maxelems;
 
-ArrayType* construct_array_with_nulls(	Datum *elems,
-	bool *nulls, int nelems, Oid elmtype, int elmlen, bool elmbyval, char elmalign );
+	int			ndim;			/* -1 until the first element is seen */
+	int			dims[ MAXDIM ];
+	bool		dims_known[ MAXDIM ];
+} ArrayReadState;
 
-// memory allocator callbacks for libjson
-static void *allocator(unsigned long bytes);
-static void *reallocator(void * buffer, unsigned long bytes);
-static void deallocator(void * buffer);
+static void deserialize_array_level( ArrayReadState *state, JsonParser *parser, int depth );
+static JsonTypeInfo *deserialize_fn_type( FunctionCallInfo fcinfo, Oid type_oid );
+static Datum deserialize_record_set_common( FunctionCallInfo fcinfo, Oid type_oid );
 
-void *allocator(unsigned long bytes)
+/*
+ * Type of the regtype argument, kept in fn_extra. Its child plan reference
+ * caches the row or element plan across calls.
+ */
+static JsonTypeInfo *deserialize_fn_type( FunctionCallInfo fcinfo, Oid type_oid )
 {
-	return palloc( bytes );
-}
+	JsonTypeInfo *type = (JsonTypeInfo *) fcinfo->flinfo->fn_extra;
 
-void *reallocator(void * buffer, unsigned long bytes)
-{
-	return repalloc( buffer, bytes );
-}
+	if (type == NULL)
+	{
+		type = MemoryContextAllocZero( fcinfo->flinfo->fn_mcxt, sizeof( JsonTypeInfo ) );
+		fcinfo->flinfo->fn_extra = type;
+	}
 
-void deallocator(void *buffer)
-{
-	pfree( buffer );
+	if (type->typid != type_oid)
+		json_plan_type_info( type, type_oid, fcinfo->flinfo->fn_mcxt );
+
+	return type;
 }
 
-Datum ConvertFromText( char *value, Oid column_type, MemoryContext fn_mcxt, int4 typmod )
+/*
+ * Read one non-null value of the given type
+ */
+Datum deserialize_value( JsonParser *parser, JsonTypeInfo *type, int32 typmod )
 {
-	Oid         typinput;
-	Oid         typioparam;
-	FmgrInfo    finfo_input;
-
-	getTypeInputInfo(column_type, &typinput, &typioparam);
-	fmgr_info_cxt(typinput, &finfo_input, fn_mcxt);
+	char		c = json_parser_peek( parser );
 
-	return InputFunctionCall( &finfo_input, value, typioparam, typmod );
-}
+	// http://www.postgresql.org/docs/current/static/catalog-pg-type.html#CATALOG-TYPCATEGORY-TABLE
+	if (type->category == 'A' && c == '[')
+		return deserialize_array_internal( parser, type, typmod );
 
-ArrayType* construct_array_with_nulls(	Datum *elems,
-	bool *nulls, int nelems, Oid elmtype, int elmlen, bool elmbyval, char elmalign )
-{
-	int dims[1], lbs[1];
-	dims[0] = nelems;
-	lbs[0] = 1;
+	if (type->category == 'C' && c == '{')
+		return deserialize_record_internal( parser, json_plan_get( &type->child, type->typid, -1, JSON_PLAN_ROW ) );
 
-	return construct_md_array( elems, nulls, 1, dims, lbs,
-		  elmtype, elmlen, elmbyval, elmalign );
+	// just convert from text representation, objects and arrays as raw json
+	return InputFunctionCall( &type->infunc, json_parser_scalar( parser ), type->typioparam, typmod );
 }
 
-Datum deserialize_record_internal( Oid type_oid, JSONNODE *json_obj, MemoryContext fn_mcxt )
+/*
+ * Read an object into values/isnull, which must come in all null. Keys
+ * found, null or not, are marked in seen unless it is NULL.
+ */
+void deserialize_record_fields( JsonParser *parser, JsonPlan *plan, Datum *tuple_values,
+								bool *tuple_isnull, bool *seen )
 {
-	HeapTuple 			type_tuple;
-	Form_pg_attribute *	attrs;
-	int					natts;          /* number of attributes */
-	int4 				typtypmod;
-	TupleDesc			tupdesc;
-	int 				i;
-	HeapTuple 			tuple;
-	Datum *				tuple_values;
-	bool *				tuple_isnull;
-	int4				mem_size;
-
-	if( json_type( json_obj ) != JSON_NODE )
-		elog(ERROR, "non-record type passed to deserialize_record\n" );
+	int					hint = 0;
 
-	/* obtain type information from pg_catalog */
-	type_tuple = SearchSysCache1( TYPEOID, ObjectIdGetDatum( type_oid ) );
-	if( ! HeapTupleIsValid( type_tuple ) )
-		elog(ERROR, "cache lookup failed for relation %u", type_oid);
-
-	typtypmod = ((Form_pg_type) GETSTRUCT( type_tuple ))->typcategory;
-	ReleaseSysCache( type_tuple );
-
-	// get tuple description
-	tupdesc = lookup_rowtype_tupdesc(type_oid, typtypmod);
-	if( ! tupdesc )
-		elog(ERROR, "row type lookup failed for relation %u", type_oid);
+	// values are stored as their keys come along, absent columns stay null
+	if (json_parser_begin( parser, '{', '}' ))
+	{
+		do
+		{
+			const char *		key;
+			int					keylen;
+			JsonColumnPlan *	column;
 
-	attrs = tupdesc->attrs;
-	natts = tupdesc->natts;
+			json_parser_string( parser, &key, &keylen );
+			json_parser_expect( parser, ':' );
 
-	// allocate memory for storing tuple data
-	mem_size = sizeof( Datum ) * natts;
-	tuple_values = palloc( mem_size );
-	memset( tuple_values, 0, mem_size );
+			column = json_plan_find_column( plan, key, keylen, &hint );
 
-	mem_size = sizeof( bool ) * natts;
-	tuple_isnull = palloc( mem_size );
-	memset( tuple_isnull, 1, mem_size );
+			// unknown columns are skipped, for repeated keys the first value wins
+			if (column == NULL || !tuple_isnull[ column->attno ])
+			{
+				json_parser_skip( parser );
+				continue;
+			}
 
-	// iterate over all attributes
-	for( i = 0; i < natts; ++i )
-	{
-		const char *		column_name;
-		JSONNODE *			column_node;
-		Oid		 			column_type = tupdesc->attrs[ i ]->atttypid;
-		json_char * 		column_value;
-		char 				type_category;
-		HeapTuple 			type_tuple;
-
-		/* Ignore dropped columns in datatype */
-		if (attrs[ i ]->attisdropped)
-			continue;
-
-		/* obtain type information from pg_catalog */
-		type_tuple = SearchSysCache1( TYPEOID, ObjectIdGetDatum(column_type) );
-		if (!HeapTupleIsValid( type_tuple ))
-			elog(ERROR, "cache lookup failed for relation %u (record type)", column_type);
-
-		type_category = ((Form_pg_type) GETSTRUCT( type_tuple ))->typcategory;
-		ReleaseSysCache( type_tuple );
-
-		// get column name
-		column_name = SPI_fname( tupdesc, i + 1 );
-
-		column_node = json_get( json_obj, column_name );
-		// don't fill unexistent columns
-		if( ! column_node )
-			continue;
-
-		//check for null
-		if( json_type( column_node ) == JSON_NULL )
-			continue;
-
-		switch( type_category )
-		{
-			// http://www.postgresql.org/docs/current/static/catalog-pg-type.html#CATALOG-TYPCATEGORY-TABLE
-			case 'A': //array
-				tuple_values[ i ] = deserialize_array_internal( column_type, column_node, fn_mcxt );
-			break;
+			if (seen)
+				seen[ column->attno ] = true;
 
-			case 'C': //composite
-				tuple_values[ i ] = deserialize_record_internal( column_type, column_node, fn_mcxt );
-			break;
+			//check for null
+			if (json_parser_null( parser ))
+				continue;
 
-			default: //another
-				// just convert from text representation
-				column_value = json_as_string( column_node );
+			tuple_values[ column->attno ] = deserialize_value( parser, &column->type, column->typmod );
+			tuple_isnull[ column->attno ] = false;
+		} while (json_parser_next( parser, '}' ));
+	}
+}
 
-				tuple_values[ i ] = ConvertFromText( column_value,
-				column_type, fn_mcxt, attrs[i]->atttypmod );
+HeapTuple deserialize_record_tuple( JsonParser *parser, JsonPlan *plan )
+{
+	int					natts = plan->tupdesc->natts;
+	HeapTuple 			tuple;
+	Datum *				tuple_values;
+	bool *				tuple_isnull;
 
-				json_free( column_value );
-		}
-		tuple_isnull[ i ] = false;
-	}
+	// allocate memory for storing tuple data
+	tuple_values = palloc0( sizeof( Datum ) * natts );
+	tuple_isnull = palloc( sizeof( bool ) * natts );
+	memset( tuple_isnull, 1, sizeof( bool ) * natts );
 
-	ReleaseTupleDesc(tupdesc);
+	deserialize_record_fields( parser, plan, tuple_values, tuple_isnull, NULL );
 
 	// create tuple from values and return them
-	tuple = heap_form_tuple( tupdesc, tuple_values, tuple_isnull );
+	tuple = heap_form_tuple( plan->tupdesc, tuple_values, tuple_isnull );
 
 	pfree( tuple_values );
 	pfree( tuple_isnull );
 
-	return HeapTupleGetDatum( tuple );
+	return tuple;
+}
+
+Datum deserialize_record_internal( JsonParser *parser, JsonPlan *plan )
+{
+	return HeapTupleGetDatum( deserialize_record_tuple( parser, plan ) );
 }
 
 
@@ -195,138 +167,153 @@ Datum deserialize_record( PG_FUNCTION_ARGS )
 {
 	text *				json_text;
 	Oid 				type_oid;
-	JSONNODE *			json_obj;
+	JsonTypeInfo *		type;
+	JsonParser			parser;
 	Datum				result;
 
 	// get argument values
 	type_oid = PG_GETARG_OID( 0 );
-	json_text = PG_GETARG_TEXT_P( 1 );
+	json_text = PG_GETARG_TEXT_PP( 1 );
 
-	// set postgreSQL allocators as defaults for libjson
-	json_register_memory_callbacks( allocator, reallocator, deallocator );
+	// the row plan is looked up once and then kept in fn_extra
+	type = deserialize_fn_type( fcinfo, type_oid );
 
-	// parse json
-	json_obj = json_parse( PG_TEXT_GET_CSTR( json_text ) );
+	// parse json in place, values go straight into the tuple
+	json_parser_init( &parser, VARDATA_ANY( json_text ), VARSIZE_ANY_EXHDR( json_text ) );
 
-	if( ! json_obj )
-		elog(ERROR, "error parsing json\n" );
+	result = deserialize_record_internal( &parser, json_plan_get( &type->child, type_oid, -1, JSON_PLAN_ROW ) );
 
-	// call internal function for other processing
-	result = deserialize_record_internal( type_oid, json_obj, fcinfo->flinfo->fn_mcxt );
-
-	json_delete(json_obj);
+	json_parser_finish( &parser );
 
 	PG_RETURN_DATUM( result );
 }
 
-Datum deserialize_array_internal( Oid type_oid, JSONNODE *json_obj, MemoryContext fn_mcxt )
+/*
+ * Read the elements of one array level, recursing into nested arrays
+ */
+static void deserialize_array_level( ArrayReadState *state, JsonParser *parser, int depth )
 {
-	HeapTuple 			type_tuple;
-	char 				type_category;
-	int4				typmod;
-	int2        		typlen;
-	bool        		typbyval;
-	char        		typalign;
-	Oid         		typinput;
-	Oid         		typioparam;
-	FmgrInfo    		finfo_input;
-	Form_pg_type		type_info;
-	json_index_t		arr_size;
-	json_index_t		i;
-	Datum *				arr_elems;
-	bool *				arr_nulls;
-	int4				mem_size;
-	ArrayType *			result;
+	int			count = 0;
 
-	if( json_type( json_obj ) != JSON_ARRAY )
-		elog(ERROR, "non-array type passed to deserialize_array\n" );
+	if (depth >= MAXDIM)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("number of array dimensions exceeds the maximum allowed (%d)", MAXDIM)));
 
-	/* obtain array type information from pg_catalog */
-	type_tuple = SearchSysCache1( TYPEOID, ObjectIdGetDatum( type_oid ) );
-	if( ! HeapTupleIsValid( type_tuple ) )
-		elog(ERROR, "cache lookup failed for relation %u (array type)", type_oid);
-
-	type_oid = ((Form_pg_type)GETSTRUCT( type_tuple ))->typelem;
-	ReleaseSysCache( type_tuple );
-
-	/* obtain array element type information from pg_catalog */
-	type_tuple = SearchSysCache1( TYPEOID, ObjectIdGetDatum( type_oid ) );
-	if( ! HeapTupleIsValid( type_tuple ) )
-		elog(ERROR, "cache lookup failed for relation %u (array element type)", type_oid);
-
-	type_info = (Form_pg_type)GETSTRUCT( type_tuple );
-
-	type_category = type_info->typcategory;
-	typlen = type_info->typlen;
-	typmod = type_info->typtypmod;
-	typbyval = type_info->typbyval;
-	typalign = type_info->typalign;
+	if (json_parser_begin( parser, '[', ']' ))
+	{
+		do
+		{
+			if (!state->nested_values && json_parser_peek( parser ) == '[')
+			{
+				if (state->ndim >= 0 && depth + 1 >= state->ndim)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+							 errmsg("malformed multidimensional array in json")));
+
+				deserialize_array_level( state, parser, depth + 1 );
+				count++;
+				continue;
+			}
+
+			if (state->ndim < 0)
+				state->ndim = depth + 1;
+			else if (state->ndim != depth + 1)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("malformed multidimensional array in json")));
+
+			if (state->nelems == state->maxelems)
+			{
+				state->maxelems *= 2;
+				state->elems = repalloc( state->elems, state->maxelems * sizeof( Datum ) );
+				state->nulls = repalloc( state->nulls, state->maxelems * sizeof( bool ) );
+			}
+
+			//check for null
+			if (json_parser_null( parser ))
+			{
+				state->elems[ state->nelems ] = 0;
+				state->nulls[ state->nelems ] = true;
+			}
+			else
+			{
+				state->elems[ state->nelems ] = deserialize_value( parser, state->element, state->typmod );
+				state->nulls[ state->nelems ] = false;
+			}
+
+			state->nelems++;
+			count++;
+		} while (json_parser_next( parser, ']' ));
+	}
 
-	ReleaseSysCache( type_tuple );
+	if (count == 0 && depth > 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("malformed multidimensional array in json"),
+				 errdetail("Nested arrays must not be empty.")));
 
-	if( type_category != 'C' && type_category != 'A' )
+	if (state->dims_known[ depth ])
+	{
+		if (state->dims[ depth ] != count)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("malformed multidimensional array in json"),
+					 errdetail("Multidimensional arrays must have sub-arrays with matching dimensions.")));
+	}
+	else
 	{
-		// get type input info and prepare context for InputFunc
-		getTypeInputInfo(type_oid, &typinput, &typioparam);
-		fmgr_info_cxt(typinput, &finfo_input, fn_mcxt);
+		state->dims[ depth ] = count;
+		state->dims_known[ depth ] = true;
 	}
+}
 
-	arr_size = json_size( json_obj );
+/*
+ * Read an array of the given array type. The element plan is cached in
+ * the type's child reference, like the serializer's.
+ */
+Datum deserialize_array_internal( JsonParser *parser, JsonTypeInfo *type, int32 typmod )
+{
+	JsonPlan *			plan;
+	ArrayReadState		state;
+	int					lbs[ MAXDIM ];
+	int					i;
+	ArrayType *			result;
 
-	// allocate memory for array elements
-	mem_size = arr_size * sizeof( Datum );
-	arr_elems = palloc( mem_size );
-	memset( arr_elems, 0, mem_size );
+	if (type->elemtype == InvalidOid)
+		elog(ERROR, "non-array type passed to deserialize_array");
 
-	// allocate memory for array "is null" flags
-	mem_size = arr_size * sizeof( bool );
-	arr_nulls = palloc( mem_size );
-	memset( arr_nulls, 0, mem_size );
+	plan = json_plan_get( &type->child, type->elemtype, -1, JSON_PLAN_ARRAY );
 
-	for( i = 0; i < arr_size; ++ i )
-	{
-		JSONNODE *			item_node;
-		json_char * 		item_value;
+	memset( &state, 0, sizeof( state ) );
+	state.element = &plan->element;
+	state.typmod = typmod;
+	state.nested_values = (type->elemtype == JSONOID);
+#ifdef JSONBOID
+	state.nested_values |= (type->elemtype == JSONBOID);
+#endif
 
-		item_node = json_at( json_obj, i );
-		if( ! item_node )
-		{
-			elog(WARNING, "array item %d == nullptr", i); //strange case
-			continue;
-		}
+	state.maxelems = 16;
+	state.elems = palloc( state.maxelems * sizeof( Datum ) );
+	state.nulls = palloc( state.maxelems * sizeof( bool ) );
+	state.ndim = -1;
 
-		//check for null
-		if( json_type( item_node ) == JSON_NULL )
-		{
-			arr_elems[ i ] = 0;
-			arr_nulls[ i ] = true;
-			continue;
-		}
+	deserialize_array_level( &state, parser, 0 );
 
-		arr_nulls[ i ] = false;
+	if (state.nelems == 0)
+		result = construct_empty_array( type->elemtype );
+	else
+	{
+		for (i = 0; i < state.ndim; i++)
+			lbs[ i ] = 1;
 
-		switch( type_category )
-		{
-			// http://www.postgresql.org/docs/current/static/catalog-pg-type.html#CATALOG-TYPCATEGORY-TABLE
-			case 'A': //array - impossible case
-			break;
-
-			case 'C': //composite
-				arr_elems[ i ] = deserialize_record_internal( type_oid, item_node, fn_mcxt );
-			break;
-
-			default: //another
-				// just convert from text representation
-				item_value = json_as_string( item_node );
-				arr_elems[ i ] = InputFunctionCall( &finfo_input, item_value, typioparam, typmod );
-				json_free( item_value );
-		}
+		result = construct_md_array( state.elems, state.nulls, state.ndim, state.dims, lbs,
+									 type->elemtype, plan->element.typlen,
+									 plan->element.typbyval, plan->element.typalign );
 	}
 
-	result = construct_array_with_nulls( arr_elems, arr_nulls, arr_size, type_oid, typlen, typbyval, typalign );
-
-	pfree( arr_elems );
-	pfree( arr_nulls );
+	pfree( state.elems );
+	pfree( state.nulls );
 
 	return PointerGetDatum( result );
 }
@@ -336,28 +323,129 @@ Datum deserialize_array(PG_FUNCTION_ARGS)
 {
 	text *				json_text;
 	Oid 				type_oid;
-	JSONNODE *			json_obj;
+	JsonTypeInfo *		type;
+	JsonParser			parser;
 	Datum				result;
 
 	// get argument values
 	type_oid = PG_GETARG_OID( 0 );
-	json_text = PG_GETARG_TEXT_P( 1 );
+	json_text = PG_GETARG_TEXT_PP( 1 );
 
-	// set postgreSQL allocators as defaults for libjson
-	json_register_memory_callbacks( allocator, reallocator, deallocator );
+	// the element plan is looked up once and then kept in fn_extra
+	type = deserialize_fn_type( fcinfo, type_oid );
 
-	// parse json
-	json_obj = json_parse( PG_TEXT_GET_CSTR( json_text ) );
+	// parse json in place, elements go straight into the array
+	json_parser_init( &parser, VARDATA_ANY( json_text ), VARSIZE_ANY_EXHDR( json_text ) );
 
-	if( ! json_obj )
-		elog(ERROR, "error parsing json\n" );
+	result = deserialize_array_internal( &parser, type, -1 );
 
-	// call internal function for other processing
-	result = deserialize_array_internal( type_oid, json_obj, fcinfo->flinfo->fn_mcxt );
-
-	json_delete(json_obj);
+	json_parser_finish( &parser );
 
 	PG_RETURN_DATUM( result );
 }
 
-#endif // OPTION_WITH_DESERIALIZER
+/*
+ * Rows of a JSON array of objects, parsed in one pass with one plan. Every
+ * row is built in a scratch context and copied into the tuplestore, which
+ * spills to disk past work_mem.
+ */
+static Datum deserialize_record_set_common( FunctionCallInfo fcinfo, Oid type_oid )
+{
+	ReturnSetInfo *		rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	text *				json_text;
+	JsonTypeInfo *		type;
+	JsonPlan *			plan;
+	JsonParser			parser;
+	Tuplestorestate *	tupstore;
+	MemoryContext		oldcontext;
+	MemoryContext		scratch;
+
+	if (rsinfo == NULL || !IsA( rsinfo, ReturnSetInfo ))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	type = deserialize_fn_type( fcinfo, type_oid );
+	plan = json_plan_get( &type->child, type_oid, -1, JSON_PLAN_ROW );
+
+	oldcontext = MemoryContextSwitchTo( rsinfo->econtext->ecxt_per_query_memory );
+
+	tupstore = tuplestore_begin_heap( (rsinfo->allowedModes & SFRM_Materialize_Random) != 0,
+									  false, work_mem );
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = CreateTupleDescCopy( plan->tupdesc );
+
+	MemoryContextSwitchTo( oldcontext );
+
+	// a null document is an empty set
+	if (PG_ARGISNULL( 1 ))
+		return (Datum) 0;
+
+	json_text = PG_GETARG_TEXT_PP( 1 );
+
+	// large documents may be split among parallel workers in the caller's transaction
+	if (json_parallel_record_set( tupstore, plan, VARDATA_ANY( json_text ), VARSIZE_ANY_EXHDR( json_text ) ))
+		return (Datum) 0;
+
+	json_parser_init( &parser, VARDATA_ANY( json_text ), VARSIZE_ANY_EXHDR( json_text ) );
+
+	scratch = AllocSetContextCreate( CurrentMemoryContext,
+									 "from_json_set row",
+									 ALLOCSET_DEFAULT_MINSIZE,
+									 ALLOCSET_DEFAULT_INITSIZE,
+									 ALLOCSET_DEFAULT_MAXSIZE );
+
+	if (json_parser_begin( &parser, '[', ']' ))
+	{
+		do
+		{
+			HeapTuple			tuple;
+
+			oldcontext = MemoryContextSwitchTo( scratch );
+
+			tuple = deserialize_record_tuple( &parser, plan );
+			tuplestore_puttuple( tupstore, tuple );
+
+			MemoryContextSwitchTo( oldcontext );
+			MemoryContextReset( scratch );
+		} while (json_parser_next( &parser, ']' ));
+	}
+
+	json_parser_finish( &parser );
+
+	MemoryContextDelete( scratch );
+
+	return (Datum) 0;
+}
+
+/*
+ * from_json_set( regtype, text ) returns setof record
+ */
+PG_FUNCTION_INFO_V1( deserialize_record_set );
+Datum deserialize_record_set( PG_FUNCTION_ARGS )
+{
+	return deserialize_record_set_common( fcinfo, PG_GETARG_OID( 0 ) );
+}
+
+/*
+ * from_json_set( anyelement, text ) returns setof anyelement
+ *
+ * The row type comes from the type of the first argument, usually a typed
+ * null, so the result needs no column definition list.
+ */
+PG_FUNCTION_INFO_V1( deserialize_record_set_typed );
+Datum deserialize_record_set_typed( PG_FUNCTION_ARGS )
+{
+	Oid					type_oid = get_fn_expr_argtype( fcinfo->flinfo, 0 );
+
+	if (type_oid == InvalidOid)
+		elog(ERROR, "could not determine the row type of from_json_set");
+
+	return deserialize_record_set_common( fcinfo, type_oid );
+}
@@ -0,0 +1,21 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer deserializer entry points shared with the loader
+*/
+
+#ifndef DESERIALIZER_H
+#define DESERIALIZER_H
+
+#include "access/htup.h"
+
+#include "json_parser.h"
+#include "json_plan.h"
+
+extern void deserialize_record_fields( JsonParser *parser, JsonPlan *plan, Datum *tuple_values,
+									   bool *tuple_isnull, bool *seen );
+extern HeapTuple deserialize_record_tuple( JsonParser *parser, JsonPlan *plan );
+extern Datum deserialize_record_internal( JsonParser *parser, JsonPlan *plan );
+extern Datum deserialize_array_internal( JsonParser *parser, JsonTypeInfo *type, int32 typmod );
+extern Datum deserialize_value( JsonParser *parser, JsonTypeInfo *type, int32 typmod );
+
+#endif /* DESERIALIZER_H */
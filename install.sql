@@ -1,54 +1,387 @@
 CREATE OR REPLACE FUNCTION to_json(anyarray)
   RETURNS character varying AS
 'serializer', 'serialize_array'
-  LANGUAGE c IMMUTABLE STRICT
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
   COST 1;
 
 
 CREATE OR REPLACE FUNCTION to_json(record)
   RETURNS character varying AS
 'serializer', 'serialize_record'
-  LANGUAGE c IMMUTABLE STRICT
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
   COST 1;
 
 
+CREATE OR REPLACE FUNCTION to_json(record, columns text[])
+  RETURNS character varying AS
+'serializer', 'serialize_record_columns'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+
+
+CREATE OR REPLACE FUNCTION to_jsonb(anyarray)
+  RETURNS jsonb AS
+'serializer', 'serialize_array_jsonb'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+
+
+CREATE OR REPLACE FUNCTION to_jsonb(record)
+  RETURNS jsonb AS
+'serializer', 'serialize_record_jsonb'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+
+
+CREATE OR REPLACE FUNCTION arr_from_json( regtype, character varying )
+  RETURNS varchar[] AS
+'serializer', 'deserialize_array'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+
+
+CREATE OR REPLACE FUNCTION from_json(regtype, character varying)
+  RETURNS record AS
+'serializer', 'deserialize_record'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+
+
+CREATE OR REPLACE FUNCTION from_json_set( regtype, text )
+  RETURNS SETOF record AS
+'serializer', 'deserialize_record_set'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1 ROWS 1000;
+
+
+CREATE OR REPLACE FUNCTION from_json_set( anyelement, text )
+  RETURNS SETOF anyelement AS
+'serializer', 'deserialize_record_set_typed'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1 ROWS 1000;
+
+
+-- batches hold newline-separated rows; export with psql -At, not COPY text format (see README)
+CREATE OR REPLACE FUNCTION to_jsonl( query text, batch_rows integer DEFAULT 1 )
+  RETURNS SETOF text AS
+'serializer', 'to_jsonl'
+  LANGUAGE c VOLATILE STRICT
+  COST 1 ROWS 1000;
+
+
+CREATE OR REPLACE FUNCTION json_load( target regclass, doc text )
+  RETURNS bigint AS
+'serializer', 'json_load'
+  LANGUAGE c VOLATILE STRICT;
+
+-- superuser only, checked by the function as well
+CREATE OR REPLACE FUNCTION json_load_file( target regclass, path text )
+  RETURNS bigint AS
+'serializer', 'json_load_file'
+  LANGUAGE c VOLATILE STRICT;
+
+REVOKE ALL ON FUNCTION json_load_file( regclass, text ) FROM PUBLIC;
+
+-- superuser only, checked by the function as well
+CREATE OR REPLACE FUNCTION json_export( query text, path text, format text DEFAULT 'lines', compression text DEFAULT 'none' )
+  RETURNS bigint AS
+'serializer', 'json_export'
+  LANGUAGE c VOLATILE STRICT;
+
+REVOKE ALL ON FUNCTION json_export( text, text, text, text ) FROM PUBLIC;
+
+
 CREATE OR REPLACE FUNCTION json_agg_transfn( internal, input_record record, array_name text ) 
   RETURNS internal AS
 'serializer', 'json_agg_transfn'
-  LANGUAGE c IMMUTABLE
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
   COST 1;
 
 CREATE OR REPLACE FUNCTION json_agg_plain_transfn( internal, input_record record, array_name text )
 RETURNS internal AS
 'serializer', 'json_agg_plain_transfn'
-LANGUAGE c IMMUTABLE
+LANGUAGE c IMMUTABLE PARALLEL SAFE
 COST 1;
 
+CREATE OR REPLACE FUNCTION json_agg_transfn( internal, input_record record, array_name text, columns text[] )
+  RETURNS internal AS
+'serializer', 'json_agg_transfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION json_agg_plain_transfn( internal, input_record record, array_name text, columns text[] )
+  RETURNS internal AS
+'serializer', 'json_agg_plain_transfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION json_agg_nested_transfn( internal, input_record record, key_columns text[], path text[] )
+  RETURNS internal AS
+'serializer', 'json_agg_nested_transfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
 CREATE OR REPLACE FUNCTION json_agg_finalfn(internal)
   RETURNS text AS
 'serializer', 'json_agg_finalfn'
-  LANGUAGE c IMMUTABLE
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
   COST 1;
 
 CREATE OR REPLACE FUNCTION json_agg_plain_finalfn(internal)
   RETURNS text AS
 'serializer', 'json_agg_plain_finalfn'
-  LANGUAGE c IMMUTABLE
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION json_agg_nested_finalfn(internal)
+  RETURNS text AS
+'serializer', 'json_agg_nested_finalfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION json_agg_combinefn(internal, internal)
+  RETURNS internal AS
+'serializer', 'json_agg_combinefn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION json_agg_serialfn(internal)
+  RETURNS bytea AS
+'serializer', 'json_agg_serialfn'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION json_agg_deserialfn(bytea, internal)
+  RETURNS internal AS
+'serializer', 'json_agg_deserialfn'
+  LANGUAGE c IMMUTABLE STRICT PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION jsonb_agg_transfn( internal, input_record record, array_name text )
+  RETURNS internal AS
+'serializer', 'jsonb_agg_transfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION jsonb_agg_plain_transfn( internal, input_record record )
+  RETURNS internal AS
+'serializer', 'jsonb_agg_transfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION jsonb_agg_finalfn(internal)
+  RETURNS jsonb AS
+'serializer', 'jsonb_agg_finalfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION jsonb_agg_plain_finalfn(internal)
+  RETURNS jsonb AS
+'serializer', 'jsonb_agg_plain_finalfn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION jsonb_agg_combinefn(internal, internal)
+  RETURNS internal AS
+'serializer', 'jsonb_agg_combinefn'
+  LANGUAGE c IMMUTABLE PARALLEL SAFE
   COST 1;
 
 
 CREATE AGGREGATE json_agg( record, text ) (
   SFUNC=json_agg_transfn,
   STYPE=internal,
-  FINALFUNC=json_agg_finalfn
+  FINALFUNC=json_agg_finalfn,
+  COMBINEFUNC=json_agg_combinefn,
+  SERIALFUNC=json_agg_serialfn,
+  DESERIALFUNC=json_agg_deserialfn,
+  PARALLEL=SAFE
 );
 
 CREATE AGGREGATE json_agg_plain( record, text ) (
   SFUNC=json_agg_plain_transfn,
   STYPE=internal,
-  FINALFUNC=json_agg_plain_finalfn
+  FINALFUNC=json_agg_plain_finalfn,
+  COMBINEFUNC=json_agg_combinefn,
+  SERIALFUNC=json_agg_serialfn,
+  DESERIALFUNC=json_agg_deserialfn,
+  PARALLEL=SAFE
+);
+
+CREATE AGGREGATE json_agg( record, text, text[] ) (
+  SFUNC=json_agg_transfn,
+  STYPE=internal,
+  FINALFUNC=json_agg_finalfn,
+  COMBINEFUNC=json_agg_combinefn,
+  SERIALFUNC=json_agg_serialfn,
+  DESERIALFUNC=json_agg_deserialfn,
+  PARALLEL=SAFE
+);
+
+CREATE AGGREGATE json_agg_plain( record, text, text[] ) (
+  SFUNC=json_agg_plain_transfn,
+  STYPE=internal,
+  FINALFUNC=json_agg_plain_finalfn,
+  COMBINEFUNC=json_agg_combinefn,
+  SERIALFUNC=json_agg_serialfn,
+  DESERIALFUNC=json_agg_deserialfn,
+  PARALLEL=SAFE
 );
 
+-- rows must arrive sorted by the key columns, no partial aggregation
+CREATE AGGREGATE json_agg_nested( record, text[], text[] ) (
+  SFUNC=json_agg_nested_transfn,
+  STYPE=internal,
+  FINALFUNC=json_agg_nested_finalfn,
+  PARALLEL=SAFE
+);
+
+CREATE AGGREGATE jsonb_agg( record, text ) (
+  SFUNC=jsonb_agg_transfn,
+  STYPE=internal,
+  FINALFUNC=jsonb_agg_finalfn,
+  COMBINEFUNC=jsonb_agg_combinefn,
+  SERIALFUNC=json_agg_serialfn,
+  DESERIALFUNC=json_agg_deserialfn,
+  PARALLEL=SAFE
+);
+
+CREATE AGGREGATE jsonb_agg_plain( record ) (
+  SFUNC=jsonb_agg_plain_transfn,
+  STYPE=internal,
+  FINALFUNC=jsonb_agg_plain_finalfn,
+  COMBINEFUNC=jsonb_agg_combinefn,
+  SERIALFUNC=json_agg_serialfn,
+  DESERIALFUNC=json_agg_deserialfn,
+  PARALLEL=SAFE
+);
+
+
+CREATE OR REPLACE FUNCTION json_serializer_stats( shared boolean DEFAULT false,
+  OUT name text, OUT value bigint )
+  RETURNS SETOF record AS
+'serializer', 'json_serializer_stats'
+  LANGUAGE c VOLATILE STRICT;
+
+CREATE OR REPLACE FUNCTION json_serializer_column_stats( shared boolean DEFAULT false,
+  OUT rowtype regtype, OUT column_name text, OUT count bigint, OUT bytes bigint, OUT time_ns bigint )
+  RETURNS SETOF record AS
+'serializer', 'json_serializer_column_stats'
+  LANGUAGE c VOLATILE STRICT;
+
+CREATE OR REPLACE FUNCTION json_serializer_stats_reset( shared boolean DEFAULT false )
+  RETURNS void AS
+'serializer', 'json_serializer_stats_reset'
+  LANGUAGE c VOLATILE STRICT;
+
+CREATE OR REPLACE FUNCTION to_json_cached( regclass, tid )
+  RETURNS character varying AS
+'serializer', 'to_json_cached'
+  LANGUAGE c STABLE STRICT PARALLEL SAFE
+  COST 1;
+
+CREATE OR REPLACE FUNCTION json_serializer_cache_stats(
+  OUT name text, OUT value bigint )
+  RETURNS SETOF record AS
+'serializer', 'json_serializer_cache_stats'
+  LANGUAGE c VOLATILE STRICT;
+
+CREATE OR REPLACE FUNCTION json_serializer_cache_reset()
+  RETURNS void AS
+'serializer', 'json_serializer_cache_reset'
+  LANGUAGE c VOLATILE STRICT;
+
+-- json_agg documents kept up to date by triggers, see json_maintain.c
+CREATE TABLE IF NOT EXISTS json_agg_maintained (
+  docs regclass PRIMARY KEY,
+  source regclass NOT NULL,
+  group_column name NOT NULL,
+  array_name text NOT NULL
+);
+
+CREATE OR REPLACE FUNCTION json_agg_maintain_trigger()
+  RETURNS trigger AS
+'serializer', 'json_agg_maintain_trigger'
+  LANGUAGE c;
+
+CREATE OR REPLACE FUNCTION json_agg_maintain_fill( source regclass, docs regclass, group_column name, array_name text )
+  RETURNS bigint AS
+'serializer', 'json_agg_maintain_fill'
+  LANGUAGE c VOLATILE STRICT;
+
+CREATE OR REPLACE FUNCTION json_agg_maintain( source regclass, group_column name, array_name text, docs_name name DEFAULT NULL )
+  RETURNS regclass AS
+$$
+DECLARE
+  nsp name;
+  rel name;
+  keytype text;
+  target text;
+  result regclass;
+BEGIN
+  SELECT n.nspname, c.relname INTO nsp, rel
+  FROM pg_class c JOIN pg_namespace n ON n.oid = c.relnamespace
+  WHERE c.oid = source;
+
+  SELECT format_type( a.atttypid, a.atttypmod ) INTO keytype
+  FROM pg_attribute a
+  WHERE a.attrelid = source AND a.attname = group_column AND a.attnum > 0 AND NOT a.attisdropped;
+
+  IF keytype IS NULL THEN
+    RAISE EXCEPTION 'column "%" of relation "%" does not exist', group_column, rel
+      USING ERRCODE = 'undefined_column';
+  END IF;
+
+  target := format( '%I.%I', nsp, coalesce( docs_name, rel || '_' || group_column || '_json' ) );
+
+  EXECUTE format( 'CREATE TABLE %s ( group_key %s PRIMARY KEY, doc text NOT NULL, ctids tid[] NOT NULL, positions int4[] NOT NULL, offsets int4[] NOT NULL )',
+                  target, keytype );
+  result := target::regclass;
+
+  INSERT INTO json_agg_maintained VALUES ( result, source, group_column, array_name );
+
+  -- the triggers lock out writers of source until the documents are filled
+  EXECUTE format( 'CREATE TRIGGER %I AFTER INSERT OR UPDATE OR DELETE ON %s FOR EACH ROW EXECUTE PROCEDURE json_agg_maintain_trigger( %L, %L, %L )',
+                  result::oid || '_json_agg_row', source, target, group_column, array_name );
+  EXECUTE format( 'CREATE TRIGGER %I AFTER TRUNCATE ON %s FOR EACH STATEMENT EXECUTE PROCEDURE json_agg_maintain_trigger( %L, %L, %L )',
+                  result::oid || '_json_agg_truncate', source, target, group_column, array_name );
+
+  PERFORM json_agg_maintain_fill( source, result, group_column, array_name );
+
+  RETURN result;
+END
+$$ LANGUAGE plpgsql VOLATILE STRICT
+  SET search_path FROM CURRENT;
+
+-- rebuilds the documents, needed after VACUUM FULL or CLUSTER of the source
+CREATE OR REPLACE FUNCTION json_agg_maintain_refresh( docs_table regclass )
+  RETURNS bigint AS
+$$
+DECLARE
+  r json_agg_maintained;
+BEGIN
+  SELECT * INTO STRICT r FROM json_agg_maintained m WHERE m.docs = docs_table;
+
+  EXECUTE format( 'LOCK TABLE %s IN SHARE ROW EXCLUSIVE MODE', r.source );
+  EXECUTE format( 'DELETE FROM %s', r.docs );
 
+  RETURN json_agg_maintain_fill( r.source, r.docs, r.group_column, r.array_name );
+END
+$$ LANGUAGE plpgsql VOLATILE STRICT
+  SET search_path FROM CURRENT;
 
+CREATE OR REPLACE FUNCTION json_agg_unmaintain( docs_table regclass )
+  RETURNS void AS
+$$
+DECLARE
+  r json_agg_maintained;
+BEGIN
+  SELECT * INTO STRICT r FROM json_agg_maintained m WHERE m.docs = docs_table;
 
+  EXECUTE format( 'DROP TRIGGER %I ON %s', r.docs::oid || '_json_agg_row', r.source );
+  EXECUTE format( 'DROP TRIGGER %I ON %s', r.docs::oid || '_json_agg_truncate', r.source );
+  DELETE FROM json_agg_maintained m WHERE m.docs = docs_table;
+  EXECUTE format( 'DROP TABLE %s', r.docs );
+END
+$$ LANGUAGE plpgsql VOLATILE STRICT
+  SET search_path FROM CURRENT;
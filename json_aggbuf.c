@@ -0,0 +1,246 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer chunked aggregate output buffer
+*
+* Replaces the single doubling StringInfo of the aggregate state, which
+* copied every byte O(log n) times, peaked at twice the output size and
+* failed at 1GB. Output is kept as a list of chunks and moved to a
+* temporary file once it passes work_mem; the final function assembles
+* it with one allocation of the exact size.
+*/
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+
+#include "json_aggbuf.h"
+#include "json_stats.h"
+
+static void json_aggbuf_new_tail( JsonAggBuf *buf );
+static void json_aggbuf_write_file( JsonAggBuf *buf, const char *data, int len );
+static void json_aggbuf_spill( JsonAggBuf *buf );
+
+/*
+ * Start an empty tail of exactly one chunk plus the terminator, in the
+ * current context. enlargeStringInfo would round it up to the next power
+ * of two and leave every chunk half empty.
+ */
+static void json_aggbuf_new_tail( JsonAggBuf *buf )
+{
+	buf->tail.data = (char *) palloc( JSON_AGGBUF_CHUNK_SIZE + 1 );
+	buf->tail.maxlen = JSON_AGGBUF_CHUNK_SIZE + 1;
+	buf->tail.len = 0;
+	buf->tail.cursor = 0;
+	buf->tail.data[ 0 ] = '\0';
+}
+
+void json_aggbuf_init( JsonAggBuf *buf, MemoryContext cxt )
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo( cxt );
+
+	buf->cxt = cxt;
+	json_aggbuf_new_tail( buf );
+	buf->head = NULL;
+	buf->last = NULL;
+	buf->chunk_bytes = 0;
+	buf->file = NULL;
+	buf->file_bytes = 0;
+	buf->spill_limit = work_mem * 1024L;
+
+	MemoryContextSwitchTo( oldcontext );
+}
+
+static void json_aggbuf_write_file( JsonAggBuf *buf, const char *data, int len )
+{
+	if (BufFileWrite( buf->file, (void *) data, len ) != (size_t) len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to json_agg temporary file: %m")));
+
+	buf->file_bytes += len;
+}
+
+/*
+ * Move the chunks held in memory to the temporary file
+ */
+static void json_aggbuf_spill( JsonAggBuf *buf )
+{
+	if (buf->file == NULL)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo( buf->cxt );
+
+		JSON_STATS_COUNT( agg_spills, 1 );
+
+		buf->file = BufFileCreateTemp( false );
+
+		MemoryContextSwitchTo( oldcontext );
+	}
+
+	while (buf->head != NULL)
+	{
+		JsonAggChunk *chunk = buf->head;
+
+		json_aggbuf_write_file( buf, chunk->data, chunk->len );
+
+		buf->head = chunk->next;
+		pfree( chunk->data );
+		pfree( chunk );
+	}
+
+	buf->last = NULL;
+	buf->chunk_bytes = 0;
+}
+
+/*
+ * Called after appending to the tail: a full tail is written out when
+ * spilling, or becomes a chunk and a fresh tail is started.
+ */
+void json_aggbuf_seal( JsonAggBuf *buf )
+{
+	JsonAggChunk *chunk;
+	MemoryContext oldcontext;
+
+	if (buf->tail.len < JSON_AGGBUF_CHUNK_SIZE)
+		return;
+
+	if (buf->file != NULL)
+	{
+		json_aggbuf_write_file( buf, buf->tail.data, buf->tail.len );
+		resetStringInfo( &buf->tail );
+		return;
+	}
+
+	oldcontext = MemoryContextSwitchTo( buf->cxt );
+
+	chunk = (JsonAggChunk *) palloc( sizeof( JsonAggChunk ) );
+	chunk->next = NULL;
+	chunk->data = buf->tail.data;
+	chunk->len = buf->tail.len;
+
+	if (buf->last != NULL)
+		buf->last->next = chunk;
+	else
+		buf->head = chunk;
+	buf->last = chunk;
+	buf->chunk_bytes += chunk->len;
+
+	JSON_STATS_COUNT( agg_chunks, 1 );
+
+	json_aggbuf_new_tail( buf );
+
+	MemoryContextSwitchTo( oldcontext );
+
+	if (buf->chunk_bytes > buf->spill_limit)
+		json_aggbuf_spill( buf );
+}
+
+void json_aggbuf_append( JsonAggBuf *buf, const char *data, int64 len )
+{
+	while (len > 0)
+	{
+		/* the tail is always below the chunk size between calls */
+		int			part = (int) Min( len, (int64) (JSON_AGGBUF_CHUNK_SIZE - buf->tail.len) );
+
+		appendBinaryStringInfo( &buf->tail, data, part );
+		json_aggbuf_seal( buf );
+
+		data += part;
+		len -= part;
+	}
+}
+
+/*
+ * Append the whole content of src, which is left untouched
+ */
+void json_aggbuf_append_buf( JsonAggBuf *buf, JsonAggBuf *src )
+{
+	JsonAggChunk *chunk;
+
+	if (src->file != NULL)
+	{
+		char	   *block = palloc( JSON_AGGBUF_CHUNK_SIZE );
+		int			fileno;
+		off_t		offset;
+		int64		remaining = src->file_bytes;
+
+		BufFileTell( src->file, &fileno, &offset );
+
+		if (BufFileSeek( src->file, 0, 0L, SEEK_SET ) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not rewind json_agg temporary file: %m")));
+
+		while (remaining > 0)
+		{
+			size_t		part = (size_t) Min( remaining, (int64) JSON_AGGBUF_CHUNK_SIZE );
+
+			if (BufFileRead( src->file, block, part ) != part)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not read json_agg temporary file: %m")));
+
+			json_aggbuf_append( buf, block, part );
+			remaining -= part;
+		}
+
+		/* later appends to src continue at its end */
+		if (BufFileSeek( src->file, fileno, offset, SEEK_SET ) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not seek json_agg temporary file: %m")));
+
+		pfree( block );
+	}
+
+	for (chunk = src->head; chunk != NULL; chunk = chunk->next)
+		json_aggbuf_append( buf, chunk->data, chunk->len );
+
+	json_aggbuf_append( buf, src->tail.data, src->tail.len );
+}
+
+int64 json_aggbuf_size( JsonAggBuf *buf )
+{
+	return buf->file_bytes + buf->chunk_bytes + buf->tail.len;
+}
+
+/*
+ * Copy the whole content to dst, which has room for json_aggbuf_size
+ * bytes. The buffer stays usable, window aggregates keep appending.
+ */
+void json_aggbuf_copy( JsonAggBuf *buf, char *dst )
+{
+	JsonAggChunk *chunk;
+
+	if (buf->file != NULL)
+	{
+		int			fileno;
+		off_t		offset;
+
+		BufFileTell( buf->file, &fileno, &offset );
+
+		if (BufFileSeek( buf->file, 0, 0L, SEEK_SET ) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not rewind json_agg temporary file: %m")));
+
+		if (BufFileRead( buf->file, dst, buf->file_bytes ) != (size_t) buf->file_bytes)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read json_agg temporary file: %m")));
+
+		if (BufFileSeek( buf->file, fileno, offset, SEEK_SET ) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not seek json_agg temporary file: %m")));
+
+		dst += buf->file_bytes;
+	}
+
+	for (chunk = buf->head; chunk != NULL; chunk = chunk->next)
+	{
+		memcpy( dst, chunk->data, chunk->len );
+		dst += chunk->len;
+	}
+
+	memcpy( dst, buf->tail.data, buf->tail.len );
+}
@@ -0,0 +1,47 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer chunked aggregate output buffer
+*/
+
+#ifndef JSON_AGGBUF_H
+#define JSON_AGGBUF_H
+
+#include "lib/stringinfo.h"
+#include "storage/buffile.h"
+
+/* a tail that reaches this size is sealed into a chunk */
+#define JSON_AGGBUF_CHUNK_SIZE	(64 * 1024)
+
+typedef struct JsonAggChunk
+{
+	struct JsonAggChunk *next;
+	char	   *data;
+	int			len;
+} JsonAggChunk;
+
+/*
+ * Output accumulated by an aggregate. Writers append into tail and call
+ * json_aggbuf_seal afterwards. Full tails become chunks, so bytes are
+ * never copied by buffer growth. Past work_mem the chunks are moved to
+ * a temporary file, which then holds the beginning of the output.
+ */
+typedef struct JsonAggBuf
+{
+	MemoryContext cxt;
+	StringInfoData tail;
+	JsonAggChunk *head;			/* sealed chunks still in memory */
+	JsonAggChunk *last;
+	int64		chunk_bytes;	/* bytes in head..last */
+	BufFile    *file;			/* spilled output, NULL until work_mem is exceeded */
+	int64		file_bytes;
+	int64		spill_limit;
+} JsonAggBuf;
+
+extern void json_aggbuf_init( JsonAggBuf *buf, MemoryContext cxt );
+extern void json_aggbuf_seal( JsonAggBuf *buf );
+extern void json_aggbuf_append( JsonAggBuf *buf, const char *data, int64 len );
+extern void json_aggbuf_append_buf( JsonAggBuf *buf, JsonAggBuf *src );
+extern int64 json_aggbuf_size( JsonAggBuf *buf );
+extern void json_aggbuf_copy( JsonAggBuf *buf, char *dst );
+
+#endif /* JSON_AGGBUF_H */
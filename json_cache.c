@@ -0,0 +1,653 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer shared cache of serialized rows
+*
+* to_json_cached( regclass, tid ) returns the JSON of a table row and keeps
+* it in shared memory, so hot rows are serialized once for all backends.
+* A row version never changes in place: an update or delete leaves it
+* behind and the new version has another ctid and xmin, so entries are
+* keyed by (relfilenode, ctid, xmin) and never need invalidating. The
+* relfilenode rather than the table oid keeps rows moved by VACUUM FULL
+* or CLUSTER apart. The key also holds JsonPlan.version, for rowtypes
+* altered since, nested ones included, and a hash of the settings output
+* functions depend on (DateStyle, IntervalStyle, TimeZone,
+* extra_float_digits, bytea_output, lc_monetary).
+*
+* The cache is json_serializer.cache_size of shared memory, set up only
+* with serializer in shared_preload_libraries. It is split into 16
+* partitions by key hash, each with its own LWLock: lookups take it
+* shared, so readers of different rows or of the same row do not wait
+* for each other. Texts are stored in 256 byte chunks linked per entry.
+* When a partition runs out of chunks or entries, a clock hand passes over
+* its entries clearing their reference bits, and evicts the first one
+* found clear, which approximates LRU without touching a list on hits.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgtime.h"
+#include "access/hash.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "catalog/pg_class.h"
+#include "port/atomics.h"
+#include "storage/bufmgr.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/bytea.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/pg_locale.h"
+#include "utils/rel.h"
+#include "utils/rls.h"
+#include "utils/snapmgr.h"
+#include "utils/tuplestore.h"
+
+#include "serializer.h"
+#include "json_cache.h"
+#include "json_stats.h"
+
+#define JSON_CACHE_PARTITIONS	16
+#define JSON_CACHE_CHUNK		256
+
+typedef struct JsonCacheKey
+{
+	RelFileNode node;
+	ItemPointerData tid;
+	TransactionId xmin;
+	uint32		version;		/* JsonPlan.version of the rowtype */
+	uint32		settings;		/* see json_cache_settings */
+} JsonCacheKey;
+
+typedef struct JsonCacheEntry
+{
+	JsonCacheKey key;
+	int32		slot;
+} JsonCacheEntry;
+
+typedef struct JsonCacheSlot
+{
+	JsonCacheKey key;
+	uint32		hashcode;
+	int32		len;			/* text length, -1 when the slot is free */
+	int32		next;			/* first chunk, or next free slot */
+	bool		used;			/* reference bit of the clock */
+} JsonCacheSlot;
+
+typedef struct JsonCachePartition
+{
+	LWLock	   *lock;
+	int32		nentries;
+	int32		hand;			/* next slot the clock looks at */
+	int32		free_slot;
+	int32		free_chunk;
+	int32		nfree_chunks;
+
+	pg_atomic_uint64 hits;
+	pg_atomic_uint64 misses;
+	pg_atomic_uint64 inserts;
+	pg_atomic_uint64 evictions;
+	pg_atomic_uint64 too_large;
+} JsonCachePartition;
+
+/* slots and chunks are numbered across partitions, nslots per partition */
+typedef struct JsonCacheShared
+{
+	int32		nslots;
+	JsonCachePartition partitions[ JSON_CACHE_PARTITIONS ];
+} JsonCacheShared;
+
+int json_cache_size = 0;
+
+static JsonCacheShared *json_cache_shared = NULL;
+static JsonCacheSlot *json_cache_slots = NULL;
+static int32 *json_cache_links = NULL;
+static char *json_cache_chunks = NULL;
+static HTAB *json_cache_hash = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+Datum to_json_cached( PG_FUNCTION_ARGS );
+Datum json_serializer_cache_stats( PG_FUNCTION_ARGS );
+Datum json_serializer_cache_reset( PG_FUNCTION_ARGS );
+
+static int32 json_cache_nslots( void );
+static Size json_cache_shmem_size( void );
+static void json_cache_shmem_startup( void );
+
+void json_cache_init( void )
+{
+	DefineCustomIntVariable( "json_serializer.cache_size",
+							 "Sets the shared memory used to cache the output of to_json_cached.",
+							 "Zero disables the cache.",
+							 &json_cache_size,
+							 0,
+							 0,
+							 MAX_KILOBYTES,
+							 PGC_POSTMASTER,
+							 GUC_UNIT_KB,
+							 NULL, NULL, NULL );
+
+	if (!process_shared_preload_libraries_in_progress || json_cache_nslots() == 0)
+		return;
+
+	RequestAddinShmemSpace( json_cache_shmem_size() );
+	RequestNamedLWLockTranche( "json_serializer cache", JSON_CACHE_PARTITIONS );
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = json_cache_shmem_startup;
+}
+
+static int32 json_cache_nslots( void )
+{
+	Size		nslots = (Size) json_cache_size * 1024 / JSON_CACHE_PARTITIONS / JSON_CACHE_CHUNK;
+
+	/* too small to hold anything useful */
+	if (nslots < 16)
+		return 0;
+
+	return (int32) Min( nslots, PG_INT32_MAX / JSON_CACHE_PARTITIONS );
+}
+
+static Size json_cache_shmem_size( void )
+{
+	Size		total = mul_size( json_cache_nslots(), JSON_CACHE_PARTITIONS );
+	Size		size;
+
+	size = MAXALIGN( sizeof( JsonCacheShared ) );
+	size = add_size( size, MAXALIGN( mul_size( total, sizeof( JsonCacheSlot ) ) ) );
+	size = add_size( size, MAXALIGN( mul_size( total, sizeof( int32 ) ) ) );
+	size = add_size( size, mul_size( total, JSON_CACHE_CHUNK ) );
+	size = add_size( size, hash_estimate_size( total, sizeof( JsonCacheEntry ) ) );
+
+	return size;
+}
+
+static void json_cache_shmem_startup( void )
+{
+	int32		nslots = json_cache_nslots();
+	Size		total = (Size) nslots * JSON_CACHE_PARTITIONS;
+	HASHCTL		ctl;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire( AddinShmemInitLock, LW_EXCLUSIVE );
+
+	json_cache_shared = ShmemInitStruct( "json_serializer cache", sizeof( JsonCacheShared ), &found );
+	json_cache_slots = ShmemInitStruct( "json_serializer cache slots", total * sizeof( JsonCacheSlot ), &found );
+	json_cache_links = ShmemInitStruct( "json_serializer cache links", total * sizeof( int32 ), &found );
+	json_cache_chunks = ShmemInitStruct( "json_serializer cache chunks", total * JSON_CACHE_CHUNK, &found );
+
+	if (!found)
+	{
+		LWLockPadded *locks = GetNamedLWLockTranche( "json_serializer cache" );
+		int			p;
+		int32		i;
+
+		json_cache_shared->nslots = nslots;
+
+		for (p = 0; p < JSON_CACHE_PARTITIONS; p++)
+		{
+			JsonCachePartition *part = &json_cache_shared->partitions[ p ];
+			int32		first = p * nslots;
+
+			part->lock = &locks[ p ].lock;
+			part->nentries = 0;
+			part->hand = first;
+			part->free_slot = first;
+			part->free_chunk = first;
+			part->nfree_chunks = nslots;
+
+			pg_atomic_init_u64( &part->hits, 0 );
+			pg_atomic_init_u64( &part->misses, 0 );
+			pg_atomic_init_u64( &part->inserts, 0 );
+			pg_atomic_init_u64( &part->evictions, 0 );
+			pg_atomic_init_u64( &part->too_large, 0 );
+
+			for (i = first; i < first + nslots; i++)
+			{
+				json_cache_slots[ i ].len = -1;
+				json_cache_slots[ i ].next = i + 1 < first + nslots ? i + 1 : -1;
+				json_cache_links[ i ] = i + 1 < first + nslots ? i + 1 : -1;
+			}
+		}
+	}
+
+	MemSet( &ctl, 0, sizeof( ctl ) );
+	ctl.keysize = sizeof( JsonCacheKey );
+	ctl.entrysize = sizeof( JsonCacheEntry );
+	ctl.hash = tag_hash;
+	ctl.num_partitions = JSON_CACHE_PARTITIONS;
+
+	json_cache_hash = ShmemInitHash( "json_serializer cache hash", total, total,
+									 &ctl, HASH_ELEM | HASH_FUNCTION | HASH_PARTITION );
+
+	LWLockRelease( AddinShmemInitLock );
+}
+
+static inline JsonCachePartition *json_cache_partition( uint32 hashcode )
+{
+	return &json_cache_shared->partitions[ hashcode % JSON_CACHE_PARTITIONS ];
+}
+
+/*
+ * Settings that change what output functions print
+ */
+static uint32 json_cache_settings( void )
+{
+	const char *tz = pg_get_timezone_name( session_timezone );
+	uint32		styles = (uint32) DateStyle | (uint32) DateOrder << 4 | (uint32) IntervalStyle << 8 |
+						 (uint32) bytea_output << 12 | (uint32) (extra_float_digits + 16) << 16;
+
+	/* money prints its currency symbol and separators from the locale */
+	return DatumGetUInt32( hash_any( (const unsigned char *) tz, strlen( tz ) ) ) ^
+		   DatumGetUInt32( hash_any( (const unsigned char *) locale_monetary, strlen( locale_monetary ) ) ) ^
+		   DatumGetUInt32( hash_uint32( styles ) );
+}
+
+/*
+ * Copy of the cached text, or NULL. Readers share the partition lock and
+ * set the reference bit without a lock of their own: losing a race only
+ * makes the clock pass over an entry once more or once less.
+ */
+static text *json_cache_lookup( JsonCacheKey *key, uint32 hashcode )
+{
+	JsonCachePartition *part = json_cache_partition( hashcode );
+	JsonCacheEntry *entry;
+	JsonCacheSlot *slot;
+	text	   *result;
+	char	   *p;
+	int32		chunk;
+	int32		left;
+
+	LWLockAcquire( part->lock, LW_SHARED );
+
+	entry = (JsonCacheEntry *) hash_search_with_hash_value( json_cache_hash, key, hashcode, HASH_FIND, NULL );
+	if (entry == NULL)
+	{
+		LWLockRelease( part->lock );
+		pg_atomic_fetch_add_u64( &part->misses, 1 );
+		return NULL;
+	}
+
+	slot = &json_cache_slots[ entry->slot ];
+	slot->used = true;
+
+	result = (text *) palloc( VARHDRSZ + slot->len );
+	SET_VARSIZE( result, VARHDRSZ + slot->len );
+
+	p = VARDATA( result );
+	left = slot->len;
+	for (chunk = slot->next; left > 0; chunk = json_cache_links[ chunk ])
+	{
+		int			n = Min( left, JSON_CACHE_CHUNK );
+
+		memcpy( p, json_cache_chunks + (Size) chunk * JSON_CACHE_CHUNK, n );
+		p += n;
+		left -= n;
+	}
+
+	LWLockRelease( part->lock );
+	pg_atomic_fetch_add_u64( &part->hits, 1 );
+
+	return result;
+}
+
+/*
+ * Drop one entry, the partition lock is held exclusively
+ */
+static void json_cache_remove( JsonCachePartition *part, int32 index )
+{
+	JsonCacheSlot *slot = &json_cache_slots[ index ];
+	int32		last = slot->next;
+	int32		nchunks = 1;
+
+	hash_search_with_hash_value( json_cache_hash, &slot->key, slot->hashcode, HASH_REMOVE, NULL );
+
+	while (nchunks * JSON_CACHE_CHUNK < slot->len)
+	{
+		last = json_cache_links[ last ];
+		nchunks++;
+	}
+
+	json_cache_links[ last ] = part->free_chunk;
+	part->free_chunk = slot->next;
+	part->nfree_chunks += nchunks;
+
+	slot->len = -1;
+	slot->next = part->free_slot;
+	part->free_slot = index;
+	part->nentries--;
+}
+
+/*
+ * Move the clock hand until it finds an entry not used since it last
+ * passed, and evict that. Two rounds always find one.
+ */
+static bool json_cache_evict( JsonCachePartition *part, int32 first )
+{
+	int32		nslots = json_cache_shared->nslots;
+	int32		i;
+
+	for (i = 0; i < 2 * nslots; i++)
+	{
+		int32		index = part->hand;
+		JsonCacheSlot *slot = &json_cache_slots[ index ];
+
+		part->hand = index + 1 < first + nslots ? index + 1 : first;
+
+		if (slot->len < 0)
+			continue;
+
+		if (slot->used)
+		{
+			slot->used = false;
+			continue;
+		}
+
+		json_cache_remove( part, index );
+		pg_atomic_fetch_add_u64( &part->evictions, 1 );
+		return true;
+	}
+
+	return false;
+}
+
+static void json_cache_insert( JsonCacheKey *key, uint32 hashcode, const char *data, int32 len )
+{
+	JsonCachePartition *part = json_cache_partition( hashcode );
+	int32		first = (hashcode % JSON_CACHE_PARTITIONS) * json_cache_shared->nslots;
+	int32		nchunks = Max( (len + JSON_CACHE_CHUNK - 1) / JSON_CACHE_CHUNK, 1 );
+	JsonCacheEntry *entry;
+	JsonCacheSlot *slot;
+	int32		index;
+	int32		chunk;
+	int32		left;
+	bool		found;
+
+	/* a single row may take an eighth of its partition */
+	if (nchunks > json_cache_shared->nslots / 8)
+	{
+		pg_atomic_fetch_add_u64( &part->too_large, 1 );
+		return;
+	}
+
+	LWLockAcquire( part->lock, LW_EXCLUSIVE );
+
+	while (part->free_slot < 0 || part->nfree_chunks < nchunks)
+	{
+		if (!json_cache_evict( part, first ))
+		{
+			LWLockRelease( part->lock );
+			return;
+		}
+	}
+
+	/* another backend may have added it meanwhile */
+	entry = (JsonCacheEntry *) hash_search_with_hash_value( json_cache_hash, key, hashcode, HASH_ENTER_NULL, &found );
+	if (entry == NULL || found)
+	{
+		LWLockRelease( part->lock );
+		return;
+	}
+
+	index = part->free_slot;
+	slot = &json_cache_slots[ index ];
+	part->free_slot = slot->next;
+
+	slot->key = *key;
+	slot->hashcode = hashcode;
+	slot->len = len;
+	slot->next = part->free_chunk;
+	slot->used = false;
+
+	left = len;
+	chunk = part->free_chunk;
+	for (;;)
+	{
+		int			n = Min( left, JSON_CACHE_CHUNK );
+
+		memcpy( json_cache_chunks + (Size) chunk * JSON_CACHE_CHUNK, data, n );
+		data += n;
+		left -= n;
+
+		if (left <= 0)
+			break;
+
+		chunk = json_cache_links[ chunk ];
+	}
+
+	part->free_chunk = json_cache_links[ chunk ];
+	part->nfree_chunks -= nchunks;
+	part->nentries++;
+
+	entry->slot = index;
+
+	LWLockRelease( part->lock );
+	pg_atomic_fetch_add_u64( &part->inserts, 1 );
+}
+
+/*
+ * to_json_cached( regclass, tid ) returns character varying
+ *
+ * JSON of the row version at tid, null when it is not visible to the
+ * current snapshot. Works without the cache too, then it only saves the
+ * whole-row reference of to_json( t ).
+ */
+PG_FUNCTION_INFO_V1( to_json_cached );
+Datum to_json_cached( PG_FUNCTION_ARGS )
+{
+	Oid			relid = PG_GETARG_OID( 0 );
+	ItemPointer tid = PG_GETARG_ITEMPOINTER( 1 );
+	JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+	Relation	rel;
+	HeapTupleData tuple;
+	Buffer		buffer;
+	JsonPlan   *plan;
+	JsonCacheKey key;
+	uint32		hashcode = 0;
+	text	   *result = NULL;
+
+	JSON_STATS_COUNT( record_calls, 1 );
+
+	rel = heap_open( relid, AccessShareLock );
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION && rel->rd_rel->relkind != RELKIND_MATVIEW)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a table", RelationGetRelationName( rel ))));
+
+	if (pg_class_aclcheck( relid, GetUserId(), ACL_SELECT ) != ACLCHECK_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("permission denied for relation %s", RelationGetRelationName( rel ))));
+
+	/* a ctid bypasses the policies a query would apply */
+	if (check_enable_rls( relid, InvalidOid, false ) == RLS_ENABLED)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("to_json_cached does not support row level security on \"%s\"",
+						RelationGetRelationName( rel ))));
+
+	if (!ItemPointerIsValid( tid ) ||
+		ItemPointerGetBlockNumber( tid ) >= RelationGetNumberOfBlocks( rel ))
+	{
+		heap_close( rel, AccessShareLock );
+		PG_RETURN_NULL();
+	}
+
+	tuple.t_self = *tid;
+	if (!heap_fetch( rel, GetActiveSnapshot(), &tuple, &buffer, false, NULL ))
+	{
+		heap_close( rel, AccessShareLock );
+		PG_RETURN_NULL();
+	}
+
+	plan = json_plan_get( &fn->ref, RelationGetDescr( rel )->tdtypeid, -1, JSON_PLAN_ROW );
+
+	if (json_cache_shared != NULL)
+	{
+		MemSet( &key, 0, sizeof( key ) );
+		key.node = rel->rd_node;
+		key.tid = tuple.t_self;
+		key.xmin = HeapTupleHeaderGetRawXmin( tuple.t_data );
+		key.version = plan->version;
+		key.settings = json_cache_settings();
+
+		hashcode = get_hash_value( json_cache_hash, &key );
+		result = json_cache_lookup( &key, hashcode );
+	}
+
+	if (result == NULL)
+	{
+		StringInfoData buf;
+		MemoryContext oldcontext;
+
+		json_text_init( &buf );
+
+		/* toasted columns are fetched into scratch */
+		oldcontext = MemoryContextSwitchTo( fn->scratch );
+		json_write_tuple( &buf, plan, &tuple );
+		MemoryContextSwitchTo( oldcontext );
+		MemoryContextReset( fn->scratch );
+
+		result = json_text_finish( &buf );
+
+		if (json_cache_shared != NULL)
+			json_cache_insert( &key, hashcode, VARDATA( result ), VARSIZE( result ) - VARHDRSZ );
+	}
+
+	ReleaseBuffer( buffer );
+	heap_close( rel, AccessShareLock );
+
+	JSON_STATS_COUNT( output_bytes, VARSIZE( result ) - VARHDRSZ );
+
+	PG_RETURN_TEXT_P( result );
+}
+
+/*
+ * json_serializer_cache_stats() returns table ( name text, value bigint )
+ */
+PG_FUNCTION_INFO_V1( json_serializer_cache_stats );
+Datum json_serializer_cache_stats( PG_FUNCTION_ARGS )
+{
+	static const char *const names[] = {
+		"size_bytes", "entries", "hits", "misses", "inserts", "evictions", "too_large"
+	};
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+	MemoryContext oldcontext;
+	int64		values[ lengthof( names ) ];
+	int			i;
+
+	if (rsinfo == NULL || !IsA( rsinfo, ReturnSetInfo ))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type( fcinfo, NULL, &tupdesc ) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldcontext = MemoryContextSwitchTo( rsinfo->econtext->ecxt_per_query_memory );
+
+	tupdesc = CreateTupleDescCopy( tupdesc );
+	tupstore = tuplestore_begin_heap( true, false, work_mem );
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo( oldcontext );
+
+	MemSet( values, 0, sizeof( values ) );
+
+	if (json_cache_shared != NULL)
+	{
+		values[ 0 ] = (int64) json_cache_shared->nslots * JSON_CACHE_PARTITIONS * JSON_CACHE_CHUNK;
+
+		for (i = 0; i < JSON_CACHE_PARTITIONS; i++)
+		{
+			JsonCachePartition *part = &json_cache_shared->partitions[ i ];
+
+			LWLockAcquire( part->lock, LW_SHARED );
+			values[ 1 ] += part->nentries;
+			LWLockRelease( part->lock );
+
+			values[ 2 ] += pg_atomic_read_u64( &part->hits );
+			values[ 3 ] += pg_atomic_read_u64( &part->misses );
+			values[ 4 ] += pg_atomic_read_u64( &part->inserts );
+			values[ 5 ] += pg_atomic_read_u64( &part->evictions );
+			values[ 6 ] += pg_atomic_read_u64( &part->too_large );
+		}
+	}
+
+	for (i = 0; i < lengthof( names ); i++)
+	{
+		Datum		row[ 2 ];
+		bool		nulls[ 2 ] = { false, false };
+
+		row[ 0 ] = CStringGetTextDatum( names[ i ] );
+		row[ 1 ] = Int64GetDatum( values[ i ] );
+
+		tuplestore_putvalues( tupstore, tupdesc, row, nulls );
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * json_serializer_cache_reset() drops every entry and zeroes the counters.
+ * Stale entries age out by themselves, this only frees them at once.
+ */
+PG_FUNCTION_INFO_V1( json_serializer_cache_reset );
+Datum json_serializer_cache_reset( PG_FUNCTION_ARGS )
+{
+	int32		nslots;
+	int			p;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to reset the json_serializer cache")));
+
+	if (json_cache_shared == NULL)
+		PG_RETURN_VOID();
+
+	nslots = json_cache_shared->nslots;
+
+	for (p = 0; p < JSON_CACHE_PARTITIONS; p++)
+	{
+		JsonCachePartition *part = &json_cache_shared->partitions[ p ];
+		int32		i;
+
+		LWLockAcquire( part->lock, LW_EXCLUSIVE );
+
+		for (i = p * nslots; i < (p + 1) * nslots; i++)
+		{
+			if (json_cache_slots[ i ].len >= 0)
+				json_cache_remove( part, i );
+		}
+
+		pg_atomic_write_u64( &part->hits, 0 );
+		pg_atomic_write_u64( &part->misses, 0 );
+		pg_atomic_write_u64( &part->inserts, 0 );
+		pg_atomic_write_u64( &part->evictions, 0 );
+		pg_atomic_write_u64( &part->too_large, 0 );
+
+		LWLockRelease( part->lock );
+	}
+
+	PG_RETURN_VOID();
+}
@@ -0,0 +1,13 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer shared cache of serialized rows
+*/
+
+#ifndef JSON_CACHE_H
+#define JSON_CACHE_H
+
+extern int json_cache_size;
+
+extern void json_cache_init( void );
+
+#endif /* JSON_CACHE_H */
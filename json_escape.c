@@ -0,0 +1,176 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer string escaping kernel
+*
+* Finds the bytes that need escaping ('"', '\' and control characters
+* below 0x20) 16 bytes at a time with SSE2, or 32 bytes at a time with
+* AVX2 when the CPU supports it, so that clean runs can be copied to the
+* output in bulk. Other platforms use the scalar table lookup.
+*/
+
+#include <string.h>
+
+#include "json_escape.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define JSON_ESCAPE_X86 1
+#include <immintrin.h>
+#endif
+
+static const char json_hex_chars[] = "0123456789abcdef";
+
+/* non-zero for bytes that need escaping, the value is the short escape if any */
+static const unsigned char json_escape_table[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 'b', 't', 'n', 1, 1, 'r', 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0
+	/* the rest is zero */
+};
+
+size_t json_escape_clean_prefix_scalar( const char *str, size_t len )
+{
+	const unsigned char *s = (const unsigned char *) str;
+	size_t		i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (json_escape_table[ s[ i ] ])
+			break;
+	}
+
+	return i;
+}
+
+#ifdef JSON_ESCAPE_X86
+
+static size_t json_escape_clean_prefix_sse2( const char *str, size_t len )
+{
+	const __m128i quote = _mm_set1_epi8( '"' );
+	const __m128i bslash = _mm_set1_epi8( '\\' );
+	const __m128i ctrl = _mm_set1_epi8( 0x1f );
+	size_t		i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i		v = _mm_loadu_si128( (const __m128i *) (str + i) );
+		__m128i		m;
+		int			mask;
+
+		/* max(v, 0x1f) == 0x1f exactly for bytes <= 0x1f (unsigned) */
+		m = _mm_or_si128( _mm_cmpeq_epi8( v, quote ), _mm_cmpeq_epi8( v, bslash ) );
+		m = _mm_or_si128( m, _mm_cmpeq_epi8( _mm_max_epu8( v, ctrl ), ctrl ) );
+
+		mask = _mm_movemask_epi8( m );
+		if (mask != 0)
+			return i + __builtin_ctz( mask );
+	}
+
+	return i + json_escape_clean_prefix_scalar( str + i, len - i );
+}
+
+__attribute__((target("avx2")))
+static size_t json_escape_clean_prefix_avx2( const char *str, size_t len )
+{
+	const __m256i quote = _mm256_set1_epi8( '"' );
+	const __m256i bslash = _mm256_set1_epi8( '\\' );
+	const __m256i ctrl = _mm256_set1_epi8( 0x1f );
+	size_t		i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i		v = _mm256_loadu_si256( (const __m256i *) (str + i) );
+		__m256i		m;
+		unsigned int mask;
+
+		m = _mm256_or_si256( _mm256_cmpeq_epi8( v, quote ), _mm256_cmpeq_epi8( v, bslash ) );
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi8( _mm256_max_epu8( v, ctrl ), ctrl ) );
+
+		mask = (unsigned int) _mm256_movemask_epi8( m );
+		if (mask != 0)
+			return i + __builtin_ctz( mask );
+	}
+
+	return i + json_escape_clean_prefix_sse2( str + i, len - i );
+}
+
+static size_t json_escape_clean_prefix_choose( const char *str, size_t len );
+
+static size_t (*json_escape_clean_prefix_impl)( const char *, size_t ) = json_escape_clean_prefix_choose;
+
+/* first call picks the implementation for this CPU */
+static size_t json_escape_clean_prefix_choose( const char *str, size_t len )
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports( "avx2" ))
+		json_escape_clean_prefix_impl = json_escape_clean_prefix_avx2;
+	else
+		json_escape_clean_prefix_impl = json_escape_clean_prefix_sse2;
+
+	return json_escape_clean_prefix_impl( str, len );
+}
+
+size_t json_escape_clean_prefix( const char *str, size_t len )
+{
+	/* short strings (keys, small values) are not worth a vector setup */
+	if (len < 16)
+		return json_escape_clean_prefix_scalar( str, len );
+
+	return json_escape_clean_prefix_impl( str, len );
+}
+
+#else
+
+size_t json_escape_clean_prefix( const char *str, size_t len )
+{
+	return json_escape_clean_prefix_scalar( str, len );
+}
+
+#endif /* JSON_ESCAPE_X86 */
+
+int json_escape_char( unsigned char c, char *dst )
+{
+	unsigned char	e = json_escape_table[ c ];
+
+	dst[ 0 ] = '\\';
+
+	if (e > 1)
+	{
+		dst[ 1 ] = (char) e;
+		return 2;
+	}
+
+	dst[ 1 ] = 'u';
+	dst[ 2 ] = '0';
+	dst[ 3 ] = '0';
+	dst[ 4 ] = json_hex_chars[ c >> 4 ];
+	dst[ 5 ] = json_hex_chars[ c & 0xf ];
+	return 6;
+}
+
+size_t json_escape_buf( char *dst, const char *str, size_t len )
+{
+	char	   *out = dst;
+
+	while (len > 0)
+	{
+		size_t		clean = json_escape_clean_prefix( str, len );
+
+		memcpy( out, str, clean );
+		out += clean;
+		str += clean;
+		len -= clean;
+
+		if (len == 0)
+			break;
+
+		out += json_escape_char( (unsigned char) *str, out );
+		str++;
+		len--;
+	}
+
+	return out - dst;
+}
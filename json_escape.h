@@ -0,0 +1,35 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer string escaping kernel
+*
+* Kept free of backend dependencies so it can be linked into standalone
+* programs as well as into the extension.
+*/
+
+#ifndef JSON_ESCAPE_H
+#define JSON_ESCAPE_H
+
+#include <stddef.h>
+
+/* longest escape sequence produced for one input byte: \u00XX */
+#define JSON_ESCAPE_MAX_SEQ 6
+
+/*
+ * Length of the leading run of str[0..len) that can be copied to the
+ * output as is, i.e. contains no '"', '\' or bytes below 0x20.
+ */
+extern size_t json_escape_clean_prefix( const char *str, size_t len );
+
+/* portable implementation, also used for tails shorter than a vector */
+extern size_t json_escape_clean_prefix_scalar( const char *str, size_t len );
+
+/* write the escape sequence of a byte that needs escaping, returns its length */
+extern int json_escape_char( unsigned char c, char *dst );
+
+/*
+ * Escape str[0..len) into dst, which must have room for
+ * len * JSON_ESCAPE_MAX_SEQ bytes. Returns the number of bytes written.
+ */
+extern size_t json_escape_buf( char *dst, const char *str, size_t len );
+
+#endif /* JSON_ESCAPE_H */
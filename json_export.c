@@ -0,0 +1,486 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer export of a query result to a server file
+*
+* json_export( query, path, format, compression ) runs the query through a
+* cursor and writes its rows as JSON Lines or as one JSON array straight
+* into a file on the server, optionally as an lz4 or zstd stream. Output
+* is collected in large aligned batches and written whole; after each
+* write the kernel is asked to start writing the batch back, so the disk
+* works on one batch while the next one is serialized.
+*
+* The compressors are the extension's own build options, not the server's:
+* "make WITH_LZ4=1 WITH_ZSTD=1" defines HAVE_LZ4 and HAVE_ZSTD and links
+* liblz4 and libzstd.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "executor/spi.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "serializer.h"
+#include "json_stats.h"
+
+Datum json_export( PG_FUNCTION_ARGS );
+
+/* output batch, written in one call and aligned for the page cache */
+#define JSON_EXPORT_BATCH		(1024 * 1024)
+#define JSON_EXPORT_ALIGN		4096
+
+/* rows fetched from the cursor at a time */
+#define JSON_EXPORT_FETCH		1000
+
+/* input handed to the compressor at a time, bounds its worst-case output */
+#define JSON_EXPORT_INPUT		(64 * 1024)
+
+#define JSON_EXPORT_NONE		0
+#define JSON_EXPORT_LZ4			1
+#define JSON_EXPORT_ZSTD		2
+
+typedef struct JsonExportWriter
+{
+	const char *path;
+	int			fd;
+	off_t		offset;			/* file bytes written so far */
+	char	   *batch;			/* JSON_EXPORT_BATCH bytes, aligned */
+	int			used;
+	int			compression;
+#ifdef HAVE_LZ4
+	LZ4F_compressionContext_t lz4;
+	size_t		lz4_bound;		/* worst-case output of JSON_EXPORT_INPUT bytes */
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx  *zstd;
+#endif
+} JsonExportWriter;
+
+/*
+ * Write out the batch. pg_flush_data starts the writeback of what was just
+ * written without waiting for it, so dirty pages do not pile up and the
+ * next batch is serialized while the device is busy with this one.
+ */
+static void json_export_flush( JsonExportWriter *w )
+{
+	char	   *p = w->batch;
+	int			left = w->used;
+
+	while (left > 0)
+	{
+		ssize_t		written = write( w->fd, p, left );
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write to file \"%s\": %m", w->path)));
+		}
+
+		if (written == 0)
+		{
+			/* no error reported, most likely out of space */
+			errno = ENOSPC;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write to file \"%s\": %m", w->path)));
+		}
+
+		p += written;
+		left -= written;
+	}
+
+	pg_flush_data( w->fd, w->offset, w->used );
+
+	w->offset += w->used;
+	w->used = 0;
+}
+
+/* make room for len more bytes in the batch */
+static void json_export_reserve( JsonExportWriter *w, size_t len )
+{
+	if (w->used + len > JSON_EXPORT_BATCH)
+		json_export_flush( w );
+}
+
+static void json_export_write( JsonExportWriter *w, const char *data, size_t len )
+{
+	while (len > 0)
+	{
+		size_t		chunk = Min( len, JSON_EXPORT_INPUT );
+
+		switch( w->compression )
+		{
+#ifdef HAVE_LZ4
+			case JSON_EXPORT_LZ4:
+			{
+				size_t		n;
+
+				json_export_reserve( w, w->lz4_bound );
+
+				n = LZ4F_compressUpdate( w->lz4, w->batch + w->used, JSON_EXPORT_BATCH - w->used,
+										 data, chunk, NULL );
+				if (LZ4F_isError( n ))
+					ereport(ERROR,
+							(errmsg("could not compress data: %s", LZ4F_getErrorName( n ))));
+
+				w->used += n;
+			}
+			break;
+#endif
+
+#ifdef HAVE_ZSTD
+			case JSON_EXPORT_ZSTD:
+			{
+				ZSTD_inBuffer in = { data, chunk, 0 };
+
+				while (in.pos < in.size)
+				{
+					ZSTD_outBuffer out;
+					size_t		n;
+
+					json_export_reserve( w, ZSTD_CStreamOutSize() );
+
+					out.dst = w->batch + w->used;
+					out.size = JSON_EXPORT_BATCH - w->used;
+					out.pos = 0;
+
+					n = ZSTD_compressStream2( w->zstd, &out, &in, ZSTD_e_continue );
+					if (ZSTD_isError( n ))
+						ereport(ERROR,
+								(errmsg("could not compress data: %s", ZSTD_getErrorName( n ))));
+
+					w->used += out.pos;
+				}
+			}
+			break;
+#endif
+
+			default:
+				json_export_reserve( w, chunk );
+				memcpy( w->batch + w->used, data, chunk );
+				w->used += chunk;
+		}
+
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+/* end the compressed stream and write out the rest */
+static void json_export_finish( JsonExportWriter *w )
+{
+	switch( w->compression )
+	{
+#ifdef HAVE_LZ4
+		case JSON_EXPORT_LZ4:
+		{
+			size_t		n;
+
+			json_export_reserve( w, w->lz4_bound );
+
+			n = LZ4F_compressEnd( w->lz4, w->batch + w->used, JSON_EXPORT_BATCH - w->used, NULL );
+			if (LZ4F_isError( n ))
+				ereport(ERROR,
+						(errmsg("could not end compression: %s", LZ4F_getErrorName( n ))));
+
+			w->used += n;
+		}
+		break;
+#endif
+
+#ifdef HAVE_ZSTD
+		case JSON_EXPORT_ZSTD:
+		{
+			ZSTD_inBuffer in = { NULL, 0, 0 };
+			size_t		remaining;
+
+			do
+			{
+				ZSTD_outBuffer out;
+
+				json_export_reserve( w, ZSTD_CStreamOutSize() );
+
+				out.dst = w->batch + w->used;
+				out.size = JSON_EXPORT_BATCH - w->used;
+				out.pos = 0;
+
+				remaining = ZSTD_compressStream2( w->zstd, &out, &in, ZSTD_e_end );
+				if (ZSTD_isError( remaining ))
+					ereport(ERROR,
+							(errmsg("could not end compression: %s", ZSTD_getErrorName( remaining ))));
+
+				w->used += out.pos;
+			} while (remaining > 0);
+		}
+		break;
+#endif
+
+		default:
+			break;
+	}
+
+	json_export_flush( w );
+}
+
+/* compression contexts are malloc'ed by the libraries */
+static void json_export_free( JsonExportWriter *w )
+{
+#ifdef HAVE_LZ4
+	if (w->lz4 != NULL)
+		LZ4F_freeCompressionContext( w->lz4 );
+	w->lz4 = NULL;
+#endif
+#ifdef HAVE_ZSTD
+	if (w->zstd != NULL)
+		ZSTD_freeCCtx( w->zstd );
+	w->zstd = NULL;
+#endif
+}
+
+static int json_export_compression( const char *name )
+{
+	if (strcmp( name, "none" ) == 0)
+		return JSON_EXPORT_NONE;
+
+	if (strcmp( name, "lz4" ) == 0)
+	{
+#ifdef HAVE_LZ4
+		return JSON_EXPORT_LZ4;
+#else
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("serializer was not built with lz4 support"),
+				 errhint("Rebuild the extension with \"make WITH_LZ4=1\".")));
+#endif
+	}
+	else if (strcmp( name, "zstd" ) == 0)
+	{
+#ifdef HAVE_ZSTD
+		return JSON_EXPORT_ZSTD;
+#else
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("serializer was not built with zstd support"),
+				 errhint("Rebuild the extension with \"make WITH_ZSTD=1\".")));
+#endif
+	}
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized compression \"%s\"", name),
+				 errhint("Valid values are \"none\", \"lz4\" and \"zstd\".")));
+
+	return JSON_EXPORT_NONE;	/* keep compiler quiet */
+}
+
+static void json_export_start( JsonExportWriter *w )
+{
+	switch( w->compression )
+	{
+#ifdef HAVE_LZ4
+		case JSON_EXPORT_LZ4:
+		{
+			size_t		n = LZ4F_createCompressionContext( &w->lz4, LZ4F_VERSION );
+
+			if (LZ4F_isError( n ))
+				ereport(ERROR,
+						(errmsg("could not create lz4 compression context: %s", LZ4F_getErrorName( n ))));
+
+			w->lz4_bound = LZ4F_compressBound( JSON_EXPORT_INPUT, NULL );
+
+			n = LZ4F_compressBegin( w->lz4, w->batch, JSON_EXPORT_BATCH, NULL );
+			if (LZ4F_isError( n ))
+				ereport(ERROR,
+						(errmsg("could not begin compression: %s", LZ4F_getErrorName( n ))));
+
+			w->used = n;
+		}
+		break;
+#endif
+
+#ifdef HAVE_ZSTD
+		case JSON_EXPORT_ZSTD:
+			w->zstd = ZSTD_createCCtx();
+			if (w->zstd == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_OUT_OF_MEMORY),
+						 errmsg("could not create zstd compression context")));
+		break;
+#endif
+
+		default:
+			break;
+	}
+}
+
+/* writing server files is reserved to superusers, as for COPY TO a file */
+static void json_export_check_access( void )
+{
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to export to a file")));
+}
+
+/*
+ * json_export( query text, path text, format text, compression text )
+ * returns bigint, the number of rows written
+ *
+ * format is 'lines' (one object per line) or 'array'; compression is
+ * 'none', 'lz4' (frame format) or 'zstd', the latter two when the
+ * extension was built with them. The file is created or truncated.
+ */
+PG_FUNCTION_INFO_V1( json_export );
+Datum json_export( PG_FUNCTION_ARGS )
+{
+	char	   *query = text_to_cstring( PG_GETARG_TEXT_PP(0) );
+	char	   *path = text_to_cstring( PG_GETARG_TEXT_PP(1) );
+	char	   *format = text_to_cstring( PG_GETARG_TEXT_PP(2) );
+	char	   *compression = text_to_cstring( PG_GETARG_TEXT_PP(3) );
+	JsonExportWriter w;
+	StringInfoData buf;
+	MemoryContext cxt = CurrentMemoryContext;
+	MemoryContext scratch;
+	MemoryContext oldcontext;
+	JsonPlan   *plan;
+	Portal		portal;
+	bool		array;
+	int64		nrows = 0;
+	instr_time	start;
+
+	json_export_check_access();
+
+	if (strcmp( format, "lines" ) == 0)
+		array = false;
+	else if (strcmp( format, "array" ) == 0)
+		array = true;
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized format \"%s\"", format),
+				 errhint("Valid formats are \"lines\" and \"array\".")));
+
+	/* as for COPY, a relative path would land in the data directory */
+	if (!is_absolute_path( path ))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_NAME),
+				 errmsg("relative path not allowed for json_export")));
+
+	JSON_STATS_TIMER_START( start );
+
+	MemSet( &w, 0, sizeof( w ) );
+	w.path = path;
+	w.compression = json_export_compression( compression );
+	w.batch = (char *) TYPEALIGN( JSON_EXPORT_ALIGN, palloc( JSON_EXPORT_BATCH + JSON_EXPORT_ALIGN ) );
+
+	/* closed by the resource owner if we fail */
+	w.fd = OpenTransientFile( path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+							  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+	if (w.fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for writing: %m", path)));
+
+	scratch = AllocSetContextCreate( cxt,
+									 "json_export batch",
+									 ALLOCSET_DEFAULT_MINSIZE,
+									 ALLOCSET_DEFAULT_INITSIZE,
+									 ALLOCSET_DEFAULT_MAXSIZE );
+
+	/* rows of one fetch are serialized together and handed over at once */
+	initStringInfo( &buf );
+
+	PG_TRY();
+	{
+		json_export_start( &w );
+
+		if (array)
+			json_export_write( &w, "[\n", 2 );
+
+		if (SPI_connect() != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect failed");
+
+		portal = SPI_cursor_open_with_args( NULL, query, 0, NULL, NULL, NULL,
+											false, CURSOR_OPT_NO_SCROLL );
+
+		plan = json_plan_build_row( portal->tupDesc, cxt );
+
+		for (;;)
+		{
+			uint64		i;
+
+			SPI_cursor_fetch( portal, true, JSON_EXPORT_FETCH );
+
+			if (SPI_processed == 0)
+				break;
+
+			oldcontext = MemoryContextSwitchTo( scratch );
+
+			for (i = 0; i < SPI_processed; i++)
+			{
+				/* one row per line in both formats */
+				if (array && nrows + i > 0)
+					appendStringInfoString( &buf, ",\n" );
+
+				json_write_tuple( &buf, plan, SPI_tuptable->vals[ i ] );
+
+				if (!array)
+					appendStringInfoChar( &buf, '\n' );
+			}
+
+			MemoryContextSwitchTo( oldcontext );
+			MemoryContextReset( scratch );
+
+			json_export_write( &w, buf.data, buf.len );
+			JSON_STATS_COUNT( output_bytes, buf.len );
+			resetStringInfo( &buf );
+
+			nrows += SPI_processed;
+			SPI_freetuptable( SPI_tuptable );
+		}
+
+		SPI_cursor_close( portal );
+		SPI_finish();
+
+		if (array)
+			json_export_write( &w, "\n]\n", 3 );
+
+		json_export_finish( &w );
+	}
+	PG_CATCH();
+	{
+		json_export_free( &w );
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	json_export_free( &w );
+
+	if (CloseTransientFile( w.fd ) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", path)));
+
+	MemoryContextDelete( scratch );
+	MemoryContextDelete( plan->cxt );
+
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	PG_RETURN_INT64( nrows );
+}
@@ -0,0 +1,355 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer jsonb output
+*
+* to_jsonb( record ) and to_jsonb( anyarray ) walk the same plans as the
+* text serializer, but push JsonbValues into a JsonbParseState, so the
+* result is binary jsonb without printing and reparsing it. Integers and
+* numerics go in as numerics directly, floats through the shortest
+* round-trip digits the text serializer prints.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "utils/builtins.h"
+#include "utils/jsonb.h"
+#include "utils/memutils.h"
+#include "utils/numeric.h"
+
+#include "serializer.h"
+#include "json_numfmt.h"
+#include "json_stats.h"
+
+Datum serialize_record_jsonb( PG_FUNCTION_ARGS );
+Datum serialize_array_jsonb( PG_FUNCTION_ARGS );
+
+static void jsonb_push_value( JsonbParseState **state, JsonbIteratorToken token,
+							  Datum value, JsonTypeInfo *type );
+static JsonbValue *jsonb_push_tuple( JsonbParseState **state, JsonPlan *plan, HeapTuple tuple );
+
+static void jsonb_push_string( JsonbParseState **state, JsonbIteratorToken token,
+							   const char *str, int len )
+{
+	JsonbValue	v;
+
+	if (len > JENTRY_OFFLENMASK)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("string too long to represent as jsonb string"),
+				 errdetail("Due to an implementation restriction, jsonb strings cannot exceed %d bytes.",
+						   JENTRY_OFFLENMASK)));
+
+	v.type = jbvString;
+	v.val.string.val = (char *) str;
+	v.val.string.len = len;
+
+	pushJsonbValue( state, token, &v );
+}
+
+/* NaN and infinities have no JSON number, they become strings like in to_json */
+static void jsonb_push_special( JsonbParseState **state, JsonbIteratorToken token, int code )
+{
+	const char *quoted = json_special_number( code );
+
+	jsonb_push_string( state, token, quoted + 1, strlen( quoted ) - 2 );
+}
+
+static void jsonb_push_number( JsonbParseState **state, JsonbIteratorToken token,
+							   Datum value, JsonTypeInfo *type )
+{
+	JsonbValue	v;
+	char		buf[ JSON_NUMFMT_BUFLEN + 1 ];
+	char	   *result;
+	int			len;
+
+	v.type = jbvNumeric;
+
+	switch( type->typid )
+	{
+		case INT2OID:
+			v.val.numeric = DatumGetNumeric( DirectFunctionCall1( int2_numeric, value ) );
+		break;
+
+		case INT4OID:
+			v.val.numeric = DatumGetNumeric( DirectFunctionCall1( int4_numeric, value ) );
+		break;
+
+		case INT8OID:
+			v.val.numeric = DatumGetNumeric( DirectFunctionCall1( int8_numeric, value ) );
+		break;
+
+		case FLOAT4OID:
+		case FLOAT8OID:
+			if (type->typid == FLOAT4OID)
+				len = json_format_float( buf, DatumGetFloat4( value ) );
+			else
+				len = json_format_double( buf, DatumGetFloat8( value ) );
+
+			if (len < 0)
+			{
+				jsonb_push_special( state, token, len );
+				return;
+			}
+
+			buf[ len ] = '\0';
+			v.val.numeric = DatumGetNumeric( DirectFunctionCall3( numeric_in, CStringGetDatum( buf ),
+																  ObjectIdGetDatum( InvalidOid ),
+																  Int32GetDatum( -1 ) ) );
+		break;
+
+		case NUMERICOID:
+			v.val.numeric = DatumGetNumeric( value );
+
+			if (numeric_is_nan( v.val.numeric ))
+			{
+				jsonb_push_special( state, token, JSON_NUM_NAN );
+				return;
+			}
+		break;
+
+		default:
+			/* oid, money, reg*: a number when the output reads as one */
+			result = ConvertToText( value, &type->outfunc );
+
+			if (!json_is_number( result ))
+			{
+				jsonb_push_string( state, token, result, strlen( result ) );
+				return;
+			}
+
+			v.val.numeric = DatumGetNumeric( DirectFunctionCall3( numeric_in, CStringGetDatum( result ),
+																  ObjectIdGetDatum( InvalidOid ),
+																  Int32GetDatum( -1 ) ) );
+	}
+
+	pushJsonbValue( state, token, &v );
+}
+
+/*
+ * token is WJB_VALUE inside objects and WJB_ELEM inside arrays, containers
+ * are opened in its place
+ */
+static void jsonb_push_value( JsonbParseState **state, JsonbIteratorToken token,
+							  Datum value, JsonTypeInfo *type )
+{
+	JsonbValue	v;
+	char	   *result;
+
+	switch( type->category )
+	{
+		case 'A': //array
+			jsonb_push_array( state, DatumGetArrayTypeP( value ), &type->child );
+		break;
+
+		case 'C': //composite
+			jsonb_push_record( state, DatumGetHeapTupleHeader( value ), &type->child );
+		break;
+
+		case 'N': //numeric
+			jsonb_push_number( state, token, value, type );
+		break;
+
+		case 'B': //boolean
+			v.type = jbvBool;
+			v.val.boolean = DatumGetBool( value );
+			pushJsonbValue( state, token, &v );
+		break;
+
+		default: //another
+			result = ConvertToText( value, &type->outfunc );
+			jsonb_push_string( state, token, result, strlen( result ) );
+	}
+}
+
+static JsonbValue *jsonb_push_tuple( JsonbParseState **state, JsonPlan *plan, HeapTuple tuple )
+{
+	Datum	   *values;
+	bool	   *nulls;
+	int			i;
+
+	JSON_STATS_COUNT( rows, 1 );
+	plan->stats->counters.values++;
+
+	values = (Datum *) palloc( plan->tupdesc->natts * sizeof( Datum ) );
+	nulls = (bool *) palloc( plan->tupdesc->natts * sizeof( bool ) );
+
+	heap_deform_tuple( tuple, plan->tupdesc, values, nulls );
+
+	pushJsonbValue( state, WJB_BEGIN_OBJECT, NULL );
+
+	/* null columns are left out, as in to_json */
+	for (i = 0; i < plan->ncolumns; i++)
+	{
+		JsonColumnPlan *column = &plan->columns[ i ];
+
+		if (nulls[ column->attno ])
+			continue;
+
+		if (column->stats)
+			column->stats->counters.values++;
+
+		jsonb_push_string( state, WJB_KEY, column->name, column->namelen );
+		jsonb_push_value( state, WJB_VALUE, values[ column->attno ], &column->type );
+	}
+
+	return pushJsonbValue( state, WJB_END_OBJECT, NULL );
+}
+
+JsonbValue *jsonb_push_record( JsonbParseState **state, HeapTupleHeader rec, JsonPlanRef *ref )
+{
+	HeapTupleData tuple;
+	JsonPlan   *plan = json_plan_get( ref, HeapTupleHeaderGetTypeId( rec ),
+									  HeapTupleHeaderGetTypMod( rec ), JSON_PLAN_ROW );
+
+	tuple.t_len = HeapTupleHeaderGetDatumLength( rec );
+	ItemPointerSetInvalid( &tuple.t_self );
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = rec;
+
+	return jsonb_push_tuple( state, plan, &tuple );
+}
+
+/*
+ * Multidimensional arrays become nested arrays, walked like in
+ * json_write_array
+ */
+JsonbValue *jsonb_push_array( JsonbParseState **state, ArrayType *v, JsonPlanRef *ref )
+{
+	JsonPlan   *plan;
+	JsonbValue *result = NULL;
+	JsonbValue	null;
+	char	   *p;
+	bits8	   *bitmap;
+	int			bitmask;
+	int			nitems, i;
+	int			ndim, *dims;
+	int			indx[ MAXDIM ];
+	int			d, k;
+
+	ndim = ARR_NDIM( v );
+	dims = ARR_DIMS( v );
+	nitems = ArrayGetNItems( ndim, dims );
+
+	if (nitems == 0)
+	{
+		pushJsonbValue( state, WJB_BEGIN_ARRAY, NULL );
+		return pushJsonbValue( state, WJB_END_ARRAY, NULL );
+	}
+
+	plan = json_plan_get( ref, ARR_ELEMTYPE( v ), -1, JSON_PLAN_ARRAY );
+
+	p = ARR_DATA_PTR( v );
+	bitmap = ARR_NULLBITMAP( v );
+	bitmask = 1;
+
+	null.type = jbvNull;
+
+	for (d = 0; d < ndim; d++)
+	{
+		indx[ d ] = 0;
+		pushJsonbValue( state, WJB_BEGIN_ARRAY, NULL );
+	}
+
+	for (i = 0; i < nitems; i++)
+	{
+		if (bitmap && (*bitmap & bitmask) == 0)
+			pushJsonbValue( state, WJB_ELEM, &null );
+		else
+		{
+			Datum		itemvalue = fetch_att( p, plan->element.typbyval, plan->element.typlen );
+
+			p = att_addlength_pointer( p, plan->element.typlen, p );
+			p = (char *) att_align_nominal( p, plan->element.typalign );
+
+			jsonb_push_value( state, WJB_ELEM, itemvalue, &plan->element );
+		}
+
+		if (bitmap)
+		{
+			bitmask <<= 1;
+			if (bitmask == 0x100)
+			{
+				bitmap++;
+				bitmask = 1;
+			}
+		}
+
+		/* close the dimensions that are complete, then reopen them */
+		for (d = ndim - 1; d >= 0; d--)
+		{
+			if (++indx[ d ] < dims[ d ])
+				break;
+
+			result = pushJsonbValue( state, WJB_END_ARRAY, NULL );
+			indx[ d ] = 0;
+		}
+
+		if (d >= 0 && d < ndim - 1)
+		{
+			for (k = d + 1; k < ndim; k++)
+				pushJsonbValue( state, WJB_BEGIN_ARRAY, NULL );
+		}
+	}
+
+	return result;
+}
+
+//----------------------------------------------------------
+
+/*
+ * The value is built in scratch, only the binary result is allocated in
+ * the caller's context
+ */
+PG_FUNCTION_INFO_V1( serialize_record_jsonb );
+Datum serialize_record_jsonb( PG_FUNCTION_ARGS )
+{
+	JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+	JsonbParseState *state = NULL;
+	JsonbValue *value;
+	Jsonb	   *result;
+	MemoryContext oldcontext;
+	instr_time	start;
+
+	JSON_STATS_COUNT( record_calls, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	oldcontext = MemoryContextSwitchTo( fn->scratch );
+	value = jsonb_push_record( &state, PG_GETARG_HEAPTUPLEHEADER(0), &fn->ref );
+	MemoryContextSwitchTo( oldcontext );
+
+	result = JsonbValueToJsonb( value );
+	MemoryContextReset( fn->scratch );
+
+	JSON_STATS_COUNT( output_bytes, VARSIZE( result ) - VARHDRSZ );
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	PG_RETURN_POINTER( result );
+}
+
+PG_FUNCTION_INFO_V1( serialize_array_jsonb );
+Datum serialize_array_jsonb( PG_FUNCTION_ARGS )
+{
+	JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+	JsonbParseState *state = NULL;
+	JsonbValue *value;
+	Jsonb	   *result;
+	MemoryContext oldcontext;
+	instr_time	start;
+
+	JSON_STATS_COUNT( array_calls, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	oldcontext = MemoryContextSwitchTo( fn->scratch );
+	value = jsonb_push_array( &state, PG_GETARG_ARRAYTYPE_P(0), &fn->ref );
+	MemoryContextSwitchTo( oldcontext );
+
+	result = JsonbValueToJsonb( value );
+	MemoryContextReset( fn->scratch );
+
+	JSON_STATS_COUNT( output_bytes, VARSIZE( result ) - VARHDRSZ );
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	PG_RETURN_POINTER( result );
+}
@@ -0,0 +1,142 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer JSON Lines export over a query cursor
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include "serializer.h"
+
+Datum to_jsonl( PG_FUNCTION_ARGS );
+
+typedef struct JsonLinesState
+{
+	char	   *portal_name;
+	int			batch_rows;
+	JsonPlan   *plan;			/* built once for the result descriptor */
+	MemoryContext scratch;		/* reset after every batch */
+} JsonLinesState;
+
+/* close the cursor when the caller stops reading early */
+static void to_jsonl_shutdown( Datum arg )
+{
+	JsonLinesState *state = (JsonLinesState *) DatumGetPointer( arg );
+	Portal		portal = SPI_cursor_find( state->portal_name );
+
+	if (portal != NULL)
+		SPI_cursor_close( portal );
+}
+
+/*
+ * to_jsonl( query text, batch_rows int ) returns setof text
+ *
+ * Runs the query through a cursor and returns its rows as JSON Lines,
+ * one result per batch of batch_rows rows, so memory stays bounded by the
+ * batch however large the result is.
+ */
+PG_FUNCTION_INFO_V1( to_jsonl );
+Datum to_jsonl( PG_FUNCTION_ARGS )
+{
+	FuncCallContext *funcctx;
+	JsonLinesState *state;
+	MemoryContext oldcontext;
+	Portal		portal;
+	StringInfoData buf;
+	uint64		i;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		char	   *query = text_to_cstring( PG_GETARG_TEXT_PP(0) );
+		int			batch_rows = PG_GETARG_INT32(1);
+		ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+		if (batch_rows <= 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("batch_rows must be greater than zero")));
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		if (SPI_connect() != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect failed");
+
+		portal = SPI_cursor_open_with_args( NULL, query, 0, NULL, NULL, NULL,
+											false, CURSOR_OPT_NO_SCROLL );
+
+		oldcontext = MemoryContextSwitchTo( funcctx->multi_call_memory_ctx );
+
+		state = (JsonLinesState *) palloc0( sizeof( JsonLinesState ) );
+		state->portal_name = pstrdup( portal->name );
+		state->batch_rows = batch_rows;
+		state->plan = json_plan_build_row( portal->tupDesc, funcctx->multi_call_memory_ctx );
+		state->scratch = AllocSetContextCreate( funcctx->multi_call_memory_ctx,
+												"to_jsonl batch",
+												ALLOCSET_DEFAULT_MINSIZE,
+												ALLOCSET_DEFAULT_INITSIZE,
+												ALLOCSET_DEFAULT_MAXSIZE );
+
+		MemoryContextSwitchTo( oldcontext );
+
+		funcctx->user_fctx = state;
+
+		/* the cursor outlives the SPI connection, it is fetched on every call */
+		SPI_finish();
+
+		if (rsinfo != NULL && IsA( rsinfo, ReturnSetInfo ))
+			RegisterExprContextCallback( rsinfo->econtext, to_jsonl_shutdown,
+										 PointerGetDatum( state ) );
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	state = (JsonLinesState *) funcctx->user_fctx;
+
+	/* the result line is allocated in the caller's context */
+	json_text_init( &buf );
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	portal = SPI_cursor_find( state->portal_name );
+	if (portal == NULL)
+		elog(ERROR, "cursor \"%s\" of to_jsonl does not exist", state->portal_name);
+
+	SPI_cursor_fetch( portal, true, state->batch_rows );
+
+	if (SPI_processed == 0)
+	{
+		ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+		SPI_cursor_close( portal );
+		SPI_finish();
+
+		/* the state goes away with the multi-call context */
+		if (rsinfo != NULL && IsA( rsinfo, ReturnSetInfo ))
+			UnregisterExprContextCallback( rsinfo->econtext, to_jsonl_shutdown,
+										   PointerGetDatum( state ) );
+
+		SRF_RETURN_DONE( funcctx );
+	}
+
+	oldcontext = MemoryContextSwitchTo( state->scratch );
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		if (i > 0)
+			appendStringInfoChar( &buf, '\n' );
+
+		json_write_tuple( &buf, state->plan, SPI_tuptable->vals[ i ] );
+	}
+
+	MemoryContextSwitchTo( oldcontext );
+	MemoryContextReset( state->scratch );
+
+	SPI_freetuptable( SPI_tuptable );
+	SPI_finish();
+
+	SRF_RETURN_NEXT( funcctx, PointerGetDatum( json_text_finish( &buf ) ) );
+}
@@ -0,0 +1,426 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer bulk load of JSON arrays into tables
+*
+* json_load( regclass, text ) and json_load_file( regclass, text ) insert
+* the objects of a JSON array into a table the way COPY FROM does: rows
+* are formed straight from the parsed values against the table's
+* descriptor and inserted in batches with heap_multi_insert, one WAL
+* record per page instead of one per row. Defaults, constraints, indexes
+* and triggers are handled as in COPY; keys missing from an object take
+* the column default, explicit nulls stay null.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/sysattr.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "commands/trigger.h"
+#include "executor/executor.h"
+#include "nodes/makefuncs.h"
+#include "optimizer/planner.h"
+#include "rewrite/rewriteHandler.h"
+#include "storage/fd.h"
+#include "tcop/utility.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/rls.h"
+
+#include "deserializer.h"
+#include "serializer.h"
+
+Datum json_load( PG_FUNCTION_ARGS );
+Datum json_load_file( PG_FUNCTION_ARGS );
+
+/* a batch is inserted when it has this many rows or bytes, as in COPY */
+#define JSON_LOAD_BATCH_ROWS	1000
+#define JSON_LOAD_BATCH_BYTES	(64 * 1024)
+
+typedef struct JsonLoadState
+{
+	Relation	rel;
+	JsonPlan   *plan;
+	EState	   *estate;
+	ResultRelInfo *relinfo;
+	TupleTableSlot *slot;
+	BulkInsertState bistate;
+	CommandId	cid;
+	ExprState **defaults;		/* per attribute, NULL without a default */
+	bool		before_row;		/* BEFORE ROW INSERT triggers, rows go one by one */
+	bool		after_row;
+
+	MemoryContext batch_cxt;	/* parsed values and formed rows of a batch */
+	HeapTuple  *tuples;
+	int			ntuples;
+	int			max_tuples;
+	Size		bytes;
+	int64		nrows;
+} JsonLoadState;
+
+static void json_load_begin( JsonLoadState *state, FmgrInfo *flinfo, Oid relid );
+static void json_load_end( JsonLoadState *state );
+static void json_load_flush( JsonLoadState *state );
+static void json_load_row( JsonLoadState *state, JsonParser *parser, Datum *values,
+						   bool *isnull, bool *seen );
+static int64 json_load_common( FmgrInfo *flinfo, Oid relid, const char *data, int len );
+
+/*
+ * Open the table and set up an executor state for it, checking INSERT
+ * privilege on every column like an INSERT naming them all. As with COPY
+ * FROM, tables under row level security are refused, since rows would go
+ * in without their WITH CHECK policies.
+ */
+static void json_load_begin( JsonLoadState *state, FmgrInfo *flinfo, Oid relid )
+{
+	Relation	rel;
+	TupleDesc	tupdesc;
+	RangeTblEntry *rte;
+	ResultRelInfo *relinfo;
+	EState	   *estate;
+	int			i;
+
+	PreventCommandIfReadOnly( "json_load" );
+	PreventCommandIfParallelMode( "json_load" );
+
+	rel = heap_open( relid, RowExclusiveLock );
+	tupdesc = RelationGetDescr( rel );
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("cannot load into \"%s\"", RelationGetRelationName( rel )),
+				 errdetail("json_load only loads into tables.")));
+
+	rte = makeNode( RangeTblEntry );
+	rte->rtekind = RTE_RELATION;
+	rte->relid = relid;
+	rte->relkind = rel->rd_rel->relkind;
+	rte->requiredPerms = ACL_INSERT;
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		if (!tupdesc->attrs[ i ]->attisdropped)
+			rte->insertedCols = bms_add_member( rte->insertedCols,
+												i + 1 - FirstLowInvalidHeapAttributeNumber );
+	}
+
+	ExecCheckRTPerms( list_make1( rte ), true );
+
+	if (check_enable_rls( relid, InvalidOid, false ) == RLS_ENABLED)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("json_load does not support row level security on \"%s\"",
+						RelationGetRelationName( rel ))));
+
+	relinfo = makeNode( ResultRelInfo );
+	InitResultRelInfo( relinfo, rel, 1, 0 );
+	ExecOpenIndices( relinfo, false );
+
+	estate = CreateExecutorState();
+	estate->es_result_relations = relinfo;
+	estate->es_num_result_relations = 1;
+	estate->es_result_relation_info = relinfo;
+	estate->es_range_table = list_make1( rte );
+
+	state->slot = ExecInitExtraTupleSlot( estate );
+	ExecSetSlotDescriptor( state->slot, tupdesc );
+
+	if (relinfo->ri_TrigDesc)
+		estate->es_trig_tuple_slot = ExecInitExtraTupleSlot( estate );
+
+	state->rel = rel;
+	state->relinfo = relinfo;
+	state->estate = estate;
+	state->before_row = relinfo->ri_TrigDesc && relinfo->ri_TrigDesc->trig_insert_before_row;
+	state->after_row = relinfo->ri_TrigDesc && relinfo->ri_TrigDesc->trig_insert_after_row;
+
+	/* keys are matched to columns through the cached plan of the rowtype */
+	state->plan = json_plan_get( &json_fn_state( flinfo )->ref, rel->rd_rel->reltype, -1, JSON_PLAN_ROW );
+
+	state->defaults = (ExprState **) palloc0( tupdesc->natts * sizeof( ExprState * ) );
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Expr	   *defexpr;
+
+		if (tupdesc->attrs[ i ]->attisdropped)
+			continue;
+
+		defexpr = (Expr *) build_column_default( rel, i + 1 );
+		if (defexpr != NULL)
+			state->defaults[ i ] = ExecInitExpr( expression_planner( defexpr ), NULL );
+	}
+
+	state->cid = GetCurrentCommandId( true );
+	state->bistate = GetBulkInsertState();
+
+	/* BEFORE ROW triggers may look at the table, rows go in one at a time */
+	state->max_tuples = state->before_row ? 1 : JSON_LOAD_BATCH_ROWS;
+	state->tuples = (HeapTuple *) palloc( state->max_tuples * sizeof( HeapTuple ) );
+	state->ntuples = 0;
+	state->bytes = 0;
+	state->nrows = 0;
+
+	state->batch_cxt = AllocSetContextCreate( CurrentMemoryContext,
+											  "json_load batch",
+											  ALLOCSET_DEFAULT_MINSIZE,
+											  ALLOCSET_DEFAULT_INITSIZE,
+											  ALLOCSET_DEFAULT_MAXSIZE );
+
+	/* AFTER triggers queued by the load fire when it ends */
+	AfterTriggerBeginQuery();
+	ExecBSInsertTriggers( estate, relinfo );
+}
+
+/*
+ * Insert the rows of the batch, then their index entries and AFTER ROW
+ * trigger events, as CopyFromInsertBatch does
+ */
+static void json_load_flush( JsonLoadState *state )
+{
+	EState	   *estate = state->estate;
+	int			i;
+
+	if (state->ntuples == 0)
+		return;
+
+	heap_multi_insert( state->rel, state->tuples, state->ntuples, state->cid, 0, state->bistate );
+
+	if (state->relinfo->ri_NumIndices > 0 || state->after_row)
+	{
+		for (i = 0; i < state->ntuples; i++)
+		{
+			List	   *recheck = NIL;
+
+			if (state->relinfo->ri_NumIndices > 0)
+			{
+				ExecStoreTuple( state->tuples[ i ], state->slot, InvalidBuffer, false );
+				recheck = ExecInsertIndexTuples( state->slot, &(state->tuples[ i ]->t_self),
+												 estate, false, NULL, NIL );
+			}
+
+			if (state->after_row)
+				ExecARInsertTriggers( estate, state->relinfo, state->tuples[ i ], recheck );
+
+			list_free( recheck );
+			ResetPerTupleExprContext( estate );
+		}
+	}
+
+	state->nrows += state->ntuples;
+	state->ntuples = 0;
+	state->bytes = 0;
+
+	MemoryContextReset( state->batch_cxt );
+}
+
+/*
+ * Parse one object into a row of the table and add it to the batch
+ */
+static void json_load_row( JsonLoadState *state, JsonParser *parser, Datum *values,
+						   bool *isnull, bool *seen )
+{
+	TupleDesc	tupdesc = RelationGetDescr( state->rel );
+	EState	   *estate = state->estate;
+	TupleTableSlot *slot = state->slot;
+	MemoryContext oldcontext;
+	HeapTuple	tuple;
+	int			natts = tupdesc->natts;
+	int			i;
+
+	oldcontext = MemoryContextSwitchTo( state->batch_cxt );
+
+	memset( values, 0, natts * sizeof( Datum ) );
+	memset( isnull, true, natts * sizeof( bool ) );
+	memset( seen, false, natts * sizeof( bool ) );
+
+	deserialize_record_fields( parser, state->plan, values, isnull, seen );
+
+	/* keys left out take the column default */
+	for (i = 0; i < natts; i++)
+	{
+		if (!seen[ i ] && state->defaults[ i ] != NULL)
+			values[ i ] = ExecEvalExpr( state->defaults[ i ], GetPerTupleExprContext( estate ),
+										&isnull[ i ], NULL );
+	}
+
+	tuple = heap_form_tuple( tupdesc, values, isnull );
+
+	ExecStoreTuple( tuple, slot, InvalidBuffer, false );
+
+	if (state->before_row)
+	{
+		slot = ExecBRInsertTriggers( estate, state->relinfo, slot );
+
+		/* skipped by a trigger */
+		if (slot == NULL)
+		{
+			MemoryContextSwitchTo( oldcontext );
+			MemoryContextReset( state->batch_cxt );
+			return;
+		}
+
+		tuple = ExecCopySlotTuple( slot );
+	}
+
+	if (tupdesc->constr)
+		ExecConstraints( state->relinfo, slot, estate );
+
+	MemoryContextSwitchTo( oldcontext );
+	ResetPerTupleExprContext( estate );
+
+	state->tuples[ state->ntuples++ ] = tuple;
+	state->bytes += tuple->t_len;
+
+	if (state->ntuples == state->max_tuples || state->bytes >= JSON_LOAD_BATCH_BYTES)
+		json_load_flush( state );
+}
+
+static void json_load_end( JsonLoadState *state )
+{
+	json_load_flush( state );
+
+	ExecASInsertTriggers( state->estate, state->relinfo );
+	AfterTriggerEndQuery( state->estate );
+
+	FreeBulkInsertState( state->bistate );
+
+	ExecResetTupleTable( state->estate->es_tupleTable, false );
+	ExecCloseIndices( state->relinfo );
+	FreeExecutorState( state->estate );
+
+	MemoryContextDelete( state->batch_cxt );
+
+	/* the lock is kept until the end of the transaction */
+	heap_close( state->rel, NoLock );
+}
+
+static int64 json_load_common( FmgrInfo *flinfo, Oid relid, const char *data, int len )
+{
+	JsonLoadState state;
+	JsonParser	parser;
+	Datum	   *values;
+	bool	   *isnull;
+	bool	   *seen;
+	int			natts;
+
+	json_load_begin( &state, flinfo, relid );
+
+	natts = RelationGetDescr( state.rel )->natts;
+	values = (Datum *) palloc( natts * sizeof( Datum ) );
+	isnull = (bool *) palloc( natts * sizeof( bool ) );
+	seen = (bool *) palloc( natts * sizeof( bool ) );
+
+	json_parser_init( &parser, data, len );
+
+	if (json_parser_begin( &parser, '[', ']' ))
+	{
+		do
+		{
+			json_load_row( &state, &parser, values, isnull, seen );
+		} while (json_parser_next( &parser, ']' ));
+	}
+
+	json_parser_finish( &parser );
+
+	json_load_end( &state );
+
+	return state.nrows;
+}
+
+/*
+ * json_load( target regclass, doc text ) returns bigint, the rows inserted
+ */
+PG_FUNCTION_INFO_V1( json_load );
+Datum json_load( PG_FUNCTION_ARGS )
+{
+	Oid			relid = PG_GETARG_OID(0);
+	text	   *doc = PG_GETARG_TEXT_PP(1);
+
+	PG_RETURN_INT64( json_load_common( fcinfo->flinfo, relid, VARDATA_ANY( doc ), VARSIZE_ANY_EXHDR( doc ) ) );
+}
+
+/*
+ * json_load_file( target regclass, path text ) returns bigint
+ *
+ * Reads a server file, which needs superuser as for COPY FROM a file.
+ * The file is read whole, up to the 2GB the parser accepts.
+ */
+PG_FUNCTION_INFO_V1( json_load_file );
+Datum json_load_file( PG_FUNCTION_ARGS )
+{
+	Oid			relid = PG_GETARG_OID(0);
+	char	   *path = text_to_cstring( PG_GETARG_TEXT_PP(1) );
+	struct stat st;
+	char	   *data;
+	off_t		done = 0;
+	int			fd;
+	int64		nrows;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to load from a file")));
+
+	if (!is_absolute_path( path ))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_NAME),
+				 errmsg("relative path not allowed for json_load_file")));
+
+	fd = OpenTransientFile( path, O_RDONLY | PG_BINARY, 0 );
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for reading: %m", path)));
+
+	if (fstat( fd, &st ) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file \"%s\": %m", path)));
+
+	if (st.st_size > PG_INT32_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("file \"%s\" is too large to load", path),
+				 errdetail("Files of up to %d bytes can be loaded.", PG_INT32_MAX)));
+
+	data = (char *) MemoryContextAllocHuge( CurrentMemoryContext, Max( st.st_size, 1 ) );
+
+	while (done < st.st_size)
+	{
+		ssize_t		n = read( fd, data + done, st.st_size - done );
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m", path)));
+		}
+
+		/* the file shrank under us, load what is there */
+		if (n == 0)
+			break;
+
+		done += n;
+	}
+
+	CloseTransientFile( fd );
+
+	nrows = json_load_common( fcinfo->flinfo, relid, data, (int) done );
+
+	pfree( data );
+
+	PG_RETURN_INT64( nrows );
+}
@@ -0,0 +1,743 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer trigger-maintained json_agg documents
+*
+* json_agg_maintain (install.sql) registers a source table, a grouping
+* column and an array name, creates a documents table
+*
+*	group_key <type> PRIMARY KEY, doc text, ctids tid[], positions int4[],
+*	offsets int4[]
+*
+* and fills it with one {"name":[...]} document per group, the same text
+* as json_agg( t, 'name' ) with the rows in ctid order. The arrays index
+* the document: ctids is sorted, the row at ctids[k] is element
+* positions[k], and element i starts at byte offsets[i]. A row trigger on
+* the source table finds the changed row by binary search and patches
+* only its element: an update replaces its bytes and moves the offsets
+* after it, an insert appends, a delete cuts it out, and a row moving to
+* another group does both. Other elements are never printed again. The
+* documents row is locked while it is patched, concurrent writers of one
+* group wait for each other.
+*
+* An updated row keeps its place although its new version has another
+* ctid, and inserted rows go last, so after writes the elements are no
+* longer in ctid order, only the same set json_agg would print;
+* json_agg_maintain_refresh restores the order. Serializing and finding
+* the row cost what the row does, but a document is one text value, so
+* each write still stores the whole document and its arrays again, and
+* the group size shows in the TOAST and WAL volume of every write.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/spi.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/regproc.h"
+#include "utils/rel.h"
+
+#include "serializer.h"
+
+/* SPI plans of one trigger, kept for the life of the backend */
+typedef struct JsonMaintainPlans
+{
+	Oid			tgoid;			/* hash key */
+	Oid			keytype;		/* type of the group column when prepared */
+	JsonPlanRef	ref;			/* row plan of the source table */
+	char	   *empty;			/* {"name":[]} */
+	SPIPlanPtr	select;
+	SPIPlanPtr	create;
+	SPIPlanPtr	update;
+	SPIPlanPtr	remove;
+} JsonMaintainPlans;
+
+/*
+ * A document being patched, allocated in the SPI context. offsets are in
+ * document order; ctids are sorted for binary search, and positions[k] is
+ * the element of the row at ctids[k].
+ */
+typedef struct JsonMaintainDoc
+{
+	StringInfoData text;
+	int			nelems;
+	int			maxelems;
+	ItemPointerData *ctids;
+	int32	   *positions;
+	int32	   *offsets;
+} JsonMaintainDoc;
+
+static HTAB *json_maintain_plans = NULL;
+
+static void json_maintain_stale( Relation rel, ItemPointer tid ) pg_attribute_noreturn();
+
+Datum json_agg_maintain_trigger( PG_FUNCTION_ARGS );
+Datum json_agg_maintain_fill( PG_FUNCTION_ARGS );
+
+/*
+ * Schema-qualified and quoted name of a relation
+ */
+static char *json_maintain_relname( Oid relid )
+{
+	return quote_qualified_identifier( get_namespace_name( get_rel_namespace( relid ) ),
+									   get_rel_name( relid ) );
+}
+
+static char *json_maintain_empty( const char *array_name, MemoryContext cxt )
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo( cxt );
+	StringInfoData buf;
+
+	initStringInfo( &buf );
+	appendStringInfoChar( &buf, '{' );
+	appendStringInfoQuotedString( &buf, array_name );
+	appendStringInfoString( &buf, ":[]}" );
+
+	MemoryContextSwitchTo( oldcontext );
+
+	return buf.data;
+}
+
+static void json_maintain_doc_init( JsonMaintainDoc *doc, const char *text, int len, int nelems )
+{
+	initStringInfo( &doc->text );
+	appendBinaryStringInfo( &doc->text, text, len );
+
+	doc->nelems = 0;
+	doc->maxelems = Max( nelems + 1, 8 );
+	doc->ctids = (ItemPointerData *) palloc( doc->maxelems * sizeof( ItemPointerData ) );
+	doc->positions = (int32 *) palloc( doc->maxelems * sizeof( int32 ) );
+	doc->offsets = (int32 *) palloc( doc->maxelems * sizeof( int32 ) );
+}
+
+/*
+ * Replace the bytes [from, to) of the document by ins, in place
+ */
+static void json_maintain_splice( JsonMaintainDoc *doc, int from, int to, const char *ins, int inslen )
+{
+	int			delta = inslen - (to - from);
+
+	if (delta > 0)
+		enlargeStringInfo( &doc->text, delta );
+
+	memmove( doc->text.data + to + delta, doc->text.data + to, doc->text.len - to );
+	if (inslen > 0)
+		memcpy( doc->text.data + from, ins, inslen );
+
+	doc->text.len += delta;
+	doc->text.data[ doc->text.len ] = '\0';
+}
+
+/* the document ends with "]}" */
+static int json_maintain_end( JsonMaintainDoc *doc, int i )
+{
+	return i + 1 < doc->nelems ? doc->offsets[ i + 1 ] - 1 : doc->text.len - 2;
+}
+
+/* index of the first of the n first ctids not below tid */
+static int json_maintain_search( JsonMaintainDoc *doc, ItemPointer tid, int n )
+{
+	int			low = 0;
+	int			high = n;
+
+	while (low < high)
+	{
+		int			middle = (low + high) / 2;
+
+		if (ItemPointerCompare( &doc->ctids[ middle ], tid ) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/* index into ctids of the row at tid, -1 if it has no element */
+static int json_maintain_find( JsonMaintainDoc *doc, ItemPointer tid )
+{
+	int			k = json_maintain_search( doc, tid, doc->nelems );
+
+	if (k < doc->nelems && ItemPointerEquals( &doc->ctids[ k ], tid ))
+		return k;
+
+	return -1;
+}
+
+/* file the row at tid as element i, among the n ctids filed so far */
+static void json_maintain_add_ctid( JsonMaintainDoc *doc, ItemPointer tid, int i, int n )
+{
+	int			k = json_maintain_search( doc, tid, n );
+
+	memmove( &doc->ctids[ k + 1 ], &doc->ctids[ k ], (n - k) * sizeof( ItemPointerData ) );
+	memmove( &doc->positions[ k + 1 ], &doc->positions[ k ], (n - k) * sizeof( int32 ) );
+
+	doc->ctids[ k ] = *tid;
+	doc->positions[ k ] = i;
+}
+
+static void json_maintain_remove_ctid( JsonMaintainDoc *doc, int k )
+{
+	int			n = doc->nelems - 1 - k;
+
+	memmove( &doc->ctids[ k ], &doc->ctids[ k + 1 ], n * sizeof( ItemPointerData ) );
+	memmove( &doc->positions[ k ], &doc->positions[ k + 1 ], n * sizeof( int32 ) );
+}
+
+static void json_maintain_append( JsonMaintainDoc *doc, ItemPointer tid, const char *elem, int len )
+{
+	int			pos = doc->text.len - 2;
+
+	if (doc->nelems > 0)
+	{
+		json_maintain_splice( doc, pos, pos, ",", 1 );
+		pos++;
+	}
+
+	json_maintain_splice( doc, pos, pos, elem, len );
+
+	if (doc->nelems == doc->maxelems)
+	{
+		doc->maxelems *= 2;
+		doc->ctids = (ItemPointerData *) repalloc( doc->ctids, doc->maxelems * sizeof( ItemPointerData ) );
+		doc->positions = (int32 *) repalloc( doc->positions, doc->maxelems * sizeof( int32 ) );
+		doc->offsets = (int32 *) repalloc( doc->offsets, doc->maxelems * sizeof( int32 ) );
+	}
+
+	json_maintain_add_ctid( doc, tid, doc->nelems, doc->nelems );
+	doc->offsets[ doc->nelems ] = pos;
+	doc->nelems++;
+}
+
+/* the row at ctids[k] is now at tid and prints as elem, in the same place */
+static void json_maintain_replace( JsonMaintainDoc *doc, int k, ItemPointer tid, const char *elem, int len )
+{
+	int			i = doc->positions[ k ];
+	int			from = doc->offsets[ i ];
+	int			to = json_maintain_end( doc, i );
+	int			delta = len - (to - from);
+	int			j;
+
+	json_maintain_splice( doc, from, to, elem, len );
+
+	for (j = i + 1; j < doc->nelems; j++)
+		doc->offsets[ j ] += delta;
+
+	json_maintain_remove_ctid( doc, k );
+	json_maintain_add_ctid( doc, tid, i, doc->nelems - 1 );
+}
+
+static void json_maintain_cut( JsonMaintainDoc *doc, int k )
+{
+	int			i = doc->positions[ k ];
+	int			from;
+	int			to;
+	int			j;
+
+	// an element takes the comma after it along, the last one the comma before it
+	if (doc->nelems == 1)
+	{
+		from = doc->offsets[ i ];
+		to = doc->text.len - 2;
+	}
+	else if (i + 1 < doc->nelems)
+	{
+		from = doc->offsets[ i ];
+		to = doc->offsets[ i + 1 ];
+	}
+	else
+	{
+		from = doc->offsets[ i ] - 1;
+		to = doc->text.len - 2;
+	}
+
+	json_maintain_splice( doc, from, to, NULL, 0 );
+
+	for (j = i + 1; j < doc->nelems; j++)
+		doc->offsets[ j - 1 ] = doc->offsets[ j ] - (to - from);
+
+	json_maintain_remove_ctid( doc, k );
+	doc->nelems--;
+
+	for (j = 0; j < doc->nelems; j++)
+	{
+		if (doc->positions[ j ] > i)
+			doc->positions[ j ]--;
+	}
+}
+
+/*
+ * doc, ctids, positions and offsets as SPI arguments
+ */
+static void json_maintain_args( JsonMaintainDoc *doc, Datum *args )
+{
+	Datum	   *elems = (Datum *) palloc( Max( doc->nelems, 1 ) * sizeof( Datum ) );
+	int			i;
+
+	args[ 0 ] = PointerGetDatum( cstring_to_text_with_len( doc->text.data, doc->text.len ) );
+
+	for (i = 0; i < doc->nelems; i++)
+		elems[ i ] = PointerGetDatum( &doc->ctids[ i ] );
+	args[ 1 ] = PointerGetDatum( construct_array( elems, doc->nelems, TIDOID, sizeof( ItemPointerData ), false, 's' ) );
+
+	for (i = 0; i < doc->nelems; i++)
+		elems[ i ] = Int32GetDatum( doc->positions[ i ] );
+	args[ 2 ] = PointerGetDatum( construct_array( elems, doc->nelems, INT4OID, sizeof( int32 ), true, 'i' ) );
+
+	for (i = 0; i < doc->nelems; i++)
+		elems[ i ] = Int32GetDatum( doc->offsets[ i ] );
+	args[ 3 ] = PointerGetDatum( construct_array( elems, doc->nelems, INT4OID, sizeof( int32 ), true, 'i' ) );
+}
+
+static SPIPlanPtr json_maintain_prepare( const char *query, int nargs, Oid *argtypes )
+{
+	SPIPlanPtr	plan = SPI_prepare( query, nargs, argtypes );
+
+	if (plan == NULL)
+		elog(ERROR, "SPI_prepare failed for \"%s\": %s", query, SPI_result_code_string( SPI_result ));
+
+	SPI_keepplan( plan );
+
+	return plan;
+}
+
+/*
+ * Plans of the trigger, prepared again when the group column changed type
+ */
+static JsonMaintainPlans *json_maintain_get_plans( Trigger *trigger, Oid keytype )
+{
+	JsonMaintainPlans *plans;
+	Oid			argtypes[ 5 ];
+	char	   *docs;
+	bool		found;
+
+	if (json_maintain_plans == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet( &ctl, 0, sizeof( ctl ) );
+		ctl.keysize = sizeof( Oid );
+		ctl.entrysize = sizeof( JsonMaintainPlans );
+		ctl.hash = tag_hash;
+		ctl.hcxt = TopMemoryContext;
+
+		json_maintain_plans = hash_create( "json_agg_maintain plans", 16, &ctl,
+										   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+	}
+
+	plans = (JsonMaintainPlans *) hash_search( json_maintain_plans, &trigger->tgoid, HASH_ENTER, &found );
+	if (!found)
+	{
+		plans->select = plans->create = plans->update = plans->remove = NULL;
+		plans->empty = NULL;
+	}
+	else if (plans->keytype == keytype)
+		return plans;
+
+	if (plans->select)
+		SPI_freeplan( plans->select );
+	if (plans->create)
+		SPI_freeplan( plans->create );
+	if (plans->update)
+		SPI_freeplan( plans->update );
+	if (plans->remove)
+		SPI_freeplan( plans->remove );
+	if (plans->empty)
+		pfree( plans->empty );
+
+	/* the entry is only usable once everything below succeeded */
+	plans->select = plans->create = plans->update = plans->remove = NULL;
+	plans->empty = NULL;
+	plans->keytype = InvalidOid;
+	plans->ref.plan = NULL;
+	plans->ref.generation = 0;
+
+	// resolving the name again checks it still is a table
+	docs = json_maintain_relname( DatumGetObjectId( DirectFunctionCall1( regclassin,
+														CStringGetDatum( trigger->tgargs[ 0 ] ) ) ) );
+
+	argtypes[ 0 ] = keytype;
+	argtypes[ 1 ] = TEXTOID;
+	argtypes[ 2 ] = get_array_type( TIDOID );
+	argtypes[ 3 ] = INT4ARRAYOID;
+	argtypes[ 4 ] = INT4ARRAYOID;
+
+	plans->select = json_maintain_prepare( psprintf( "SELECT doc, ctids, positions, offsets FROM %s WHERE group_key = $1 FOR UPDATE", docs ),
+										   1, argtypes );
+	plans->create = json_maintain_prepare( psprintf( "INSERT INTO %s ( group_key, doc, ctids, positions, offsets ) VALUES ( $1, $2, '{}', '{}', '{}' ) "
+													 "ON CONFLICT ( group_key ) DO NOTHING", docs ),
+										   2, argtypes );
+	plans->update = json_maintain_prepare( psprintf( "UPDATE %s SET doc = $2, ctids = $3, positions = $4, offsets = $5 WHERE group_key = $1", docs ),
+										   5, argtypes );
+	plans->remove = json_maintain_prepare( psprintf( "DELETE FROM %s WHERE group_key = $1", docs ),
+										   1, argtypes );
+	plans->empty = json_maintain_empty( trigger->tgargs[ 2 ], TopMemoryContext );
+	plans->keytype = keytype;
+
+	return plans;
+}
+
+/*
+ * Lock and read the document of a group, false if there is none
+ */
+static bool json_maintain_load( JsonMaintainPlans *plans, Datum key, JsonMaintainDoc *doc )
+{
+	HeapTuple	row;
+	TupleDesc	tupdesc;
+	text	   *t;
+	ArrayType  *ctids;
+	ArrayType  *positions;
+	ArrayType  *offsets;
+	Datum	   *elems;
+	int			n;
+	int			npositions;
+	int			noffsets;
+	int			i;
+	bool		isnull;
+
+	if (SPI_execute_plan( plans->select, &key, NULL, false, 1 ) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_plan failed reading a json_agg document");
+
+	if (SPI_processed == 0)
+		return false;
+
+	row = SPI_tuptable->vals[ 0 ];
+	tupdesc = SPI_tuptable->tupdesc;
+
+	t = DatumGetTextPP( SPI_getbinval( row, tupdesc, 1, &isnull ) );
+	ctids = DatumGetArrayTypeP( SPI_getbinval( row, tupdesc, 2, &isnull ) );
+	positions = DatumGetArrayTypeP( SPI_getbinval( row, tupdesc, 3, &isnull ) );
+	offsets = DatumGetArrayTypeP( SPI_getbinval( row, tupdesc, 4, &isnull ) );
+
+	n = ArrayGetNItems( ARR_NDIM( ctids ), ARR_DIMS( ctids ) );
+	json_maintain_doc_init( doc, VARDATA_ANY( t ), VARSIZE_ANY_EXHDR( t ), n );
+
+	deconstruct_array( ctids, TIDOID, sizeof( ItemPointerData ), false, 's', &elems, NULL, &n );
+	for (i = 0; i < n; i++)
+		doc->ctids[ i ] = *DatumGetItemPointer( elems[ i ] );
+
+	deconstruct_array( positions, INT4OID, sizeof( int32 ), true, 'i', &elems, NULL, &npositions );
+	if (npositions != n)
+		elog(ERROR, "json_agg document has %d positions for %d rows", npositions, n);
+	for (i = 0; i < n; i++)
+		doc->positions[ i ] = DatumGetInt32( elems[ i ] );
+
+	deconstruct_array( offsets, INT4OID, sizeof( int32 ), true, 'i', &elems, NULL, &noffsets );
+	if (noffsets != n)
+		elog(ERROR, "json_agg document has %d offsets for %d rows", noffsets, n);
+	for (i = 0; i < n; i++)
+		doc->offsets[ i ] = DatumGetInt32( elems[ i ] );
+
+	doc->nelems = n;
+
+	return true;
+}
+
+/*
+ * Write a patched document back, or delete it when its group is empty
+ */
+static void json_maintain_store( JsonMaintainPlans *plans, Datum key, JsonMaintainDoc *doc )
+{
+	Datum		args[ 5 ];
+
+	args[ 0 ] = key;
+
+	if (doc->nelems == 0)
+	{
+		if (SPI_execute_plan( plans->remove, args, NULL, false, 0 ) != SPI_OK_DELETE)
+			elog(ERROR, "SPI_execute_plan failed deleting a json_agg document");
+		return;
+	}
+
+	json_maintain_args( doc, args + 1 );
+
+	if (SPI_execute_plan( plans->update, args, NULL, false, 0 ) != SPI_OK_UPDATE)
+		elog(ERROR, "SPI_execute_plan failed updating a json_agg document");
+}
+
+static void json_maintain_stale( Relation rel, ItemPointer tid )
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_DATA_CORRUPTED),
+			 errmsg("json_agg document of \"%s\" has no element for row (%u,%u)",
+					RelationGetRelationName( rel ),
+					ItemPointerGetBlockNumber( tid ), ItemPointerGetOffsetNumber( tid )),
+			 errhint("Rows moved by VACUUM FULL or CLUSTER need json_agg_maintain_refresh.")));
+}
+
+static void json_maintain_write_row( StringInfo buf, JsonMaintainPlans *plans, Relation rel, HeapTuple tuple )
+{
+	JsonPlan   *plan = json_plan_get( &plans->ref, RelationGetDescr( rel )->tdtypeid, -1, JSON_PLAN_ROW );
+
+	resetStringInfo( buf );
+	json_write_tuple( buf, plan, tuple );
+}
+
+/*
+ * json_agg_maintain_trigger( docs, group_column, array_name )
+ *
+ * AFTER INSERT OR UPDATE OR DELETE FOR EACH ROW, and AFTER TRUNCATE FOR
+ * EACH STATEMENT, on the source table.
+ */
+PG_FUNCTION_INFO_V1( json_agg_maintain_trigger );
+Datum json_agg_maintain_trigger( PG_FUNCTION_ARGS )
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+	TriggerEvent event;
+	Trigger    *trigger;
+	Relation	rel;
+	TupleDesc	tupdesc;
+	JsonMaintainPlans *plans;
+	JsonMaintainDoc doc;
+	StringInfoData elem;
+	HeapTuple	oldtuple = NULL;
+	HeapTuple	newtuple = NULL;
+	Datum		oldkey = (Datum) 0;
+	Datum		newkey = (Datum) 0;
+	bool		oldnull = true;
+	bool		newnull = true;
+	int			attno;
+	int			i;
+
+	if (!CALLED_AS_TRIGGER( fcinfo ))
+		elog(ERROR, "json_agg_maintain_trigger: not called by trigger manager");
+
+	event = trigdata->tg_event;
+	trigger = trigdata->tg_trigger;
+	rel = trigdata->tg_relation;
+	tupdesc = RelationGetDescr( rel );
+
+	if (!TRIGGER_FIRED_AFTER( event ))
+		elog(ERROR, "json_agg_maintain_trigger: must be fired AFTER");
+	if (trigger->tgnargs != 3)
+		elog(ERROR, "json_agg_maintain_trigger: expected 3 arguments, got %d", trigger->tgnargs);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (TRIGGER_FIRED_BY_TRUNCATE( event ))
+	{
+		char	   *docs = json_maintain_relname( DatumGetObjectId( DirectFunctionCall1( regclassin,
+														CStringGetDatum( trigger->tgargs[ 0 ] ) ) ) );
+
+		if (SPI_execute( psprintf( "DELETE FROM %s", docs ), false, 0 ) != SPI_OK_DELETE)
+			elog(ERROR, "SPI_execute failed emptying a json_agg document table");
+
+		SPI_finish();
+		return PointerGetDatum( NULL );
+	}
+
+	if (!TRIGGER_FIRED_FOR_ROW( event ))
+		elog(ERROR, "json_agg_maintain_trigger: must be fired FOR EACH ROW");
+
+	attno = SPI_fnumber( tupdesc, trigger->tgargs[ 1 ] );
+	if (attno <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						trigger->tgargs[ 1 ], RelationGetRelationName( rel ))));
+
+	plans = json_maintain_get_plans( trigger, SPI_gettypeid( tupdesc, attno ) );
+
+	if (TRIGGER_FIRED_BY_INSERT( event ))
+		newtuple = trigdata->tg_trigtuple;
+	else if (TRIGGER_FIRED_BY_DELETE( event ))
+		oldtuple = trigdata->tg_trigtuple;
+	else
+	{
+		oldtuple = trigdata->tg_trigtuple;
+		newtuple = trigdata->tg_newtuple;
+	}
+
+	// rows with a null group key belong to no document
+	if (oldtuple != NULL)
+		oldkey = heap_getattr( oldtuple, attno, tupdesc, &oldnull );
+	if (newtuple != NULL)
+		newkey = heap_getattr( newtuple, attno, tupdesc, &newnull );
+
+	initStringInfo( &elem );
+
+	// same group: the element is rewritten where it is
+	if (!oldnull && !newnull &&
+		datumIsEqual( oldkey, newkey, tupdesc->attrs[ attno - 1 ]->attbyval, tupdesc->attrs[ attno - 1 ]->attlen ))
+	{
+		if (!json_maintain_load( plans, oldkey, &doc ) ||
+			(i = json_maintain_find( &doc, &oldtuple->t_self )) < 0)
+			json_maintain_stale( rel, &oldtuple->t_self );
+
+		json_maintain_write_row( &elem, plans, rel, newtuple );
+		json_maintain_replace( &doc, i, &newtuple->t_self, elem.data, elem.len );
+		json_maintain_store( plans, oldkey, &doc );
+
+		SPI_finish();
+		return PointerGetDatum( NULL );
+	}
+
+	if (!oldnull)
+	{
+		if (!json_maintain_load( plans, oldkey, &doc ) ||
+			(i = json_maintain_find( &doc, &oldtuple->t_self )) < 0)
+			json_maintain_stale( rel, &oldtuple->t_self );
+
+		json_maintain_cut( &doc, i );
+		json_maintain_store( plans, oldkey, &doc );
+	}
+
+	if (!newnull)
+	{
+		// a new group starts empty, ON CONFLICT waits for a concurrent creator
+		if (!json_maintain_load( plans, newkey, &doc ))
+		{
+			Datum		args[ 2 ];
+
+			args[ 0 ] = newkey;
+			args[ 1 ] = CStringGetTextDatum( plans->empty );
+
+			if (SPI_execute_plan( plans->create, args, NULL, false, 0 ) != SPI_OK_INSERT)
+				elog(ERROR, "SPI_execute_plan failed creating a json_agg document");
+
+			if (!json_maintain_load( plans, newkey, &doc ))
+				elog(ERROR, "json_agg document of \"%s\" disappeared while created", RelationGetRelationName( rel ));
+		}
+
+		json_maintain_write_row( &elem, plans, rel, newtuple );
+		json_maintain_append( &doc, &newtuple->t_self, elem.data, elem.len );
+		json_maintain_store( plans, newkey, &doc );
+	}
+
+	SPI_finish();
+	return PointerGetDatum( NULL );
+}
+
+/*
+ * json_agg_maintain_fill( source regclass, docs regclass, group_column name,
+ *		array_name text ) returns bigint
+ *
+ * Writes the documents of every group of source into the empty docs table
+ * and returns their number, used by json_agg_maintain and
+ * json_agg_maintain_refresh.
+ */
+PG_FUNCTION_INFO_V1( json_agg_maintain_fill );
+Datum json_agg_maintain_fill( PG_FUNCTION_ARGS )
+{
+	Oid			source = PG_GETARG_OID( 0 );
+	Oid			docs = PG_GETARG_OID( 1 );
+	char	   *column = quote_identifier( NameStr( *PG_GETARG_NAME( 2 ) ) );
+	char	   *empty;
+	JsonPlanRef	ref = { NULL, 0 };
+	SPIPlanPtr	select;
+	SPIPlanPtr	insert = NULL;
+	Portal		portal;
+	MemoryContext group_cxt;
+	MemoryContext oldcontext;
+	int64		ngroups = 0;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	empty = json_maintain_empty( text_to_cstring( PG_GETARG_TEXT_PP( 3 ) ), CurrentMemoryContext );
+
+	select = SPI_prepare( psprintf( "SELECT t.%s, array_agg( t.ctid ORDER BY t.ctid ), array_agg( t.* ORDER BY t.ctid ) "
+									"FROM ONLY %s t WHERE t.%s IS NOT NULL GROUP BY 1",
+									column, json_maintain_relname( source ), column ),
+						  0, NULL );
+	if (select == NULL)
+		elog(ERROR, "SPI_prepare failed: %s", SPI_result_code_string( SPI_result ));
+
+	portal = SPI_cursor_open( NULL, select, NULL, NULL, true );
+
+	group_cxt = AllocSetContextCreate( CurrentMemoryContext,
+									   "json_agg_maintain group",
+									   ALLOCSET_DEFAULT_MINSIZE,
+									   ALLOCSET_DEFAULT_INITSIZE,
+									   ALLOCSET_DEFAULT_MAXSIZE );
+
+	for (;;)
+	{
+		SPITupleTable *tuptable;
+		uint64		nrows;
+		uint64		r;
+
+		SPI_cursor_fetch( portal, true, 100 );
+		if (SPI_processed == 0)
+			break;
+
+		/* the inserts below overwrite both */
+		tuptable = SPI_tuptable;
+		nrows = SPI_processed;
+
+		if (insert == NULL)
+		{
+			Oid			argtypes[ 5 ];
+
+			argtypes[ 0 ] = SPI_gettypeid( tuptable->tupdesc, 1 );
+			argtypes[ 1 ] = TEXTOID;
+			argtypes[ 2 ] = SPI_gettypeid( tuptable->tupdesc, 2 );
+			argtypes[ 3 ] = INT4ARRAYOID;
+			argtypes[ 4 ] = INT4ARRAYOID;
+
+			insert = SPI_prepare( psprintf( "INSERT INTO %s ( group_key, doc, ctids, positions, offsets ) VALUES ( $1, $2, $3, $4, $5 )",
+											json_maintain_relname( docs ) ),
+								  5, argtypes );
+			if (insert == NULL)
+				elog(ERROR, "SPI_prepare failed: %s", SPI_result_code_string( SPI_result ));
+		}
+
+		for (r = 0; r < nrows; r++)
+		{
+			HeapTuple	row = tuptable->vals[ r ];
+			TupleDesc	tupdesc = tuptable->tupdesc;
+			JsonMaintainDoc doc;
+			StringInfoData elem;
+			ArrayType  *rows;
+			Datum	   *ctids;
+			Datum	   *records;
+			Datum		args[ 5 ];
+			int			nctids;
+			int			nrecords;
+			int			i;
+			bool		isnull;
+
+			oldcontext = MemoryContextSwitchTo( group_cxt );
+
+			rows = DatumGetArrayTypeP( SPI_getbinval( row, tupdesc, 2, &isnull ) );
+			deconstruct_array( rows, TIDOID, sizeof( ItemPointerData ), false, 's', &ctids, NULL, &nctids );
+
+			rows = DatumGetArrayTypeP( SPI_getbinval( row, tupdesc, 3, &isnull ) );
+			deconstruct_array( rows, ARR_ELEMTYPE( rows ), -1, false, 'd', &records, NULL, &nrecords );
+
+			json_maintain_doc_init( &doc, empty, strlen( empty ), nrecords );
+			initStringInfo( &elem );
+
+			for (i = 0; i < nrecords; i++)
+			{
+				resetStringInfo( &elem );
+				json_write_record( &elem, DatumGetHeapTupleHeader( records[ i ] ), &ref );
+				json_maintain_append( &doc, DatumGetItemPointer( ctids[ i ] ), elem.data, elem.len );
+			}
+
+			args[ 0 ] = SPI_getbinval( row, tupdesc, 1, &isnull );
+			json_maintain_args( &doc, args + 1 );
+
+			if (SPI_execute_plan( insert, args, NULL, false, 0 ) != SPI_OK_INSERT)
+				elog(ERROR, "SPI_execute_plan failed writing a json_agg document");
+
+			MemoryContextSwitchTo( oldcontext );
+			MemoryContextReset( group_cxt );
+			ngroups++;
+		}
+
+		SPI_freetuptable( tuptable );
+	}
+
+	SPI_cursor_close( portal );
+	SPI_finish();
+
+	PG_RETURN_INT64( ngroups );
+}
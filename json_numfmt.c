@@ -0,0 +1,342 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer number formatting kernels
+*
+* Integers use a two-digits-per-step table, floats the shortest
+* representation that reads back to the same value (Ryu, as used by the
+* server itself since 12), numerics are printed from their NBASE digits
+* the way numeric_out does but without the intermediate allocations.
+*/
+
+#ifndef FRONTEND
+#include "postgres.h"
+#else
+#include "postgres_fe.h"
+#endif
+
+#include <math.h>
+
+#if PG_VERSION_NUM >= 120000
+#include "common/shortest_dec.h"
+#endif
+
+#include "json_numfmt.h"
+
+static const char json_digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static int json_format_uint64( char *dst, uint64 value )
+{
+	char		tmp[ 20 ];
+	char	   *p = tmp + sizeof( tmp );
+	int			len;
+
+	while (value >= 100)
+	{
+		int			idx = (int) (value % 100) * 2;
+
+		value /= 100;
+		p -= 2;
+		p[ 0 ] = json_digit_pairs[ idx ];
+		p[ 1 ] = json_digit_pairs[ idx + 1 ];
+	}
+
+	if (value >= 10)
+	{
+		p -= 2;
+		p[ 0 ] = json_digit_pairs[ value * 2 ];
+		p[ 1 ] = json_digit_pairs[ value * 2 + 1 ];
+	}
+	else
+		*--p = (char) ('0' + value);
+
+	len = tmp + sizeof( tmp ) - p;
+	memcpy( dst, p, len );
+
+	return len;
+}
+
+int json_format_int64( char *dst, int64 value )
+{
+	if (value < 0)
+	{
+		dst[ 0 ] = '-';
+		/* negate as unsigned, so that INT64_MIN works */
+		return 1 + json_format_uint64( dst + 1, (uint64) 0 - (uint64) value );
+	}
+
+	return json_format_uint64( dst, (uint64) value );
+}
+
+int json_format_double( char *dst, double value )
+{
+#if PG_VERSION_NUM < 120000
+	int			precision;
+	int			len = 0;
+#endif
+
+	if (isnan( value ))
+		return JSON_NUM_NAN;
+	if (isinf( value ))
+		return value > 0 ? JSON_NUM_PINF : JSON_NUM_NINF;
+
+#if PG_VERSION_NUM >= 120000
+	return double_to_shortest_decimal_buf( value, dst );
+#else
+	/* fewest digits that read back to the same value */
+	for (precision = DBL_DIG; precision <= DBL_DIG + 2; precision++)
+	{
+		len = snprintf( dst, JSON_NUMFMT_BUFLEN, "%.*g", precision, value );
+		if (strtod( dst, NULL ) == value)
+			break;
+	}
+	return len;
+#endif
+}
+
+int json_format_float( char *dst, float value )
+{
+#if PG_VERSION_NUM < 120000
+	int			precision;
+	int			len = 0;
+#endif
+
+	if (isnan( value ))
+		return JSON_NUM_NAN;
+	if (isinf( value ))
+		return value > 0 ? JSON_NUM_PINF : JSON_NUM_NINF;
+
+#if PG_VERSION_NUM >= 120000
+	return float_to_shortest_decimal_buf( value, dst );
+#else
+	for (precision = FLT_DIG; precision <= FLT_DIG + 3; precision++)
+	{
+		len = snprintf( dst, JSON_NUMFMT_BUFLEN, "%.*g", precision, (double) value );
+		if (strtof( dst, NULL ) == value)
+			break;
+	}
+	return len;
+#endif
+}
+
+const char *json_special_number( int code )
+{
+	switch (code)
+	{
+		case JSON_NUM_PINF:
+			return "\"Infinity\"";
+		case JSON_NUM_NINF:
+			return "\"-Infinity\"";
+		default:
+			return "\"NaN\"";
+	}
+}
+
+//----------------------------------------------------------
+//
+// numeric on-disk format, see src/backend/utils/adt/numeric.c
+//
+//----------------------------------------------------------
+
+#define NBASE		10000
+#define DEC_DIGITS	4
+
+#define NUMERIC_SIGN_MASK	0xC000
+#define NUMERIC_NEG			0x4000
+#define NUMERIC_SHORT		0x8000
+#define NUMERIC_SPECIAL		0xC000
+
+/* special values (NaN, and infinities since 14) */
+#define NUMERIC_EXT_SIGN_MASK	0xF000
+#define NUMERIC_PINF			0xD000
+#define NUMERIC_NINF			0xF000
+
+#define NUMERIC_SHORT_SIGN_MASK			0x2000
+#define NUMERIC_SHORT_DSCALE_MASK		0x1F80
+#define NUMERIC_SHORT_DSCALE_SHIFT		7
+#define NUMERIC_SHORT_WEIGHT_SIGN_MASK	0x0040
+#define NUMERIC_SHORT_WEIGHT_MASK		0x003F
+#define NUMERIC_DSCALE_MASK				0x3FFF
+
+typedef struct JsonNumeric
+{
+	int			special;		/* 0 or one of JSON_NUM_* */
+	bool		negative;
+	int			weight;			/* weight of the first digit, in NBASE */
+	int			dscale;			/* display scale */
+	int			ndigits;
+	const int16 *digits;
+} JsonNumeric;
+
+static void json_numeric_decode( const char *data, size_t len, JsonNumeric *num )
+{
+	uint16		header;
+
+	memcpy( &header, data, sizeof( header ) );
+
+	num->special = 0;
+	num->negative = false;
+	num->weight = 0;
+	num->dscale = 0;
+	num->ndigits = 0;
+	num->digits = NULL;
+
+	switch (header & NUMERIC_SIGN_MASK)
+	{
+		case NUMERIC_SPECIAL:
+			if ((header & NUMERIC_EXT_SIGN_MASK) == NUMERIC_PINF)
+				num->special = JSON_NUM_PINF;
+			else if ((header & NUMERIC_EXT_SIGN_MASK) == NUMERIC_NINF)
+				num->special = JSON_NUM_NINF;
+			else
+				num->special = JSON_NUM_NAN;
+		break;
+
+		case NUMERIC_SHORT:
+			num->negative = (header & NUMERIC_SHORT_SIGN_MASK) != 0;
+			num->dscale = (header & NUMERIC_SHORT_DSCALE_MASK) >> NUMERIC_SHORT_DSCALE_SHIFT;
+			num->weight = (header & NUMERIC_SHORT_WEIGHT_MASK);
+			if (header & NUMERIC_SHORT_WEIGHT_SIGN_MASK)
+				num->weight |= ~NUMERIC_SHORT_WEIGHT_MASK;
+			num->digits = (const int16 *) (data + sizeof( uint16 ));
+			num->ndigits = (len - sizeof( uint16 )) / sizeof( int16 );
+		break;
+
+		default:
+		{
+			int16		weight;
+
+			memcpy( &weight, data + sizeof( uint16 ), sizeof( int16 ) );
+
+			num->negative = (header & NUMERIC_SIGN_MASK) == NUMERIC_NEG;
+			num->dscale = header & NUMERIC_DSCALE_MASK;
+			num->weight = weight;
+			num->digits = (const int16 *) (data + sizeof( uint16 ) + sizeof( int16 ));
+			num->ndigits = (len - sizeof( uint16 ) - sizeof( int16 )) / sizeof( int16 );
+		}
+	}
+}
+
+size_t json_format_numeric_maxlen( const char *data, size_t len )
+{
+	JsonNumeric	num;
+
+	json_numeric_decode( data, len, &num );
+
+	if (num.special)
+		return JSON_NUMFMT_BUFLEN;
+
+	/* sign, integral digits, point, fraction rounded up to whole NBASE digits */
+	return 1 + (num.weight >= 0 ? (num.weight + 1) * DEC_DIGITS : 1) + 1 + num.dscale + DEC_DIGITS;
+}
+
+static inline char *json_put_digit4( char *p, int dig )
+{
+	memcpy( p, json_digit_pairs + (dig / 100) * 2, 2 );
+	memcpy( p + 2, json_digit_pairs + (dig % 100) * 2, 2 );
+	return p + 4;
+}
+
+int json_format_numeric( char *dst, const char *data, size_t len )
+{
+	JsonNumeric	num;
+	char	   *p = dst;
+	int			d;
+
+	json_numeric_decode( data, len, &num );
+
+	if (num.special)
+		return num.special;
+
+	if (num.negative)
+		*p++ = '-';
+
+	/* integral part, the first digit without leading zeroes */
+	if (num.weight < 0)
+		*p++ = '0';
+	else
+	{
+		for (d = 0; d <= num.weight; d++)
+		{
+			int			dig = (d < num.ndigits) ? num.digits[ d ] : 0;
+
+			if (d == 0)
+				p += json_format_uint64( p, dig );
+			else
+				p = json_put_digit4( p, dig );
+		}
+	}
+
+	/* fraction, cut back to dscale digits afterwards */
+	if (num.dscale > 0)
+	{
+		char	   *endp;
+		int			i;
+
+		*p++ = '.';
+		endp = p + num.dscale;
+
+		for (i = 0, d = num.weight + 1; i < num.dscale; i += DEC_DIGITS, d++)
+		{
+			int			dig = (d >= 0 && d < num.ndigits) ? num.digits[ d ] : 0;
+
+			p = json_put_digit4( p, dig );
+		}
+
+		p = endp;
+	}
+
+	return p - dst;
+}
+
+/*
+ * JSON number grammar: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+ */
+bool json_is_number( const char *str )
+{
+	const char *p = str;
+
+	if (*p == '-')
+		p++;
+
+	if (*p == '0')
+		p++;
+	else if (*p >= '1' && *p <= '9')
+	{
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	else
+		return false;
+
+	if (*p == '.')
+	{
+		p++;
+		if (!(*p >= '0' && *p <= '9'))
+			return false;
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	if (*p == 'e' || *p == 'E')
+	{
+		p++;
+		if (*p == '+' || *p == '-')
+			p++;
+		if (!(*p >= '0' && *p <= '9'))
+			return false;
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	return *p == '\0';
+}
@@ -0,0 +1,37 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer number formatting kernels
+*
+* Format binary numbers straight into a caller supplied buffer. Builds with
+* FRONTEND as well, so it can be linked into standalone programs too.
+*/
+
+#ifndef JSON_NUMFMT_H
+#define JSON_NUMFMT_H
+
+/* room needed by json_format_int64 / json_format_double / json_format_float */
+#define JSON_NUMFMT_BUFLEN	32
+
+/* returned instead of a length for values JSON has no number for */
+#define JSON_NUM_NAN		(-1)
+#define JSON_NUM_PINF		(-2)
+#define JSON_NUM_NINF		(-3)
+
+extern int json_format_int64( char *dst, int64 value );
+extern int json_format_double( char *dst, double value );
+extern int json_format_float( char *dst, float value );
+
+/*
+ * Numerics are formatted from their on-disk digits, data/len being the
+ * detoasted value without its varlena header.
+ */
+extern size_t json_format_numeric_maxlen( const char *data, size_t len );
+extern int json_format_numeric( char *dst, const char *data, size_t len );
+
+/* JSON spelling of the special values above, as a quoted string */
+extern const char *json_special_number( int code );
+
+/* does the output of a numeric-category type parse as a JSON number */
+extern bool json_is_number( const char *str );
+
+#endif /* JSON_NUMFMT_H */
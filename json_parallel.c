@@ -0,0 +1,454 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer parallel parsing of large JSON arrays
+*
+* With json_serializer.parallel_workers above zero, from_json_set splits
+* large documents among parallel workers. The leader first walks the
+* top-level array without converting anything, cutting it into one byte
+* range of whole elements per worker, and copies the document into the
+* segment of a parallel context. The workers join the leader's transaction
+* with its snapshot, user and settings, so types created or altered by it
+* and not yet committed look the same to them, convert one range each
+* into tuples and send them back through their own shm_mq. The leader
+* drains all queues as tuples arrive and keeps the output of each range
+* apart, so the result is in document order. Ranges left without a worker
+* are parsed by the leader, which still empties the queues every few rows
+* so the workers never wait long on a full one. Errors raised by a worker
+* are rethrown by the leader through the parallel context.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "executor/tuptable.h"
+#include "pgstat.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shm_toc.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+
+#include "deserializer.h"
+#include "json_parallel.h"
+
+void json_parallel_worker_main( dsm_segment *seg, shm_toc *toc );
+
+/* keys of our own, the parallel context keeps its entries above these */
+#define JSON_PARALLEL_KEY_SHARED		1
+#define JSON_PARALLEL_KEY_TUPLE_QUEUE	2
+#define JSON_PARALLEL_KEY_DOCUMENT		3
+
+#define JSON_PARALLEL_TUPLE_QUEUE_SIZE	(256 * 1024)
+
+#define JSON_PARALLEL_MAX_WORKERS		64
+
+/* rows the leader parses itself between two passes over the queues */
+#define JSON_PARALLEL_DRAIN_ROWS		64
+
+#if PG_VERSION_NUM >= 100000
+#define json_toc_lookup( toc, key )		shm_toc_lookup( toc, key, false )
+#define json_parallel_context( nworkers ) \
+	CreateParallelContext( "serializer", "json_parallel_worker_main", nworkers )
+#define json_wait_latch( events )		WaitLatch( MyLatch, events, 0, PG_WAIT_EXTENSION )
+#else
+#define json_toc_lookup( toc, key )		shm_toc_lookup( toc, key )
+#define json_parallel_context( nworkers ) \
+	CreateParallelContextForExternalFunction( "serializer", "json_parallel_worker_main", nworkers )
+#define json_wait_latch( events )		WaitLatch( MyLatch, events, 0 )
+#endif
+
+int json_parallel_workers = 0;
+
+/* whole elements doc[start..end), separated by commas */
+typedef struct JsonParallelRange
+{
+	uint32		start;
+	uint32		end;
+} JsonParallelRange;
+
+typedef struct JsonParallelShared
+{
+	Oid			typid;
+	int			nranges;
+	JsonParallelRange ranges[ FLEXIBLE_ARRAY_MEMBER ];
+} JsonParallelShared;
+
+/* the leader's side of the tuple queues, one slot per range */
+typedef struct JsonParallelQueues
+{
+	ParallelContext *pcxt;
+	int			nranges;
+	int			nactive;
+	shm_mq_handle **tqh;
+	Tuplestorestate **stores;
+	bool	   *done;
+} JsonParallelQueues;
+
+/* a range the leader parses itself, still serving the queues meanwhile */
+typedef struct JsonParallelLocal
+{
+	Tuplestorestate *store;
+	JsonParallelQueues *queues;
+	int			nrows;
+} JsonParallelLocal;
+
+void json_parallel_init( void )
+{
+	DefineCustomIntVariable( "json_serializer.parallel_workers",
+							 "Sets the number of parallel workers, run in the caller's transaction, that parse a large from_json_set document.",
+							 "Zero or one parses every document in the calling backend.",
+							 &json_parallel_workers,
+							 0,
+							 0,
+							 JSON_PARALLEL_MAX_WORKERS,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL );
+}
+
+/*
+ * Cut the top-level array into at most nranges ranges of about the same
+ * size. Elements are stepped over, not converted, which also checks the
+ * syntax of the whole document before any worker starts.
+ */
+static int json_parallel_split( const char *data, int len, JsonParallelRange *ranges, int nranges )
+{
+	JsonParser	parser;
+	uint32		target = len / nranges;
+	bool		open = false;
+	int			n = 0;
+
+	json_parser_init( &parser, data, len );
+
+	if (json_parser_begin( &parser, '[', ']' ))
+	{
+		do
+		{
+			uint32		start;
+
+			json_parser_peek( &parser );
+			start = (uint32) (parser.p - parser.start);
+
+			json_parser_skip( &parser );
+
+			if (!open)
+			{
+				ranges[ n ].start = start;
+				open = true;
+			}
+
+			ranges[ n ].end = (uint32) (parser.p - parser.start);
+
+			/* the last range takes whatever is left */
+			if (ranges[ n ].end - ranges[ n ].start >= target && n < nranges - 1)
+			{
+				n++;
+				open = false;
+			}
+		} while (json_parser_next( &parser, ']' ));
+	}
+
+	json_parser_finish( &parser );
+
+	if (open)
+		n++;
+
+	return n;
+}
+
+/*
+ * Convert the elements of one range, in a scratch context reset after
+ * every tuple. Stops early when emit returns false.
+ */
+static void json_parallel_parse_range( JsonPlan *plan, const char *doc, JsonParallelRange *range,
+									   bool (*emit) ( HeapTuple tuple, void *arg ), void *arg )
+{
+	JsonParser	parser;
+	MemoryContext scratch;
+	MemoryContext oldcontext;
+
+	json_parser_init( &parser, doc + range->start, range->end - range->start );
+
+	scratch = AllocSetContextCreate( CurrentMemoryContext,
+									 "from_json_set row",
+									 ALLOCSET_DEFAULT_MINSIZE,
+									 ALLOCSET_DEFAULT_INITSIZE,
+									 ALLOCSET_DEFAULT_MAXSIZE );
+
+	for (;;)
+	{
+		bool		more;
+
+		oldcontext = MemoryContextSwitchTo( scratch );
+		more = emit( deserialize_record_tuple( &parser, plan ), arg );
+		MemoryContextSwitchTo( oldcontext );
+		MemoryContextReset( scratch );
+
+		if (!more || json_parser_peek( &parser ) != ',')
+			break;
+
+		json_parser_expect( &parser, ',' );
+	}
+
+	MemoryContextDelete( scratch );
+}
+
+/*
+ * A worker's tuple queue was detached before it finished. The parallel
+ * context rethrows the error the worker sent while we wait for the others
+ * to exit; a worker that died without one is reported here.
+ */
+static void json_parallel_lost( ParallelContext *pcxt )
+{
+	WaitForParallelWorkersToFinish( pcxt );
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INTERNAL_ERROR),
+			 errmsg("from_json_set worker exited before finishing its part of the document")));
+}
+
+/*
+ * Drain every attached queue as far as it goes without waiting. A
+ * zero-length message ends a range. Returns whether anything arrived.
+ */
+static bool json_parallel_drain( JsonParallelQueues *queues )
+{
+	bool		progress = false;
+	int			i;
+
+	for (i = 0; i < queues->nranges; i++)
+	{
+		while (queues->tqh[ i ] != NULL && !queues->done[ i ])
+		{
+			HeapTupleData tuple;
+			Size		nbytes;
+			void	   *msg;
+			shm_mq_result res = shm_mq_receive( queues->tqh[ i ], &nbytes, &msg, true );
+
+			if (res == SHM_MQ_WOULD_BLOCK)
+				break;
+
+			if (res == SHM_MQ_DETACHED)
+				json_parallel_lost( queues->pcxt );
+
+			progress = true;
+
+			if (nbytes == 0)
+			{
+				queues->done[ i ] = true;
+				queues->nactive--;
+				break;
+			}
+
+			tuple.t_len = nbytes;
+			ItemPointerSetInvalid( &tuple.t_self );
+			tuple.t_tableOid = InvalidOid;
+			tuple.t_data = (HeapTupleHeader) msg;
+
+			tuplestore_puttuple( queues->stores[ i ], &tuple );
+		}
+	}
+
+	return progress;
+}
+
+/*
+ * Stores a row of a range the leader parses, and every few rows empties
+ * the queues so that workers do not stall on a full one meanwhile.
+ */
+static bool json_parallel_store( HeapTuple tuple, void *arg )
+{
+	JsonParallelLocal *local = (JsonParallelLocal *) arg;
+
+	tuplestore_puttuple( local->store, tuple );
+
+	if (++local->nrows % JSON_PARALLEL_DRAIN_ROWS == 0 && local->queues->nactive > 0)
+	{
+		json_parallel_drain( local->queues );
+
+		/* also receives the messages of the workers, errors included */
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return true;
+}
+
+static bool json_parallel_send( HeapTuple tuple, void *arg )
+{
+	/* the leader is gone when this fails, it reports why */
+	return shm_mq_send( (shm_mq_handle *) arg, tuple->t_len, tuple->t_data, false ) == SHM_MQ_SUCCESS;
+}
+
+bool json_parallel_record_set( Tuplestorestate *tupstore, JsonPlan *plan,
+							   const char *data, int len )
+{
+	JsonParallelRange ranges[ JSON_PARALLEL_MAX_WORKERS ];
+	JsonParallelShared *shared;
+	ParallelContext *pcxt;
+	Size		shared_size;
+	char	   *tuple_queues;
+	char	   *doc;
+	JsonParallelQueues queues;
+	TupleTableSlot *slot;
+	int			nranges;
+	int			i;
+
+	/* as for parallel plans, predicate locks are not shared with workers */
+	if (json_parallel_workers <= 0 || len < JSON_PARALLEL_MIN_SIZE || IsInParallelMode() ||
+		IsolationIsSerializable())
+		return false;
+
+	nranges = json_parallel_split( data, len, ranges, json_parallel_workers );
+	if (nranges < 2)
+		return false;
+
+	EnterParallelMode();
+
+	pcxt = json_parallel_context( nranges );
+
+	/* the document, one range per worker and a tuple queue each */
+	shared_size = offsetof( JsonParallelShared, ranges ) + nranges * sizeof( JsonParallelRange );
+
+	shm_toc_estimate_chunk( &pcxt->estimator, shared_size );
+	shm_toc_estimate_chunk( &pcxt->estimator, mul_size( nranges, JSON_PARALLEL_TUPLE_QUEUE_SIZE ) );
+	shm_toc_estimate_chunk( &pcxt->estimator, len );
+	shm_toc_estimate_keys( &pcxt->estimator, 3 );
+
+	/* also copies the transaction, snapshots, user and settings for the workers */
+	InitializeParallelDSM( pcxt );
+
+	shared = (JsonParallelShared *) shm_toc_allocate( pcxt->toc, shared_size );
+	shared->typid = plan->typid;
+	shared->nranges = nranges;
+	memcpy( shared->ranges, ranges, nranges * sizeof( JsonParallelRange ) );
+	shm_toc_insert( pcxt->toc, JSON_PARALLEL_KEY_SHARED, shared );
+
+	tuple_queues = (char *) shm_toc_allocate( pcxt->toc, mul_size( nranges, JSON_PARALLEL_TUPLE_QUEUE_SIZE ) );
+	shm_toc_insert( pcxt->toc, JSON_PARALLEL_KEY_TUPLE_QUEUE, tuple_queues );
+
+	doc = (char *) shm_toc_allocate( pcxt->toc, len );
+	memcpy( doc, data, len );
+	shm_toc_insert( pcxt->toc, JSON_PARALLEL_KEY_DOCUMENT, doc );
+
+	for (i = 0; i < nranges; i++)
+	{
+		shm_mq	   *tq = shm_mq_create( tuple_queues + i * JSON_PARALLEL_TUPLE_QUEUE_SIZE,
+										JSON_PARALLEL_TUPLE_QUEUE_SIZE );
+
+		shm_mq_set_receiver( tq, MyProc );
+	}
+
+	LaunchParallelWorkers( pcxt );
+
+	queues.pcxt = pcxt;
+	queues.nranges = nranges;
+	queues.nactive = 0;
+	queues.tqh = (shm_mq_handle **) palloc0( nranges * sizeof( shm_mq_handle * ) );
+	queues.stores = (Tuplestorestate **) palloc( nranges * sizeof( Tuplestorestate * ) );
+	queues.done = (bool *) palloc0( nranges * sizeof( bool ) );
+
+	/* the first range goes straight into the result, the others follow it */
+	queues.stores[ 0 ] = tupstore;
+	for (i = 1; i < nranges; i++)
+		queues.stores[ i ] = tuplestore_begin_heap( false, false, work_mem );
+
+	for (i = 0; i < pcxt->nworkers_launched; i++)
+	{
+		queues.tqh[ i ] = shm_mq_attach( (shm_mq *) (tuple_queues + i * JSON_PARALLEL_TUPLE_QUEUE_SIZE),
+										 pcxt->seg, pcxt->worker[ i ].bgwhandle );
+		queues.nactive++;
+	}
+
+	/*
+	 * Out of worker slots (max_worker_processes): the remaining ranges are
+	 * parsed here, draining the workers' queues in between.
+	 */
+	for (i = pcxt->nworkers_launched; i < nranges; i++)
+	{
+		JsonParallelLocal local;
+
+		local.store = queues.stores[ i ];
+		local.queues = &queues;
+		local.nrows = 0;
+
+		json_parallel_parse_range( plan, data, &ranges[ i ], json_parallel_store, &local );
+		queues.done[ i ] = true;
+	}
+
+	/* drain what is left, sleeping until a worker sends more or goes away */
+	while (queues.nactive > 0)
+	{
+		bool		progress = json_parallel_drain( &queues );
+
+		if (!progress && queues.nactive > 0)
+		{
+			int			rc = json_wait_latch( WL_LATCH_SET | WL_POSTMASTER_DEATH );
+
+			if (rc & WL_POSTMASTER_DEATH)
+				proc_exit( 1 );
+
+			ResetLatch( MyLatch );
+		}
+
+		/* also receives the messages of the workers, errors included */
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	WaitForParallelWorkersToFinish( pcxt );
+
+	/* append the other ranges to the result, in order */
+	slot = MakeSingleTupleTableSlot( plan->tupdesc );
+
+	for (i = 1; i < nranges; i++)
+	{
+		tuplestore_rescan( queues.stores[ i ] );
+
+		while (tuplestore_gettupleslot( queues.stores[ i ], true, false, slot ))
+			tuplestore_puttupleslot( tupstore, slot );
+
+		tuplestore_end( queues.stores[ i ] );
+	}
+
+	ExecDropSingleTupleTableSlot( slot );
+
+	DestroyParallelContext( pcxt );
+	ExitParallelMode();
+
+	return true;
+}
+
+/*
+ * Entry point of the workers, started by the parallel context with the
+ * leader's transaction and settings in place. ParallelWorkerNumber is the
+ * range to convert.
+ */
+void json_parallel_worker_main( dsm_segment *seg, shm_toc *toc )
+{
+	JsonParallelShared *shared;
+	JsonPlanRef	ref = { NULL, 0 };
+	JsonPlan   *plan;
+	shm_mq	   *mq;
+	shm_mq_handle *tqh;
+	char	   *doc;
+
+	shared = (JsonParallelShared *) json_toc_lookup( toc, JSON_PARALLEL_KEY_SHARED );
+
+	mq = (shm_mq *) ((char *) json_toc_lookup( toc, JSON_PARALLEL_KEY_TUPLE_QUEUE ) +
+					 ParallelWorkerNumber * JSON_PARALLEL_TUPLE_QUEUE_SIZE);
+	shm_mq_set_sender( mq, MyProc );
+	tqh = shm_mq_attach( mq, seg, NULL );
+
+	doc = (char *) json_toc_lookup( toc, JSON_PARALLEL_KEY_DOCUMENT );
+	plan = json_plan_get( &ref, shared->typid, -1, JSON_PLAN_ROW );
+
+	json_parallel_parse_range( plan, doc, &shared->ranges[ ParallelWorkerNumber ], json_parallel_send, tqh );
+
+	/* end of range, lost if the leader is gone already */
+	shm_mq_send( tqh, 0, NULL, false );
+}
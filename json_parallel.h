@@ -0,0 +1,30 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer parallel parsing of large JSON arrays
+*/
+
+#ifndef JSON_PARALLEL_H
+#define JSON_PARALLEL_H
+
+#include "access/tupdesc.h"
+#include "utils/tuplestore.h"
+
+#include "json_plan.h"
+
+/* documents smaller than this are always parsed by the backend itself */
+#define JSON_PARALLEL_MIN_SIZE	(4 * 1024 * 1024)
+
+extern int json_parallel_workers;
+
+extern void json_parallel_init( void );
+
+/*
+ * Parse the rows of a JSON array of objects with parallel workers in the
+ * caller's transaction into tupstore, in document order. Returns false,
+ * having stored nothing, when parallel parsing is off or not worth it, the
+ * caller then parses serially.
+ */
+extern bool json_parallel_record_set( Tuplestorestate *tupstore, JsonPlan *plan,
+									  const char *data, int len );
+
+#endif /* JSON_PARALLEL_H */
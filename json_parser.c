@@ -0,0 +1,510 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer streaming JSON parser
+*
+* Tokenizes the input once, in place. Strings without escapes are handed
+* out as pointers into the input, clean runs are found with the same
+* vector scan the serializer uses for escaping.
+*/
+
+#include "postgres.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+
+#include "json_parser.h"
+#include "json_escape.h"
+
+static void json_parser_number( JsonParser *parser );
+static void json_parser_literal( JsonParser *parser, const char *word, int len );
+static int json_parser_hex4( JsonParser *parser );
+static void json_parser_unicode( JsonParser *parser, pg_wchar code );
+static const char *json_parser_jump( JsonParser *parser, const char *p );
+static void json_parser_delimiter( JsonParser *parser );
+
+#define JSON_WHITESPACE(c)	((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+
+void json_parser_init( JsonParser *parser, const char *data, int len )
+{
+	parser->start = data;
+	parser->p = data;
+	parser->end = data + len;
+	initStringInfo( &parser->scratch );
+
+	parser->index = NULL;
+	parser->nindex = 0;
+	parser->cursor = 0;
+	parser->indexed_to = 0;
+	memset( &parser->state, 0, sizeof( parser->state ) );
+
+	if (len >= JSON_PARSER_INDEX_MIN)
+		parser->index = palloc( JSON_PARSER_INDEX_WINDOW * sizeof( uint32_t ) );
+}
+
+/*
+ * The first token start at or after p, indexing further windows as the
+ * parser gets to them. Only called with p outside of any token, so what
+ * is skipped is whitespace.
+ */
+static const char *json_parser_jump( JsonParser *parser, const char *p )
+{
+	uint32_t	offset = (uint32_t) (p - parser->start);
+	int			len = (int) (parser->end - parser->start);
+
+	for (;;)
+	{
+		int			window;
+
+		while (parser->cursor < parser->nindex)
+		{
+			if (parser->index[ parser->cursor ] >= offset)
+				return parser->start + parser->index[ parser->cursor ];
+			parser->cursor++;
+		}
+
+		if (parser->indexed_to >= len)
+			return parser->end;
+
+		window = Min( JSON_PARSER_INDEX_WINDOW, len - parser->indexed_to );
+		parser->nindex = (int) json_structural_index( &parser->state, parser->start + parser->indexed_to,
+													   window, (uint32_t) parser->indexed_to, parser->index );
+		parser->cursor = 0;
+		parser->indexed_to += window;
+	}
+}
+
+void json_parser_error( JsonParser *parser, const char *expected )
+{
+	if (parser->p >= parser->end)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type json"),
+				 errdetail("The input string ended unexpectedly, expected %s.", expected)));
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+			 errmsg("invalid input syntax for type json"),
+			 errdetail("Expected %s at offset %d.", expected, (int) (parser->p - parser->start))));
+}
+
+/*
+ * Skip whitespace and return the next character, '\0' at the end
+ */
+char json_parser_peek( JsonParser *parser )
+{
+	const char *p = parser->p;
+
+	if (parser->index != NULL && p < parser->end && JSON_WHITESPACE( *p ))
+		p = json_parser_jump( parser, p );
+
+	while (p < parser->end && JSON_WHITESPACE( *p ))
+		p++;
+
+	parser->p = p;
+
+	return p < parser->end ? *p : '\0';
+}
+
+void json_parser_expect( JsonParser *parser, char c )
+{
+	char		expected[ 4 ] = { '"', c, '"', '\0' };
+
+	if (json_parser_peek( parser ) != c)
+		json_parser_error( parser, expected );
+
+	parser->p++;
+}
+
+/*
+ * Consume the opening character of a container, false if it is empty
+ */
+bool json_parser_begin( JsonParser *parser, char open, char close )
+{
+	check_stack_depth();
+
+	json_parser_expect( parser, open );
+
+	if (json_parser_peek( parser ) == close)
+	{
+		parser->p++;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * After a member or element: true if another one follows
+ */
+bool json_parser_next( JsonParser *parser, char close )
+{
+	char		c = json_parser_peek( parser );
+
+	if (c == ',')
+	{
+		parser->p++;
+		return true;
+	}
+
+	if (c == close)
+	{
+		parser->p++;
+		return false;
+	}
+
+	json_parser_error( parser, close == '}' ? "\",\" or \"}\"" : "\",\" or \"]\"" );
+}
+
+/*
+ * Read a string. Without escapes the result points into the input and is
+ * not null-terminated, otherwise it is the unescaped copy in scratch.
+ */
+void json_parser_string( JsonParser *parser, const char **str, int *len )
+{
+	const char *s;
+	const char *p;
+
+	if (json_parser_peek( parser ) != '"')
+		json_parser_error( parser, "string" );
+
+	s = ++parser->p;
+	p = s + json_escape_clean_prefix( s, parser->end - s );
+
+	if (p < parser->end && *p == '"')
+	{
+		parser->p = p + 1;
+		*str = s;
+		*len = (int) (p - s);
+		return;
+	}
+
+	resetStringInfo( &parser->scratch );
+	appendBinaryStringInfo( &parser->scratch, s, (int) (p - s) );
+	parser->p = p;
+
+	for (;;)
+	{
+		p = parser->p;
+
+		if (p >= parser->end)
+			json_parser_error( parser, "\"\"\"" );
+
+		if (*p == '"')
+		{
+			parser->p++;
+			break;
+		}
+
+		if (*p != '\\')
+		{
+			/* control characters must be escaped */
+			if ((unsigned char) *p < 0x20)
+				json_parser_error( parser, "escaped control character" );
+
+			s = p;
+			p = s + 1;
+			p += json_escape_clean_prefix( p, parser->end - p );
+
+			appendBinaryStringInfo( &parser->scratch, s, (int) (p - s) );
+			parser->p = p;
+			continue;
+		}
+
+		parser->p++;
+		if (parser->p >= parser->end)
+			json_parser_error( parser, "escape sequence" );
+
+		switch (*parser->p++)
+		{
+			case '"': appendStringInfoChar( &parser->scratch, '"' ); break;
+			case '\\': appendStringInfoChar( &parser->scratch, '\\' ); break;
+			case '/': appendStringInfoChar( &parser->scratch, '/' ); break;
+			case 'b': appendStringInfoChar( &parser->scratch, '\b' ); break;
+			case 'f': appendStringInfoChar( &parser->scratch, '\f' ); break;
+			case 'n': appendStringInfoChar( &parser->scratch, '\n' ); break;
+			case 'r': appendStringInfoChar( &parser->scratch, '\r' ); break;
+			case 't': appendStringInfoChar( &parser->scratch, '\t' ); break;
+
+			case 'u':
+			{
+				pg_wchar	code = json_parser_hex4( parser );
+
+				if (code >= 0xD800 && code <= 0xDBFF)
+				{
+					pg_wchar	low;
+
+					/* a surrogate pair */
+					if (parser->end - parser->p < 6 || parser->p[ 0 ] != '\\' || parser->p[ 1 ] != 'u')
+						json_parser_error( parser, "low surrogate" );
+
+					parser->p += 2;
+					low = json_parser_hex4( parser );
+					if (low < 0xDC00 || low > 0xDFFF)
+						json_parser_error( parser, "low surrogate" );
+
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				else if (code >= 0xDC00 && code <= 0xDFFF)
+					json_parser_error( parser, "high surrogate" );
+
+				json_parser_unicode( parser, code );
+			}
+			break;
+
+			default:
+				parser->p--;
+				json_parser_error( parser, "escape sequence" );
+		}
+	}
+
+	*str = parser->scratch.data;
+	*len = parser->scratch.len;
+}
+
+static int json_parser_hex4( JsonParser *parser )
+{
+	int			code = 0;
+	int			i;
+
+	if (parser->end - parser->p < 4)
+		json_parser_error( parser, "four hexadecimal digits" );
+
+	for (i = 0; i < 4; i++)
+	{
+		char		c = *parser->p;
+
+		if (c >= '0' && c <= '9')
+			code = code * 16 + (c - '0');
+		else if (c >= 'a' && c <= 'f')
+			code = code * 16 + (c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			code = code * 16 + (c - 'A' + 10);
+		else
+			json_parser_error( parser, "four hexadecimal digits" );
+
+		parser->p++;
+	}
+
+	return code;
+}
+
+static void json_parser_unicode( JsonParser *parser, pg_wchar code )
+{
+	unsigned char utf8[ 8 ];
+
+	if (code == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
+				 errmsg("unsupported Unicode escape sequence"),
+				 errdetail("\\u0000 cannot be converted to text.")));
+
+	if (code <= 0x7F)
+		appendStringInfoChar( &parser->scratch, (char) code );
+	else if (GetDatabaseEncoding() == PG_UTF8)
+	{
+		unicode_to_utf8( code, utf8 );
+		appendBinaryStringInfo( &parser->scratch, (char *) utf8, pg_utf_mblen( utf8 ) );
+	}
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
+				 errmsg("unsupported Unicode escape sequence"),
+				 errdetail("Unicode escape values cannot be used for code point values above 007F when the server encoding is not UTF8.")));
+}
+
+static void json_parser_number( JsonParser *parser )
+{
+	const char *p = parser->p;
+	const char *end = parser->end;
+
+	if (p < end && *p == '-')
+		p++;
+
+	if (p < end && *p == '0')
+		p++;
+	else if (p < end && *p >= '1' && *p <= '9')
+	{
+		while (p < end && *p >= '0' && *p <= '9')
+			p++;
+	}
+	else
+	{
+		parser->p = p;
+		json_parser_error( parser, "digit" );
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		if (p >= end || *p < '0' || *p > '9')
+		{
+			parser->p = p;
+			json_parser_error( parser, "digit" );
+		}
+		while (p < end && *p >= '0' && *p <= '9')
+			p++;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			p++;
+		if (p >= end || *p < '0' || *p > '9')
+		{
+			parser->p = p;
+			json_parser_error( parser, "digit" );
+		}
+		while (p < end && *p >= '0' && *p <= '9')
+			p++;
+	}
+
+	parser->p = p;
+	json_parser_delimiter( parser );
+}
+
+static void json_parser_literal( JsonParser *parser, const char *word, int len )
+{
+	if (parser->end - parser->p < len || memcmp( parser->p, word, len ) != 0)
+		json_parser_error( parser, "value" );
+
+	parser->p += len;
+	json_parser_delimiter( parser );
+}
+
+/*
+ * A number or literal must not run into the next token. Besides catching
+ * "12abc" early this is what lets the structural index skip whatever lies
+ * between a scalar and the next token start.
+ */
+static void json_parser_delimiter( JsonParser *parser )
+{
+	char		c;
+
+	if (parser->p >= parser->end)
+		return;
+
+	c = *parser->p;
+	if (!JSON_WHITESPACE( c ) && c != ',' && c != ']' && c != '}')
+		json_parser_error( parser, "delimiter" );
+}
+
+/*
+ * Consume a null if that is what comes next
+ */
+bool json_parser_null( JsonParser *parser )
+{
+	if (json_parser_peek( parser ) != 'n')
+		return false;
+
+	json_parser_literal( parser, "null", 4 );
+	return true;
+}
+
+/*
+ * Read any value as text for a type input function: strings unescaped,
+ * numbers and true/false as written, objects and arrays as their raw JSON.
+ * Returns NULL for null, the result lives in scratch until the next call.
+ */
+char *json_parser_scalar( JsonParser *parser )
+{
+	const char *start;
+	const char *str;
+	int			len;
+
+	switch (json_parser_peek( parser ))
+	{
+		case '"':
+			json_parser_string( parser, &str, &len );
+			if (str != parser->scratch.data)
+			{
+				resetStringInfo( &parser->scratch );
+				appendBinaryStringInfo( &parser->scratch, str, len );
+			}
+			return parser->scratch.data;
+
+		case 'n':
+			json_parser_literal( parser, "null", 4 );
+			return NULL;
+
+		case 't':
+			json_parser_literal( parser, "true", 4 );
+			return "true";
+
+		case 'f':
+			json_parser_literal( parser, "false", 5 );
+			return "false";
+
+		case '{':
+		case '[':
+			start = parser->p;
+			json_parser_skip( parser );
+			break;
+
+		default:
+			start = parser->p;
+			json_parser_number( parser );
+	}
+
+	resetStringInfo( &parser->scratch );
+	appendBinaryStringInfo( &parser->scratch, start, (int) (parser->p - start) );
+
+	return parser->scratch.data;
+}
+
+/*
+ * Step over one value, checking its syntax
+ */
+void json_parser_skip( JsonParser *parser )
+{
+	const char *str;
+	int			len;
+
+	switch (json_parser_peek( parser ))
+	{
+		case '{':
+			if (json_parser_begin( parser, '{', '}' ))
+				do
+				{
+					json_parser_string( parser, &str, &len );
+					json_parser_expect( parser, ':' );
+					json_parser_skip( parser );
+				} while (json_parser_next( parser, '}' ));
+		break;
+
+		case '[':
+			if (json_parser_begin( parser, '[', ']' ))
+				do
+				{
+					json_parser_skip( parser );
+				} while (json_parser_next( parser, ']' ));
+		break;
+
+		case '"':
+			json_parser_string( parser, &str, &len );
+		break;
+
+		case 'n':
+			json_parser_literal( parser, "null", 4 );
+		break;
+
+		case 't':
+			json_parser_literal( parser, "true", 4 );
+		break;
+
+		case 'f':
+			json_parser_literal( parser, "false", 5 );
+		break;
+
+		default:
+			json_parser_number( parser );
+	}
+}
+
+/*
+ * Only whitespace may follow the top-level value
+ */
+void json_parser_finish( JsonParser *parser )
+{
+	if (json_parser_peek( parser ) != '\0')
+		json_parser_error( parser, "end of input" );
+}
@@ -0,0 +1,62 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer streaming JSON parser
+*/
+
+#ifndef JSON_PARSER_H
+#define JSON_PARSER_H
+
+#include "lib/stringinfo.h"
+
+#include "json_structural.h"
+
+/*
+ * Pull parser over a JSON text that need not be null-terminated. Callers
+ * walk the input value by value, nothing is built beyond the current
+ * scalar, which is unescaped into scratch.
+ *
+ * Containers are read as
+ *
+ *		if (json_parser_begin( parser, '{', '}' ))
+ *			do
+ *			{
+ *				json_parser_string( parser, &key, &keylen );
+ *				json_parser_expect( parser, ':' );
+ *				... one value ...
+ *			} while (json_parser_next( parser, '}' ));
+ *
+ * Inputs of JSON_PARSER_INDEX_MIN bytes or more are indexed window by
+ * window (see json_structural.h) and whitespace is stepped over by jumping
+ * to the next token start instead of byte by byte.
+ */
+#define JSON_PARSER_INDEX_MIN		(64 * 1024)
+#define JSON_PARSER_INDEX_WINDOW	(64 * 1024)
+
+typedef struct JsonParser
+{
+	const char *start;
+	const char *p;
+	const char *end;
+	StringInfoData scratch;
+
+	/* structural index, NULL for small inputs */
+	uint32_t   *index;
+	int			nindex;
+	int			cursor;				/* first entry not yet passed */
+	int			indexed_to;			/* offset the index covers up to */
+	JsonStructuralState state;
+} JsonParser;
+
+extern void json_parser_init( JsonParser *parser, const char *data, int len );
+extern char json_parser_peek( JsonParser *parser );
+extern void json_parser_expect( JsonParser *parser, char c );
+extern bool json_parser_begin( JsonParser *parser, char open, char close );
+extern bool json_parser_next( JsonParser *parser, char close );
+extern void json_parser_string( JsonParser *parser, const char **str, int *len );
+extern bool json_parser_null( JsonParser *parser );
+extern char *json_parser_scalar( JsonParser *parser );
+extern void json_parser_skip( JsonParser *parser );
+extern void json_parser_finish( JsonParser *parser );
+extern void json_parser_error( JsonParser *parser, const char *expected ) pg_attribute_noreturn();
+
+#endif /* JSON_PARSER_H */
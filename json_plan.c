@@ -0,0 +1,550 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer per-type serialization plan cache
+*
+* A plan holds everything serialize_record/serialize_array used to look up
+* in the catalog for every value: tuple descriptor, column names, type
+* categories and output functions. The deserializer uses the same plans
+* for input functions and to match JSON keys to columns, through a table
+* of the column names sorted by length. Row plans also carry the columns
+* compiled into ops for the writer, with the keys escaped in advance.
+* Plans are built once per backend, kept in a hash keyed by (type, typmod,
+* kind) and dropped by syscache/relcache invalidation callbacks when the
+* type or its relation is altered.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/hash.h"
+#include "access/htup.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "nodes/pg_list.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
+
+#include "json_escape.h"
+#include "json_plan.h"
+#include "json_stats.h"
+
+typedef struct JsonPlanKey
+{
+	Oid			typid;
+	int32		typmod;
+	int32		kind;
+} JsonPlanKey;
+
+typedef struct JsonPlanEntry
+{
+	JsonPlanKey	key;			/* hash key, must be first */
+	JsonPlan   *plan;
+} JsonPlanEntry;
+
+/* bumped whenever a plan is invalidated, 0 is never a valid generation */
+uint32 json_plan_generation = 1;
+
+static HTAB *json_plan_hash = NULL;
+
+/* invalidated plans, may still be in use until the end of transaction */
+static JsonPlan *json_plan_dead = NULL;
+
+/* invalidation callbacks run so far, matching a plan or not */
+static uint32 json_plan_inval_count = 0;
+
+static void json_plan_init( void );
+static int json_plan_name_cmp( const char *a, int alen, const char *b, int blen );
+static int json_plan_column_cmp( const void *a, const void *b );
+static void json_plan_compile_op( JsonOp *op, JsonColumnPlan *column );
+static void json_plan_add_nested( JsonPlan *plan, JsonTypeInfo *type );
+static JsonPlan *json_plan_build( Oid typid, int32 typmod, char kind );
+static void json_plan_retire( JsonPlan *plan );
+static void json_plan_invalidate( JsonPlanEntry *entry );
+static void json_plan_syscache_callback( Datum arg, int cacheid, uint32 hashvalue );
+static void json_plan_relcache_callback( Datum arg, Oid relid );
+static void json_plan_xact_callback( XactEvent event, void *arg );
+
+static void json_plan_init( void )
+{
+	HASHCTL		ctl;
+
+	MemSet( &ctl, 0, sizeof( ctl ) );
+	ctl.keysize = sizeof( JsonPlanKey );
+	ctl.entrysize = sizeof( JsonPlanEntry );
+	ctl.hash = tag_hash;
+	ctl.hcxt = CacheMemoryContext;
+
+	json_plan_hash = hash_create( "json serializer plans", 64, &ctl,
+								  HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+
+	CacheRegisterSyscacheCallback( TYPEOID, json_plan_syscache_callback, (Datum) 0 );
+	CacheRegisterRelcacheCallback( json_plan_relcache_callback, (Datum) 0 );
+	RegisterXactCallback( json_plan_xact_callback, NULL );
+}
+
+/*
+ * Collect output and input information of a type with a single pg_type
+ * lookup
+ */
+void json_plan_type_info( JsonTypeInfo *info, Oid typid, MemoryContext cxt )
+{
+	HeapTuple	type_tuple;
+	Form_pg_type type_form;
+	Oid			typoutput;
+	Oid			typinput;
+
+	type_tuple = SearchSysCache1( TYPEOID, ObjectIdGetDatum( typid ) );
+	if (!HeapTupleIsValid( type_tuple ))
+		elog(ERROR, "cache lookup failed for type %u", typid);
+
+	type_form = (Form_pg_type) GETSTRUCT( type_tuple );
+
+	info->typid = typid;
+	info->category = type_form->typcategory;
+	info->typlen = type_form->typlen;
+	info->typbyval = type_form->typbyval;
+	info->typalign = type_form->typalign;
+	info->elemtype = type_form->typelem;
+	info->typioparam = getTypeIOParam( type_tuple );
+	typoutput = type_form->typoutput;
+	typinput = type_form->typinput;
+
+	ReleaseSysCache( type_tuple );
+
+	fmgr_info_cxt( typoutput, &info->outfunc, cxt );
+	fmgr_info_cxt( typinput, &info->infunc, cxt );
+
+	info->child.plan = NULL;
+	info->child.generation = 0;
+}
+
+/* order of by_name: length first, so most comparisons stop there */
+static int json_plan_name_cmp( const char *a, int alen, const char *b, int blen )
+{
+	if (alen != blen)
+		return alen < blen ? -1 : 1;
+
+	return memcmp( a, b, alen );
+}
+
+static int json_plan_column_cmp( const void *a, const void *b )
+{
+	const JsonColumnPlan *ca = *(JsonColumnPlan * const *) a;
+	const JsonColumnPlan *cb = *(JsonColumnPlan * const *) b;
+
+	return json_plan_name_cmp( ca->name, ca->namelen, cb->name, cb->namelen );
+}
+
+/*
+ * Pick the op writing a column and escape its key, in the current context.
+ * Types without an op of their own, domains included, take the generic
+ * path through their category.
+ */
+static void json_plan_compile_op( JsonOp *op, JsonColumnPlan *column )
+{
+	char	   *key;
+	size_t		len;
+
+	switch( column->type.typid )
+	{
+		case INT2OID:		op->code = JSON_OP_INT2;	break;
+		case INT4OID:		op->code = JSON_OP_INT4;	break;
+		case INT8OID:		op->code = JSON_OP_INT8;	break;
+		case FLOAT4OID:		op->code = JSON_OP_FLOAT4;	break;
+		case FLOAT8OID:		op->code = JSON_OP_FLOAT8;	break;
+		case NUMERICOID:	op->code = JSON_OP_NUMERIC;	break;
+		case BOOLOID:		op->code = JSON_OP_BOOL;	break;
+
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			op->code = JSON_OP_TEXT;
+		break;
+
+		default:
+			if (column->type.category == 'C')
+				op->code = JSON_OP_RECORD;
+			else if (column->type.category == 'A')
+				op->code = JSON_OP_ARRAY;
+			else
+				op->code = JSON_OP_GENERIC;
+	}
+
+	// ,"name":
+	key = (char *) palloc( column->namelen * JSON_ESCAPE_MAX_SEQ + 5 );
+	key[ 0 ] = ',';
+	key[ 1 ] = '"';
+	len = 2 + json_escape_buf( key + 2, column->name, column->namelen );
+	key[ len++ ] = '"';
+	key[ len++ ] = ':';
+	key[ len ] = '\0';
+
+	op->attno = column->attno;
+	op->keylen = (int) len;
+	op->key = key;
+	op->column = column;
+}
+
+/*
+ * Fold the rowtype held by a composite column, or by the elements of an
+ * array column, into the version of plan and remember its relation, so
+ * altering a nested rowtype changes the version of every row around it
+ * and invalidates their plans. Anonymous records have no version.
+ */
+static void json_plan_add_nested( JsonPlan *plan, JsonTypeInfo *type )
+{
+	JsonPlanRef	ref = { NULL, 0 };
+	JsonPlan   *child;
+	Oid			typid;
+
+	if (type->category == 'C')
+		typid = type->typid;
+	else if (type->category == 'A' && get_typtype( type->elemtype ) == TYPTYPE_COMPOSITE)
+		typid = type->elemtype;
+	else
+		return;
+
+	if (typid == RECORDOID)
+		return;
+
+	child = json_plan_get( &ref, typid, -1, JSON_PLAN_ROW );
+
+	plan->version = ((plan->version << 5) | (plan->version >> 27)) ^ child->version;
+	plan->nested_relids = list_append_unique_oid( plan->nested_relids, child->typrelid );
+	plan->nested_relids = list_concat_unique_oid( plan->nested_relids, child->nested_relids );
+}
+
+/*
+ * Build a row plan for the given tuple descriptor in a new context under
+ * parent. Used for cached plans and for result descriptors of queries.
+ */
+JsonPlan *json_plan_build_row( TupleDesc tupdesc, MemoryContext parent )
+{
+	MemoryContext cxt;
+	MemoryContext oldcontext;
+	JsonPlan   *plan;
+	int			i;
+
+	cxt = AllocSetContextCreate( parent, "json serializer plan",
+								 ALLOCSET_SMALL_MINSIZE,
+								 ALLOCSET_SMALL_INITSIZE,
+								 ALLOCSET_SMALL_MAXSIZE );
+
+	oldcontext = MemoryContextSwitchTo( cxt );
+
+	PG_TRY();
+	{
+		plan = (JsonPlan *) palloc0( sizeof( JsonPlan ) );
+		plan->cxt = cxt;
+		plan->valid = true;
+		plan->kind = JSON_PLAN_ROW;
+		plan->typid = tupdesc->tdtypeid;
+		plan->typmod = tupdesc->tdtypmod;
+		plan->tupdesc = CreateTupleDescCopy( tupdesc );
+		plan->columns = (JsonColumnPlan *) palloc0( tupdesc->natts * sizeof( JsonColumnPlan ) );
+		plan->stats = json_stats_entry( tupdesc->tdtypeid, 0, NULL );
+
+		for (i = 0; i < tupdesc->natts; i++)
+		{
+			JsonColumnPlan *column;
+
+			/* Ignore dropped columns in datatype */
+			if (tupdesc->attrs[ i ]->attisdropped)
+				continue;
+
+			column = &plan->columns[ plan->ncolumns++ ];
+			column->attno = i;
+			column->name = pstrdup( NameStr( tupdesc->attrs[ i ]->attname ) );
+			column->namelen = strlen( column->name );
+			column->typmod = tupdesc->attrs[ i ]->atttypmod;
+
+			json_plan_type_info( &column->type, tupdesc->attrs[ i ]->atttypid, cxt );
+			column->stats = json_stats_entry( tupdesc->tdtypeid, i + 1, column->name );
+
+			/* tells cached output of an altered rowtype apart, see json_cache.c */
+			plan->version = ((plan->version << 5) | (plan->version >> 27)) ^
+				DatumGetUInt32( hash_any( (const unsigned char *) column->name, column->namelen ) ) ^
+				DatumGetUInt32( hash_uint32( tupdesc->attrs[ i ]->atttypid ) ) ^
+				DatumGetUInt32( hash_uint32( (uint32) column->typmod ) );
+
+			json_plan_add_nested( plan, &column->type );
+		}
+
+		plan->by_name = (JsonColumnPlan **) palloc( Max( plan->ncolumns, 1 ) * sizeof( JsonColumnPlan * ) );
+		for (i = 0; i < plan->ncolumns; i++)
+			plan->by_name[ i ] = &plan->columns[ i ];
+
+		qsort( plan->by_name, plan->ncolumns, sizeof( JsonColumnPlan * ), json_plan_column_cmp );
+
+		plan->ops = (JsonOp *) palloc( Max( plan->ncolumns, 1 ) * sizeof( JsonOp ) );
+		for (i = 0; i < plan->ncolumns; i++)
+			json_plan_compile_op( &plan->ops[ i ], &plan->columns[ i ] );
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo( oldcontext );
+		MemoryContextDelete( cxt );
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo( oldcontext );
+
+	return plan;
+}
+
+static JsonPlan *json_plan_build( Oid typid, int32 typmod, char kind )
+{
+	JsonPlan   *plan;
+
+	if (kind == JSON_PLAN_ROW)
+	{
+		TupleDesc	tupdesc = lookup_rowtype_tupdesc( typid, typmod );
+
+		PG_TRY();
+		{
+			plan = json_plan_build_row( tupdesc, CacheMemoryContext );
+		}
+		PG_CATCH();
+		{
+			ReleaseTupleDesc( tupdesc );
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+
+		ReleaseTupleDesc( tupdesc );
+
+		/* anonymous record types are never altered */
+		if (typid != RECORDOID)
+			plan->typrelid = get_typ_typrelid( typid );
+	}
+	else
+	{
+		MemoryContext cxt;
+
+		cxt = AllocSetContextCreate( CacheMemoryContext, "json serializer plan",
+									 ALLOCSET_SMALL_MINSIZE,
+									 ALLOCSET_SMALL_INITSIZE,
+									 ALLOCSET_SMALL_MAXSIZE );
+
+		plan = (JsonPlan *) MemoryContextAllocZero( cxt, sizeof( JsonPlan ) );
+		plan->cxt = cxt;
+		plan->valid = true;
+		plan->kind = JSON_PLAN_ARRAY;
+
+		PG_TRY();
+		{
+			json_plan_type_info( &plan->element, typid, cxt );
+		}
+		PG_CATCH();
+		{
+			MemoryContextDelete( cxt );
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+	}
+
+	plan->typid = typid;
+	plan->typmod = typmod;
+	plan->type_hash = GetSysCacheHashValue1( TYPEOID, ObjectIdGetDatum( typid ) );
+
+	return plan;
+}
+
+/*
+ * Return the plan for (typid, typmod), reusing the one remembered in ref
+ * while it is still current. Array plans are keyed by the element type.
+ */
+JsonPlan *json_plan_get( JsonPlanRef *ref, Oid typid, int32 typmod, char kind )
+{
+	JsonPlanKey	key;
+	JsonPlanEntry *entry;
+	JsonPlan   *plan;
+	bool		found;
+
+	plan = ref->plan;
+	if (plan != NULL && ref->generation == json_plan_generation &&
+		plan->typid == typid && plan->typmod == typmod && plan->kind == kind)
+	{
+		JSON_STATS_COUNT( plan_hits, 1 );
+		return plan;
+	}
+
+	if (json_plan_hash == NULL)
+		json_plan_init();
+
+	MemSet( &key, 0, sizeof( key ) );
+	key.typid = typid;
+	key.typmod = typmod;
+	key.kind = kind;
+
+	entry = (JsonPlanEntry *) hash_search( json_plan_hash, &key, HASH_FIND, NULL );
+	if (entry != NULL)
+	{
+		JSON_STATS_COUNT( plan_hits, 1 );
+		plan = entry->plan;
+	}
+	else
+	{
+		JSON_STATS_COUNT( plan_misses, 1 );
+
+		/*
+		 * Building reads the catalogs and may process invalidations, which
+		 * cannot reach a plan not entered yet. If any arrived meanwhile the
+		 * plan may come from the old definition, so build it again.
+		 */
+		for (;;)
+		{
+			uint32		inval_count = json_plan_inval_count;
+
+			plan = json_plan_build( typid, typmod, kind );
+
+			if (json_plan_inval_count == inval_count)
+				break;
+
+			json_plan_retire( plan );
+		}
+
+		/* a nested build may have entered the same key already */
+		entry = (JsonPlanEntry *) hash_search( json_plan_hash, &key, HASH_ENTER, &found );
+		if (found)
+			json_plan_retire( entry->plan );
+		entry->plan = plan;
+	}
+
+	ref->plan = plan;
+	ref->generation = json_plan_generation;
+
+	return plan;
+}
+
+/*
+ * Column of a row plan named key[0..keylen), NULL if there is none. JSON
+ * written from a row has its keys in column order, so the column after
+ * the previous match (*hint) is tried before the binary search.
+ */
+JsonColumnPlan *json_plan_find_column( JsonPlan *plan, const char *key, int keylen, int *hint )
+{
+	int			low = 0;
+	int			high = plan->ncolumns - 1;
+
+	if (*hint < plan->ncolumns)
+	{
+		JsonColumnPlan *column = &plan->columns[ *hint ];
+
+		if (column->namelen == keylen && memcmp( column->name, key, keylen ) == 0)
+		{
+			(*hint)++;
+			return column;
+		}
+	}
+
+	while (low <= high)
+	{
+		int			middle = (low + high) / 2;
+		JsonColumnPlan *column = plan->by_name[ middle ];
+		int			cmp = json_plan_name_cmp( key, keylen, column->name, column->namelen );
+
+		if (cmp == 0)
+		{
+			*hint = (int) (column - plan->columns) + 1;
+			return column;
+		}
+
+		if (cmp < 0)
+			high = middle - 1;
+		else
+			low = middle + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * Mark a plan invalid. It may still be referenced by a serialization in
+ * progress, so it is only freed at the end of transaction.
+ */
+static void json_plan_retire( JsonPlan *plan )
+{
+	plan->valid = false;
+	plan->next_dead = json_plan_dead;
+	json_plan_dead = plan;
+}
+
+/*
+ * Drop a plan from the hash
+ */
+static void json_plan_invalidate( JsonPlanEntry *entry )
+{
+	json_plan_retire( entry->plan );
+
+	hash_search( json_plan_hash, &entry->key, HASH_REMOVE, NULL );
+
+	JSON_STATS_COUNT( plan_invalidations, 1 );
+
+	json_plan_generation++;
+	if (json_plan_generation == 0)
+		json_plan_generation = 1;
+}
+
+static void json_plan_syscache_callback( Datum arg, int cacheid, uint32 hashvalue )
+{
+	HASH_SEQ_STATUS status;
+	JsonPlanEntry *entry;
+
+	json_plan_inval_count++;
+
+	hash_seq_init( &status, json_plan_hash );
+	while ((entry = (JsonPlanEntry *) hash_seq_search( &status )) != NULL)
+	{
+		/* hashvalue 0 means the whole cache was reset */
+		if (hashvalue == 0 || entry->plan->type_hash == hashvalue)
+			json_plan_invalidate( entry );
+	}
+}
+
+static void json_plan_relcache_callback( Datum arg, Oid relid )
+{
+	HASH_SEQ_STATUS status;
+	JsonPlanEntry *entry;
+
+	json_plan_inval_count++;
+
+	hash_seq_init( &status, json_plan_hash );
+	while ((entry = (JsonPlanEntry *) hash_seq_search( &status )) != NULL)
+	{
+		JsonPlan   *plan = entry->plan;
+
+		if (plan->typrelid == InvalidOid && plan->nested_relids == NIL)
+			continue;
+
+		/* a nested rowtype changes the version of the plan, see json_plan_add_nested */
+		if (relid == InvalidOid || plan->typrelid == relid ||
+			list_member_oid( plan->nested_relids, relid ))
+			json_plan_invalidate( entry );
+	}
+}
+
+static void json_plan_xact_callback( XactEvent event, void *arg )
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+			while (json_plan_dead != NULL)
+			{
+				JsonPlan   *plan = json_plan_dead;
+
+				json_plan_dead = plan->next_dead;
+				MemoryContextDelete( plan->cxt );
+			}
+			break;
+
+		default:
+			break;
+	}
+}
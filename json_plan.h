@@ -0,0 +1,120 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer per-type serialization plan cache
+*/
+
+#ifndef JSON_PLAN_H
+#define JSON_PLAN_H
+
+#include "fmgr.h"
+#include "access/tupdesc.h"
+#include "nodes/pg_list.h"
+
+/* plan kinds */
+#define JSON_PLAN_ROW	'C'
+#define JSON_PLAN_ARRAY	'A'
+
+struct JsonPlan;
+struct JsonStatsEntry;
+
+/*
+ * Cached reference to a plan (fn_extra, nested columns, array elements).
+ * The pointer may only be followed while generation matches
+ * json_plan_generation, plans are dropped on catalog invalidation.
+ */
+typedef struct JsonPlanRef
+{
+	struct JsonPlan	*plan;
+	uint32			generation;
+} JsonPlanRef;
+
+/* output and input information about a single value type */
+typedef struct JsonTypeInfo
+{
+	Oid			typid;
+	char		category;		/* pg_type.typcategory */
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	Oid			elemtype;		/* pg_type.typelem, element type of arrays */
+	FmgrInfo	outfunc;		/* type output function */
+	FmgrInfo	infunc;			/* type input function */
+	Oid			typioparam;
+	JsonPlanRef	child;			/* plan of composite and array values */
+} JsonTypeInfo;
+
+typedef struct JsonColumnPlan
+{
+	int			attno;			/* 0-based index into deformed values */
+	char	   *name;
+	int			namelen;
+	int32		typmod;			/* pg_attribute.atttypmod, for input */
+	JsonTypeInfo type;
+	struct JsonStatsEntry *stats;	/* NULL for columns of anonymous records */
+} JsonColumnPlan;
+
+/* op codes of the compiled row writer */
+typedef enum JsonOpCode
+{
+	JSON_OP_INT2,
+	JSON_OP_INT4,
+	JSON_OP_INT8,
+	JSON_OP_FLOAT4,
+	JSON_OP_FLOAT8,
+	JSON_OP_NUMERIC,
+	JSON_OP_BOOL,
+	JSON_OP_TEXT,				/* text, varchar, bpchar */
+	JSON_OP_RECORD,
+	JSON_OP_ARRAY,
+	JSON_OP_GENERIC				/* json_write_value */
+} JsonOpCode;
+
+/*
+ * One column of a row, as json_write_columns runs it. The key is escaped
+ * and quoted once, with the separating comma in front; the first column
+ * written skips that byte.
+ */
+typedef struct JsonOp
+{
+	int16		code;			/* JsonOpCode */
+	int16		attno;			/* 0-based index into deformed values */
+	int			keylen;			/* strlen( key ) */
+	const char *key;			/* ,"name": */
+	JsonColumnPlan *column;		/* type info and stats */
+} JsonOp;
+
+typedef struct JsonPlan
+{
+	Oid			typid;			/* row type, or element type for arrays */
+	int32		typmod;
+	int32		kind;			/* JSON_PLAN_ROW or JSON_PLAN_ARRAY */
+
+	MemoryContext cxt;			/* everything below lives here */
+	bool		valid;
+	uint32		type_hash;		/* TYPEOID syscache hash of typid */
+	Oid			typrelid;		/* pg_type.typrelid of typid (or 0) */
+
+	/* row plans */
+	TupleDesc	tupdesc;		/* private copy used for deforming */
+	int			ncolumns;		/* live (not dropped) columns */
+	JsonColumnPlan *columns;
+	JsonColumnPlan **by_name;	/* columns sorted by name length, then name */
+	JsonOp	   *ops;			/* one per column, in column order */
+	uint32		version;		/* hash of column names and types, nested rowtypes included */
+	List	   *nested_relids;	/* typrelid of every rowtype nested at any depth */
+	struct JsonStatsEntry *stats;	/* counters of the rowtype */
+
+	/* array plans */
+	JsonTypeInfo element;
+
+	struct JsonPlan *next_dead;	/* invalidated plans awaiting xact end */
+} JsonPlan;
+
+extern uint32 json_plan_generation;
+
+extern JsonPlan *json_plan_get( JsonPlanRef *ref, Oid typid, int32 typmod, char kind );
+extern JsonPlan *json_plan_build_row( TupleDesc tupdesc, MemoryContext parent );
+extern void json_plan_type_info( JsonTypeInfo *info, Oid typid, MemoryContext cxt );
+extern JsonColumnPlan *json_plan_find_column( JsonPlan *plan, const char *key, int keylen, int *hint );
+
+#endif /* JSON_PLAN_H */
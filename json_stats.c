@@ -0,0 +1,549 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer statistics counters
+*
+* Counters are plain backend-local integers bumped on the hot paths; times
+* are only measured with json_serializer.track_timing on. Rowtypes and their
+* columns get entries in a small local hash, reached through pointers kept
+* in the serialization plans. When the library is in shared_preload_libraries
+* every backend also adds what it counted to shared totals at the end of a
+* transaction, at most every JSON_STATS_FLUSH_INTERVAL ms as pgstat does,
+* when shared statistics are read and when it exits. Rowtype and column
+* entries are kept per database, type oids mean nothing outside theirs.
+*/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#include "json_stats.h"
+
+#define JSON_STATS_NCOUNTERS	(sizeof( JsonStatsCounters ) / sizeof( int64 ))
+#define JSON_STATS_NVALUES		(sizeof( JsonStatsValues ) / sizeof( int64 ))
+
+/* minimum time between two flushes at transaction end, in ms */
+#define JSON_STATS_FLUSH_INTERVAL	500
+
+/* names of the JsonStatsCounters fields, in order */
+static const char *const json_stats_names[] = {
+	"record_calls",
+	"array_calls",
+	"rows",
+	"output_bytes",
+	"escaped_bytes",
+	"escapes",
+	"output_function_calls",
+	"output_function_time_ns",
+	"total_time_ns",
+	"agg_transitions",
+	"agg_finals",
+	"agg_chunks",
+	"agg_spills",
+	"plan_hits",
+	"plan_misses",
+	"plan_invalidations"
+};
+
+/* totals of all backends, only with shared_preload_libraries */
+typedef struct JsonStatsShared
+{
+	LWLock	   *lock;
+	JsonStatsCounters counters;
+} JsonStatsShared;
+
+JsonStatsCounters json_stats;
+bool json_stats_track_timing = false;
+
+static int json_stats_max_tracked = 1000;
+
+/* part of json_stats already added to the shared totals */
+static JsonStatsCounters json_stats_flushed;
+
+static HTAB *json_stats_hash = NULL;
+
+/* end of the last flush, and whether the exit flush is registered */
+static TimestampTz json_stats_last_flush = 0;
+static bool json_stats_exit_registered = false;
+
+static JsonStatsShared *json_stats_shared = NULL;
+static HTAB *json_stats_shared_hash = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+Datum json_serializer_stats( PG_FUNCTION_ARGS );
+Datum json_serializer_column_stats( PG_FUNCTION_ARGS );
+Datum json_serializer_stats_reset( PG_FUNCTION_ARGS );
+
+static Size json_stats_shmem_size( void );
+static void json_stats_shmem_startup( void );
+static void json_stats_flush( void );
+static void json_stats_exit( int code, Datum arg );
+static void json_stats_xact_callback( XactEvent event, void *arg );
+static void json_stats_require_shared( void );
+static Tuplestorestate *json_stats_begin_srf( FunctionCallInfo fcinfo, TupleDesc *tupdesc );
+
+void json_stats_init( void )
+{
+	StaticAssertStmt( lengthof( json_stats_names ) == JSON_STATS_NCOUNTERS,
+					  "json_stats_names does not match JsonStatsCounters" );
+
+	DefineCustomBoolVariable( "json_serializer.track_timing",
+							  "Collects timing statistics of JSON serialization.",
+							  NULL,
+							  &json_stats_track_timing,
+							  false,
+							  PGC_SUSET,
+							  0,
+							  NULL, NULL, NULL );
+
+	DefineCustomIntVariable( "json_serializer.max_tracked",
+							 "Sets the number of rowtype and column entries in shared statistics.",
+							 NULL,
+							 &json_stats_max_tracked,
+							 1000,
+							 100,
+							 INT_MAX / 2,
+							 PGC_POSTMASTER,
+							 0,
+							 NULL, NULL, NULL );
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RequestAddinShmemSpace( json_stats_shmem_size() );
+	RequestNamedLWLockTranche( "json_serializer", 1 );
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = json_stats_shmem_startup;
+
+	RegisterXactCallback( json_stats_xact_callback, NULL );
+}
+
+static Size json_stats_shmem_size( void )
+{
+	return add_size( MAXALIGN( sizeof( JsonStatsShared ) ),
+					 hash_estimate_size( json_stats_max_tracked, sizeof( JsonStatsEntry ) ) );
+}
+
+static void json_stats_shmem_startup( void )
+{
+	HASHCTL		ctl;
+	JsonStatsKey key;
+	JsonStatsEntry *entry;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire( AddinShmemInitLock, LW_EXCLUSIVE );
+
+	json_stats_shared = ShmemInitStruct( "json_serializer stats", sizeof( JsonStatsShared ), &found );
+	if (!found)
+	{
+		json_stats_shared->lock = &(GetNamedLWLockTranche( "json_serializer" ))->lock;
+		MemSet( &json_stats_shared->counters, 0, sizeof( JsonStatsCounters ) );
+	}
+
+	MemSet( &ctl, 0, sizeof( ctl ) );
+	ctl.keysize = sizeof( JsonStatsKey );
+	ctl.entrysize = sizeof( JsonStatsEntry );
+	ctl.hash = tag_hash;
+
+	json_stats_shared_hash = ShmemInitHash( "json_serializer stats hash",
+											json_stats_max_tracked, json_stats_max_tracked,
+											&ctl, HASH_ELEM | HASH_FUNCTION );
+
+	/* entry of type 0 collects whatever does not fit */
+	MemSet( &key, 0, sizeof( key ) );
+	entry = (JsonStatsEntry *) hash_search( json_stats_shared_hash, &key, HASH_ENTER, &found );
+	if (!found)
+	{
+		MemSet( &entry->name, 0, sizeof( NameData ) );
+		MemSet( &entry->counters, 0, sizeof( JsonStatsValues ) );
+		MemSet( &entry->flushed, 0, sizeof( JsonStatsValues ) );
+	}
+
+	LWLockRelease( AddinShmemInitLock );
+}
+
+int64 json_stats_elapsed( instr_time *start )
+{
+	instr_time	now;
+
+	/* timing was turned on after the measurement started */
+	if (INSTR_TIME_IS_ZERO( *start ))
+		return 0;
+
+	INSTR_TIME_SET_CURRENT( now );
+	INSTR_TIME_SUBTRACT( now, *start );
+
+	return (int64) (INSTR_TIME_GET_DOUBLE( now ) * 1000000000.0);
+}
+
+/*
+ * Entry of a rowtype (attno 0) or one of its columns. Entries are never
+ * removed, plans keep pointers to them. Columns of anonymous records are
+ * not tracked, their names differ from one record to the next.
+ */
+JsonStatsEntry *json_stats_entry( Oid typid, int attno, const char *name )
+{
+	JsonStatsKey key;
+	JsonStatsEntry *entry;
+	bool		found;
+
+	if (typid == RECORDOID && attno > 0)
+		return NULL;
+
+	if (json_stats_hash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet( &ctl, 0, sizeof( ctl ) );
+		ctl.keysize = sizeof( JsonStatsKey );
+		ctl.entrysize = sizeof( JsonStatsEntry );
+		ctl.hash = tag_hash;
+		ctl.hcxt = TopMemoryContext;
+
+		json_stats_hash = hash_create( "json serializer stats", 64, &ctl,
+									   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT );
+	}
+
+	MemSet( &key, 0, sizeof( key ) );
+	key.dbid = MyDatabaseId;
+	key.typid = typid;
+	key.attno = attno;
+
+	entry = (JsonStatsEntry *) hash_search( json_stats_hash, &key, HASH_ENTER, &found );
+	if (!found)
+	{
+		MemSet( &entry->counters, 0, sizeof( JsonStatsValues ) );
+		MemSet( &entry->flushed, 0, sizeof( JsonStatsValues ) );
+		namestrcpy( &entry->name, name != NULL ? name : "" );
+	}
+
+	return entry;
+}
+
+/*
+ * Add what was counted since the last flush to the shared totals
+ */
+static void json_stats_flush( void )
+{
+	int64	   *total = (int64 *) &json_stats;
+	int64	   *flushed = (int64 *) &json_stats_flushed;
+	int64	   *shared;
+	HASH_SEQ_STATUS status;
+	JsonStatsEntry *entry;
+	int			i;
+
+	if (json_stats_shared == NULL)
+		return;
+
+	/* every entry update also counts a row or a call */
+	if (memcmp( &json_stats, &json_stats_flushed, sizeof( JsonStatsCounters ) ) == 0)
+		return;
+
+	LWLockAcquire( json_stats_shared->lock, LW_EXCLUSIVE );
+
+	shared = (int64 *) &json_stats_shared->counters;
+	for (i = 0; i < JSON_STATS_NCOUNTERS; i++)
+		shared[ i ] += total[ i ] - flushed[ i ];
+
+	if (json_stats_hash != NULL)
+	{
+		hash_seq_init( &status, json_stats_hash );
+		while ((entry = (JsonStatsEntry *) hash_seq_search( &status )) != NULL)
+		{
+			JsonStatsEntry *target;
+			bool		found;
+
+			if (memcmp( &entry->counters, &entry->flushed, sizeof( JsonStatsValues ) ) == 0)
+				continue;
+
+			target = (JsonStatsEntry *) hash_search( json_stats_shared_hash, &entry->key,
+													 HASH_ENTER_NULL, &found );
+			if (target == NULL)
+			{
+				JsonStatsKey overflow;
+
+				MemSet( &overflow, 0, sizeof( overflow ) );
+				target = (JsonStatsEntry *) hash_search( json_stats_shared_hash, &overflow,
+														 HASH_FIND, NULL );
+			}
+			else if (!found)
+			{
+				target->name = entry->name;
+				MemSet( &target->counters, 0, sizeof( JsonStatsValues ) );
+				MemSet( &target->flushed, 0, sizeof( JsonStatsValues ) );
+			}
+
+			shared = (int64 *) &target->counters;
+			total = (int64 *) &entry->counters;
+			flushed = (int64 *) &entry->flushed;
+
+			for (i = 0; i < JSON_STATS_NVALUES; i++)
+				shared[ i ] += total[ i ] - flushed[ i ];
+
+			entry->flushed = entry->counters;
+		}
+	}
+
+	LWLockRelease( json_stats_shared->lock );
+
+	json_stats_flushed = json_stats;
+}
+
+/* counts held back by the flush interval are not lost at exit */
+static void json_stats_exit( int code, Datum arg )
+{
+	json_stats_flush();
+}
+
+static void json_stats_xact_callback( XactEvent event, void *arg )
+{
+	TimestampTz now;
+
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		case XACT_EVENT_PREPARE:
+			if (json_stats_shared == NULL)
+				break;
+
+			if (!json_stats_exit_registered)
+			{
+				before_shmem_exit( json_stats_exit, (Datum) 0 );
+				json_stats_exit_registered = true;
+			}
+
+			/* the shared lock is exclusive, so busy backends take it rarely */
+			now = GetCurrentTransactionStopTimestamp();
+			if (!TimestampDifferenceExceeds( json_stats_last_flush, now, JSON_STATS_FLUSH_INTERVAL ))
+				break;
+
+			json_stats_flush();
+			json_stats_last_flush = now;
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void json_stats_require_shared( void )
+{
+	if (json_stats_shared == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("json_serializer shared statistics are not available"),
+				 errhint("Add serializer to shared_preload_libraries.")));
+}
+
+static Tuplestorestate *json_stats_begin_srf( FunctionCallInfo fcinfo, TupleDesc *tupdesc )
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	MemoryContext oldcontext;
+
+	if (rsinfo == NULL || !IsA( rsinfo, ReturnSetInfo ))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type( fcinfo, NULL, tupdesc ) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldcontext = MemoryContextSwitchTo( rsinfo->econtext->ecxt_per_query_memory );
+
+	*tupdesc = CreateTupleDescCopy( *tupdesc );
+	tupstore = tuplestore_begin_heap( true, false, work_mem );
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = *tupdesc;
+
+	MemoryContextSwitchTo( oldcontext );
+
+	return tupstore;
+}
+
+/*
+ * json_serializer_stats( shared boolean ) returns table ( name text, value bigint )
+ *
+ * Counters of this backend, or of all backends since the server started
+ * when shared is true.
+ */
+PG_FUNCTION_INFO_V1( json_serializer_stats );
+Datum json_serializer_stats( PG_FUNCTION_ARGS )
+{
+	bool		shared = PG_GETARG_BOOL(0);
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore = json_stats_begin_srf( fcinfo, &tupdesc );
+	JsonStatsCounters counters;
+	int64	   *values = (int64 *) &counters;
+	int			i;
+
+	if (shared)
+	{
+		json_stats_require_shared();
+		json_stats_flush();
+
+		LWLockAcquire( json_stats_shared->lock, LW_SHARED );
+		counters = json_stats_shared->counters;
+		LWLockRelease( json_stats_shared->lock );
+	}
+	else
+		counters = json_stats;
+
+	for (i = 0; i < JSON_STATS_NCOUNTERS; i++)
+	{
+		Datum		row[ 2 ];
+		bool		nulls[ 2 ] = { false, false };
+
+		row[ 0 ] = CStringGetTextDatum( json_stats_names[ i ] );
+		row[ 1 ] = Int64GetDatum( values[ i ] );
+
+		tuplestore_putvalues( tupstore, tupdesc, row, nulls );
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * json_serializer_column_stats( shared boolean ) returns table ( rowtype regtype,
+ *		column_name text, count bigint, bytes bigint, time_ns bigint )
+ *
+ * One row per rowtype (column_name is null, count is rows) and per column
+ * (count is non-null values), of the current database. Times include
+ * nested records and arrays.
+ */
+PG_FUNCTION_INFO_V1( json_serializer_column_stats );
+Datum json_serializer_column_stats( PG_FUNCTION_ARGS )
+{
+	bool		shared = PG_GETARG_BOOL(0);
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore = json_stats_begin_srf( fcinfo, &tupdesc );
+	HTAB	   *hash = json_stats_hash;
+	HASH_SEQ_STATUS status;
+	JsonStatsEntry *entry;
+
+	if (shared)
+	{
+		json_stats_require_shared();
+		json_stats_flush();
+
+		hash = json_stats_shared_hash;
+		LWLockAcquire( json_stats_shared->lock, LW_SHARED );
+	}
+
+	if (hash != NULL)
+	{
+		hash_seq_init( &status, hash );
+		while ((entry = (JsonStatsEntry *) hash_seq_search( &status )) != NULL)
+		{
+			Datum		row[ 5 ];
+			bool		nulls[ 5 ] = { false, false, false, false, false };
+
+			/* untouched overflow entry */
+			if (entry->key.typid == InvalidOid && entry->counters.values == 0)
+				continue;
+
+			/* rowtypes of other databases, the overflow entry is shown to all */
+			if (entry->key.typid != InvalidOid && entry->key.dbid != MyDatabaseId)
+				continue;
+
+			row[ 0 ] = ObjectIdGetDatum( entry->key.typid );
+			nulls[ 0 ] = (entry->key.typid == InvalidOid);
+			row[ 1 ] = CStringGetTextDatum( NameStr( entry->name ) );
+			nulls[ 1 ] = (entry->key.attno == 0);
+			row[ 2 ] = Int64GetDatum( entry->counters.values );
+			row[ 3 ] = Int64GetDatum( entry->counters.bytes );
+			row[ 4 ] = Int64GetDatum( entry->counters.time );
+
+			tuplestore_putvalues( tupstore, tupdesc, row, nulls );
+		}
+	}
+
+	if (shared)
+		LWLockRelease( json_stats_shared->lock );
+
+	return (Datum) 0;
+}
+
+/*
+ * json_serializer_stats_reset( shared boolean ) returns void
+ *
+ * The shared reset clears the server-wide counters, the overflow entry
+ * and the rowtype and column entries of the current database.
+ */
+PG_FUNCTION_INFO_V1( json_serializer_stats_reset );
+Datum json_serializer_stats_reset( PG_FUNCTION_ARGS )
+{
+	bool		shared = PG_GETARG_BOOL(0);
+	HASH_SEQ_STATUS status;
+	JsonStatsEntry *entry;
+
+	if (shared)
+	{
+		json_stats_require_shared();
+
+		if (!superuser())
+			ereport(ERROR,
+					(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+					 errmsg("must be superuser to reset shared json_serializer statistics")));
+
+		LWLockAcquire( json_stats_shared->lock, LW_EXCLUSIVE );
+
+		MemSet( &json_stats_shared->counters, 0, sizeof( JsonStatsCounters ) );
+
+		hash_seq_init( &status, json_stats_shared_hash );
+		while ((entry = (JsonStatsEntry *) hash_seq_search( &status )) != NULL)
+		{
+			if (entry->key.typid == InvalidOid)
+				MemSet( &entry->counters, 0, sizeof( JsonStatsValues ) );
+			else if (entry->key.dbid == MyDatabaseId)
+				hash_search( json_stats_shared_hash, &entry->key, HASH_REMOVE, NULL );
+		}
+
+		LWLockRelease( json_stats_shared->lock );
+
+		PG_RETURN_VOID();
+	}
+
+	/* keep the shared totals complete before forgetting local counts */
+	json_stats_flush();
+
+	MemSet( &json_stats, 0, sizeof( JsonStatsCounters ) );
+	MemSet( &json_stats_flushed, 0, sizeof( JsonStatsCounters ) );
+
+	if (json_stats_hash != NULL)
+	{
+		hash_seq_init( &status, json_stats_hash );
+		while ((entry = (JsonStatsEntry *) hash_seq_search( &status )) != NULL)
+		{
+			MemSet( &entry->counters, 0, sizeof( JsonStatsValues ) );
+			MemSet( &entry->flushed, 0, sizeof( JsonStatsValues ) );
+		}
+	}
+
+	PG_RETURN_VOID();
+}
@@ -0,0 +1,85 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer statistics counters
+*/
+
+#ifndef JSON_STATS_H
+#define JSON_STATS_H
+
+#include "portability/instr_time.h"
+
+/*
+ * Backend-wide counters. Every field is an int64 so that deltas can be
+ * added to the shared totals field by field. Times are in nanoseconds and
+ * only advance while json_serializer.track_timing is on.
+ */
+typedef struct JsonStatsCounters
+{
+	int64		record_calls;		/* to_json(record) */
+	int64		array_calls;		/* to_json(anyarray) */
+	int64		rows;				/* records written, nested ones included */
+	int64		output_bytes;		/* JSON returned by to_json and the final functions */
+	int64		escaped_bytes;		/* string bytes passed through the escaper */
+	int64		escapes;			/* escape sequences written */
+	int64		output_calls;		/* type output function calls */
+	int64		output_time;
+	int64		total_time;			/* in to_json and the aggregate support functions */
+	int64		agg_transitions;
+	int64		agg_finals;
+	int64		agg_chunks;			/* state growth: output chunks sealed */
+	int64		agg_spills;			/* state growth: moved to a temporary file */
+	int64		plan_hits;
+	int64		plan_misses;
+	int64		plan_invalidations;
+} JsonStatsCounters;
+
+/* per rowtype (attno 0) and per column counters */
+typedef struct JsonStatsValues
+{
+	int64		values;				/* rows, or non-null values of a column */
+	int64		bytes;
+	int64		time;
+} JsonStatsValues;
+
+/* type oids are per database, so is the key */
+typedef struct JsonStatsKey
+{
+	Oid			dbid;
+	Oid			typid;
+	int32		attno;
+} JsonStatsKey;
+
+typedef struct JsonStatsEntry
+{
+	JsonStatsKey key;				/* hash key, must be first */
+	NameData	name;				/* column name, empty for rows */
+	JsonStatsValues counters;
+	JsonStatsValues flushed;		/* part of counters already in shared memory */
+} JsonStatsEntry;
+
+extern JsonStatsCounters json_stats;
+extern bool json_stats_track_timing;
+
+#define JSON_STATS_COUNT( field, n )	(json_stats.field += (n))
+
+/* start a measurement, when timing is on */
+#define JSON_STATS_TIMER_START( start ) \
+	do { \
+		if (json_stats_track_timing) \
+			INSTR_TIME_SET_CURRENT( start ); \
+		else \
+			INSTR_TIME_SET_ZERO( start ); \
+	} while (0)
+
+/* add the time since start to counter, when timing is on */
+#define JSON_STATS_TIMER_ADD( counter, start ) \
+	do { \
+		if (json_stats_track_timing) \
+			(counter) += json_stats_elapsed( &(start) ); \
+	} while (0)
+
+extern void json_stats_init( void );
+extern int64 json_stats_elapsed( instr_time *start );
+extern JsonStatsEntry *json_stats_entry( Oid typid, int attno, const char *name );
+
+#endif /* JSON_STATS_H */
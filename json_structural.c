@@ -0,0 +1,293 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer structural index of JSON input
+*
+* First pass over large JSON input, after simdjson's stage 1: every 64
+* byte block is classified into bitmasks of quotes, backslashes,
+* structural characters and whitespace, 16 bytes at a time with SSE2 or
+* 32 with AVX2 when the CPU supports it. Escapes, string extents and
+* token starts are then found with integer operations on the masks, and
+* the parser jumps from one token start to the next.
+*/
+
+#include <string.h>
+
+#include "json_structural.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define JSON_STRUCTURAL_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct JsonBlockMasks
+{
+	uint64_t	quote;
+	uint64_t	backslash;
+	uint64_t	op;					/* {}[]:, */
+	uint64_t	ws;
+} JsonBlockMasks;
+
+#define JSON_CLASS_QUOTE		1
+#define JSON_CLASS_BACKSLASH	2
+#define JSON_CLASS_OP			4
+#define JSON_CLASS_WS			8
+
+static unsigned char json_class_table[ 256 ];
+static int json_class_table_ready = 0;
+
+static void json_class_table_init( void )
+{
+	json_class_table[ (unsigned char) '"' ] = JSON_CLASS_QUOTE;
+	json_class_table[ (unsigned char) '\\' ] = JSON_CLASS_BACKSLASH;
+	json_class_table[ (unsigned char) '{' ] = JSON_CLASS_OP;
+	json_class_table[ (unsigned char) '}' ] = JSON_CLASS_OP;
+	json_class_table[ (unsigned char) '[' ] = JSON_CLASS_OP;
+	json_class_table[ (unsigned char) ']' ] = JSON_CLASS_OP;
+	json_class_table[ (unsigned char) ':' ] = JSON_CLASS_OP;
+	json_class_table[ (unsigned char) ',' ] = JSON_CLASS_OP;
+	json_class_table[ (unsigned char) ' ' ] = JSON_CLASS_WS;
+	json_class_table[ (unsigned char) '\t' ] = JSON_CLASS_WS;
+	json_class_table[ (unsigned char) '\n' ] = JSON_CLASS_WS;
+	json_class_table[ (unsigned char) '\r' ] = JSON_CLASS_WS;
+	json_class_table_ready = 1;
+}
+
+static inline void json_classify_scalar( const char *block, JsonBlockMasks *m )
+{
+	int			i;
+
+	m->quote = m->backslash = m->op = m->ws = 0;
+
+	for (i = 0; i < JSON_STRUCTURAL_BLOCK; i++)
+	{
+		unsigned char c = json_class_table[ (unsigned char) block[ i ] ];
+		uint64_t	bit = (uint64_t) 1 << i;
+
+		if (c & JSON_CLASS_QUOTE)
+			m->quote |= bit;
+		if (c & JSON_CLASS_BACKSLASH)
+			m->backslash |= bit;
+		if (c & JSON_CLASS_OP)
+			m->op |= bit;
+		if (c & JSON_CLASS_WS)
+			m->ws |= bit;
+	}
+}
+
+/* a + b, returns whether it overflowed */
+static inline int json_add_overflow( uint64_t a, uint64_t b, uint64_t *result )
+{
+	*result = a + b;
+	return *result < a;
+}
+
+/*
+ * Bytes preceded by an odd number of backslashes, see simdjson's
+ * find_escaped: runs starting on even and odd bits are told apart by the
+ * carry of adding their starts to the runs.
+ */
+static inline uint64_t json_find_escaped( uint64_t backslash, uint64_t *prev_escaped )
+{
+	const uint64_t even_bits = 0x5555555555555555ULL;
+	uint64_t	follows_escape;
+	uint64_t	odd_sequence_starts;
+	uint64_t	sequences_starting_on_even_bits;
+
+	backslash &= ~*prev_escaped;
+	follows_escape = backslash << 1 | *prev_escaped;
+	odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+	*prev_escaped = json_add_overflow( odd_sequence_starts, backslash, &sequences_starting_on_even_bits );
+
+	return (even_bits ^ (sequences_starting_on_even_bits << 1)) & follows_escape;
+}
+
+/* every bit becomes the xor of itself and all lower bits */
+static inline uint64_t json_prefix_xor( uint64_t x )
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+static inline size_t json_structural_block( JsonStructuralState *state, const JsonBlockMasks *m,
+											uint32_t base, uint32_t *out )
+{
+	uint64_t	escaped = json_find_escaped( m->backslash, &state->prev_escaped );
+	uint64_t	quote = m->quote & ~escaped;
+	uint64_t	in_string;
+	uint64_t	scalar;
+	uint64_t	structural;
+	size_t		n = 0;
+
+	/* opening quotes are inside, closing quotes outside */
+	in_string = json_prefix_xor( quote ) ^ state->prev_in_string;
+	state->prev_in_string = (uint64_t) ((int64_t) in_string >> 63);
+
+	scalar = ~(m->op | m->ws | m->quote) & ~in_string;
+
+	structural = (m->op & ~in_string) | (quote & in_string) |
+		(scalar & ~(scalar << 1 | state->prev_scalar));
+
+	state->prev_scalar = scalar >> 63;
+
+	while (structural != 0)
+	{
+		out[ n++ ] = base + (uint32_t) __builtin_ctzll( structural );
+		structural &= structural - 1;
+	}
+
+	return n;
+}
+
+/*
+ * Loop over the blocks of buf, the last partial block is padded with
+ * whitespace
+ */
+#define JSON_STRUCTURAL_LOOP( classify ) \
+	do { \
+		size_t		done = 0; \
+		size_t		n = 0; \
+		JsonBlockMasks m; \
+		char		tail[ JSON_STRUCTURAL_BLOCK ]; \
+		\
+		for (; done + JSON_STRUCTURAL_BLOCK <= len; done += JSON_STRUCTURAL_BLOCK) \
+		{ \
+			classify( buf + done, &m ); \
+			n += json_structural_block( state, &m, base + (uint32_t) done, out + n ); \
+		} \
+		\
+		if (done < len) \
+		{ \
+			memset( tail, ' ', JSON_STRUCTURAL_BLOCK ); \
+			memcpy( tail, buf + done, len - done ); \
+			classify( tail, &m ); \
+			n += json_structural_block( state, &m, base + (uint32_t) done, out + n ); \
+		} \
+		\
+		return n; \
+	} while (0)
+
+size_t json_structural_index_scalar( JsonStructuralState *state, const char *buf, size_t len,
+									 uint32_t base, uint32_t *out )
+{
+	if (!json_class_table_ready)
+		json_class_table_init();
+
+	JSON_STRUCTURAL_LOOP( json_classify_scalar );
+}
+
+#ifdef JSON_STRUCTURAL_X86
+
+static inline void json_classify_sse2( const char *block, JsonBlockMasks *m )
+{
+	int			i;
+
+	m->quote = m->backslash = m->op = m->ws = 0;
+
+	for (i = 0; i < JSON_STRUCTURAL_BLOCK; i += 16)
+	{
+		__m128i		v = _mm_loadu_si128( (const __m128i *) (block + i) );
+		__m128i		op;
+		__m128i		ws;
+
+		op = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '{' ) ),
+										 _mm_cmpeq_epi8( v, _mm_set1_epi8( '}' ) ) ),
+						   _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '[' ) ),
+										 _mm_cmpeq_epi8( v, _mm_set1_epi8( ']' ) ) ) );
+		op = _mm_or_si128( op, _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( ':' ) ),
+											 _mm_cmpeq_epi8( v, _mm_set1_epi8( ',' ) ) ) );
+		ws = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( ' ' ) ),
+										 _mm_cmpeq_epi8( v, _mm_set1_epi8( '\t' ) ) ),
+						   _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '\n' ) ),
+										 _mm_cmpeq_epi8( v, _mm_set1_epi8( '\r' ) ) ) );
+
+		m->quote |= (uint64_t) (uint16_t) _mm_movemask_epi8( _mm_cmpeq_epi8( v, _mm_set1_epi8( '"' ) ) ) << i;
+		m->backslash |= (uint64_t) (uint16_t) _mm_movemask_epi8( _mm_cmpeq_epi8( v, _mm_set1_epi8( '\\' ) ) ) << i;
+		m->op |= (uint64_t) (uint16_t) _mm_movemask_epi8( op ) << i;
+		m->ws |= (uint64_t) (uint16_t) _mm_movemask_epi8( ws ) << i;
+	}
+}
+
+__attribute__((target("avx2")))
+static inline void json_classify_avx2( const char *block, JsonBlockMasks *m )
+{
+	int			i;
+
+	m->quote = m->backslash = m->op = m->ws = 0;
+
+	for (i = 0; i < JSON_STRUCTURAL_BLOCK; i += 32)
+	{
+		__m256i		v = _mm256_loadu_si256( (const __m256i *) (block + i) );
+		__m256i		op;
+		__m256i		ws;
+
+		op = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '{' ) ),
+											   _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '}' ) ) ),
+							  _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '[' ) ),
+											   _mm256_cmpeq_epi8( v, _mm256_set1_epi8( ']' ) ) ) );
+		op = _mm256_or_si256( op, _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( ':' ) ),
+												   _mm256_cmpeq_epi8( v, _mm256_set1_epi8( ',' ) ) ) );
+		ws = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( ' ' ) ),
+											   _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\t' ) ) ),
+							  _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\n' ) ),
+											   _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\r' ) ) ) );
+
+		m->quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '"' ) ) ) << i;
+		m->backslash |= (uint64_t) (uint32_t) _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\\' ) ) ) << i;
+		m->op |= (uint64_t) (uint32_t) _mm256_movemask_epi8( op ) << i;
+		m->ws |= (uint64_t) (uint32_t) _mm256_movemask_epi8( ws ) << i;
+	}
+}
+
+static size_t json_structural_index_sse2( JsonStructuralState *state, const char *buf, size_t len,
+										  uint32_t base, uint32_t *out )
+{
+	JSON_STRUCTURAL_LOOP( json_classify_sse2 );
+}
+
+__attribute__((target("avx2")))
+static size_t json_structural_index_avx2( JsonStructuralState *state, const char *buf, size_t len,
+										  uint32_t base, uint32_t *out )
+{
+	JSON_STRUCTURAL_LOOP( json_classify_avx2 );
+}
+
+static size_t json_structural_index_choose( JsonStructuralState *state, const char *buf, size_t len,
+											uint32_t base, uint32_t *out );
+
+static size_t (*json_structural_index_impl)( JsonStructuralState *, const char *, size_t,
+											 uint32_t, uint32_t * ) = json_structural_index_choose;
+
+/* first call picks the implementation for this CPU */
+static size_t json_structural_index_choose( JsonStructuralState *state, const char *buf, size_t len,
+											uint32_t base, uint32_t *out )
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports( "avx2" ))
+		json_structural_index_impl = json_structural_index_avx2;
+	else
+		json_structural_index_impl = json_structural_index_sse2;
+
+	return json_structural_index_impl( state, buf, len, base, out );
+}
+
+size_t json_structural_index( JsonStructuralState *state, const char *buf, size_t len,
+							  uint32_t base, uint32_t *out )
+{
+	return json_structural_index_impl( state, buf, len, base, out );
+}
+
+#else
+
+size_t json_structural_index( JsonStructuralState *state, const char *buf, size_t len,
+							  uint32_t base, uint32_t *out )
+{
+	return json_structural_index_scalar( state, buf, len, base, out );
+}
+
+#endif /* JSON_STRUCTURAL_X86 */
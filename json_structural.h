@@ -0,0 +1,44 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer structural index of JSON input
+*
+* Kept free of backend dependencies so it can be linked into standalone
+* programs as well as into the extension.
+*/
+
+#ifndef JSON_STRUCTURAL_H
+#define JSON_STRUCTURAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* input is classified in blocks of this many bytes, one bit per byte */
+#define JSON_STRUCTURAL_BLOCK	64
+
+/*
+ * Carried from one block to the next, so that input can be indexed in
+ * windows of any multiple of the block size. Start zeroed.
+ */
+typedef struct JsonStructuralState
+{
+	uint64_t	prev_escaped;		/* first byte of the next block is escaped */
+	uint64_t	prev_in_string;		/* all ones inside a string */
+	uint64_t	prev_scalar;		/* last byte was part of a number or literal */
+} JsonStructuralState;
+
+/*
+ * Append to out the offsets (from base) of every token start in
+ * buf[0..len): {}[]:, and opening quotes outside strings, and the first
+ * byte of every other run of non-whitespace outside strings. Whatever
+ * lies between the end of a token and the next offset is whitespace.
+ * len must be a multiple of JSON_STRUCTURAL_BLOCK unless this is the end
+ * of the input; out must have room for len entries. Returns the count.
+ */
+extern size_t json_structural_index( JsonStructuralState *state, const char *buf, size_t len,
+									 uint32_t base, uint32_t *out );
+
+/* portable implementation, for platforms without SSE2 and for testing */
+extern size_t json_structural_index_scalar( JsonStructuralState *state, const char *buf, size_t len,
+											uint32_t base, uint32_t *out );
+
+#endif /* JSON_STRUCTURAL_H */
@@ -10,6 +10,7 @@
 #include "executor/spi.h"
 #include <string.h>
 #include "executor/executor.h"
+#include "libpq/pqformat.h"
 
 #include "catalog/pg_type.h"
 #include "utils/builtins.h"
@@ -18,587 +19,1749 @@
 #include "utils/syscache.h"
 #include "catalog/pg_type.h"
 #include "utils/array.h"
+#include "utils/memutils.h"
+#include "utils/numeric.h"
+#include "utils/bytea.h"
+#include "access/tuptoaster.h"
 #include <stdio.h>
 
 #include "common.h"
+#include "serializer.h"
+#include "json_escape.h"
+#include "json_numfmt.h"
+#include "json_aggbuf.h"
+#include "json_stats.h"
+#include "json_parallel.h"
+#include "json_cache.h"
 
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
-const char *json_hex_chars = "0123456789abcdef";
-
 Datum serialize_record( PG_FUNCTION_ARGS );
 Datum serialize_array( PG_FUNCTION_ARGS );
-char *ConvertToText( Datum, Oid, MemoryContext, char** );
-void appendStringInfoQuotedString( StringInfo, const char * );
+Datum serialize_record_columns( PG_FUNCTION_ARGS );
 
 Datum json_agg_finalfn( PG_FUNCTION_ARGS );
 Datum json_agg_transfn( PG_FUNCTION_ARGS );
 Datum json_agg_plain_finalfn( PG_FUNCTION_ARGS );
 Datum json_agg_plain_transfn( PG_FUNCTION_ARGS );
-static Datum json_agg_common_transfn( PG_FUNCTION_ARGS, bool top_object );
+Datum json_agg_combinefn( PG_FUNCTION_ARGS );
+Datum json_agg_serialfn( PG_FUNCTION_ARGS );
+Datum json_agg_deserialfn( PG_FUNCTION_ARGS );
+static Datum json_agg_common_transfn( PG_FUNCTION_ARGS );
 static Datum json_agg_common_finalfn( PG_FUNCTION_ARGS, bool top_object );
+static Datum json_agg_common_combinefn( PG_FUNCTION_ARGS, bool delimited );
+static void json_nest_close( StringInfo buf, struct JsonNestState *nest, int depth );
+
+Datum json_agg_nested_transfn( PG_FUNCTION_ARGS );
+Datum json_agg_nested_finalfn( PG_FUNCTION_ARGS );
+
+Datum jsonb_agg_transfn( PG_FUNCTION_ARGS );
+Datum jsonb_agg_finalfn( PG_FUNCTION_ARGS );
+Datum jsonb_agg_plain_finalfn( PG_FUNCTION_ARGS );
+Datum jsonb_agg_combinefn( PG_FUNCTION_ARGS );
+static Datum jsonb_agg_common_finalfn( PG_FUNCTION_ARGS, bool top_object );
+
+void _PG_init( void );
+
+void _PG_init( void )
+{
+	json_stats_init();
+	json_parallel_init();
+	json_cache_init();
+}
+
+//----------------------------------------------------------
+
+/*
+ * fn_extra of the serializing functions, see serializer.h
+ */
+JsonFnState *json_fn_state( FmgrInfo *flinfo )
+{
+	JsonFnState *state = (JsonFnState *) flinfo->fn_extra;
+
+	if (state == NULL)
+	{
+		state = (JsonFnState *) MemoryContextAllocZero( flinfo->fn_mcxt, sizeof( JsonFnState ) );
+
+		/* a reset keeps the first block, so rows after the first allocate nothing */
+		state->scratch = AllocSetContextCreate( flinfo->fn_mcxt,
+												"json serializer scratch",
+												ALLOCSET_DEFAULT_MINSIZE,
+												ALLOCSET_DEFAULT_INITSIZE,
+												ALLOCSET_DEFAULT_MAXSIZE );
+
+		flinfo->fn_extra = state;
+	}
+
+	return state;
+}
+
+//----------------------------------------------------------
+
+
+/*
+ * Append str[0..len) escaped, without quotes. Clean runs are copied in
+ * bulk, extra room is reserved only when an escape is actually needed.
+ */
+static void appendStringInfoEscapedBytes( StringInfo buf, const char *str, int len )
+{
+	enlargeStringInfo( buf, len );
+
+	JSON_STATS_COUNT( escaped_bytes, len );
+
+	while (len > 0)
+	{
+		int clean = (int) json_escape_clean_prefix( str, len );
+
+		memcpy( buf->data + buf->len, str, clean );
+		buf->len += clean;
+		str += clean;
+		len -= clean;
+
+		if (len == 0)
+			break;
+
+		/* room for the escape and the rest of the input */
+		enlargeStringInfo( buf, JSON_ESCAPE_MAX_SEQ + len );
+
+		buf->len += json_escape_char( (unsigned char) *str, buf->data + buf->len );
+		JSON_STATS_COUNT( escapes, 1 );
+		str++;
+		len--;
+	}
+
+	buf->data[ buf->len ] = '\0';
+}
+
+/*
+ * Append str[0..len) as a quoted JSON string
+ */
+void appendStringInfoQuotedBytes( StringInfo buf, const char *str, int len )
+{
+	enlargeStringInfo( buf, len + 2 );
+
+	buf->data[ buf->len++ ] = '"'; //enclose input strings with quotes
+
+	appendStringInfoEscapedBytes( buf, str, len );
+
+	appendStringInfoChar( buf, '"' );
+}
+
+void appendStringInfoQuotedString( StringInfo buf, const char *string )
+{
+	appendStringInfoQuotedBytes( buf, string, strlen( string ) );
+}
+
+char *ConvertToText( Datum value, FmgrInfo *proc )
+{
+	instr_time	start;
+	char	   *result;
+
+	JSON_STATS_COUNT( output_calls, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	result = OutputFunctionCall( proc, value );
+
+	JSON_STATS_TIMER_ADD( json_stats.output_time, start );
+
+	return result;
+}
 
 //----------------------------------------------------------
+//
+// writer: every serialization path appends into one StringInfo
+//
+//----------------------------------------------------------
+
+/*
+ * Start a result buffer, the varlena header is reserved up front so the
+ * finished buffer is returned as text without copying.
+ */
+void json_text_init( StringInfo buf )
+{
+	initStringInfo( buf );
+	appendStringInfoSpaces( buf, VARHDRSZ );
+}
+
+text *json_text_finish( StringInfo buf )
+{
+	SET_VARSIZE( buf->data, buf->len );
+
+	return (text *) buf->data;
+}
+
+/*
+ * Large text and bytea values are written piece by piece. Out-of-line
+ * values stored uncompressed are fetched one slice at a time, so only a
+ * slice is held besides the output. Compressed ones have to be
+ * decompressed whole, but are still not copied by an output function.
+ */
+#define JSON_DETOAST_SLICE	(256 * 1024)
+
+typedef void (*JsonSliceWriter) ( StringInfo buf, const char *data, int len );
+
+static void json_write_slices( StringInfo buf, Datum value, JsonSliceWriter writer )
+{
+	struct varlena *attr = (struct varlena *) DatumGetPointer( value );
+	struct varlena *detoasted;
+	const char *data;
+	int32		size;
+	int32		offset;
+
+	if (VARATT_IS_EXTERNAL_ONDISK( attr ))
+	{
+		struct varatt_external toast_pointer;
+
+		VARATT_EXTERNAL_GET_POINTER( toast_pointer, attr );
+
+		if (!VARATT_EXTERNAL_IS_COMPRESSED( toast_pointer ))
+		{
+			size = toast_pointer.va_extsize;
+
+			for (offset = 0; offset < size; offset += JSON_DETOAST_SLICE)
+			{
+				struct varlena *slice = heap_tuple_untoast_attr_slice( attr, offset,
+																	   Min( JSON_DETOAST_SLICE, size - offset ) );
+
+				writer( buf, VARDATA_ANY( slice ), VARSIZE_ANY_EXHDR( slice ) );
+				pfree( slice );
+			}
+
+			return;
+		}
+	}
+
+	/* inline values are used in place, short headers included */
+	detoasted = pg_detoast_datum_packed( attr );
+	data = VARDATA_ANY( detoasted );
+	size = VARSIZE_ANY_EXHDR( detoasted );
+
+	for (offset = 0; offset < size; offset += JSON_DETOAST_SLICE)
+		writer( buf, data + offset, Min( JSON_DETOAST_SLICE, size - offset ) );
+
+	if (detoasted != attr)
+		pfree( detoasted );
+}
+
+/* bytea_output = hex, written without the intermediate string */
+static void json_write_hex( StringInfo buf, const char *data, int len )
+{
+	enlargeStringInfo( buf, len * 2 );
+
+	buf->len += hex_encode( data, len, buf->data + buf->len );
+	buf->data[ buf->len ] = '\0';
+}
+
+/*
+ * Integers, floats and numerics are formatted from the Datum straight into
+ * the buffer. Other numeric category types (oid, money, reg*) go through
+ * their output function and are quoted unless the result is a JSON number.
+ */
+static void json_write_number( StringInfo buf, Datum value, JsonTypeInfo *type )
+{
+	char	   *result;
+	int			len;
+
+	switch( type->typid )
+	{
+		case INT2OID:
+			enlargeStringInfo( buf, JSON_NUMFMT_BUFLEN );
+			len = json_format_int64( buf->data + buf->len, DatumGetInt16( value ) );
+		break;
+
+		case INT4OID:
+			enlargeStringInfo( buf, JSON_NUMFMT_BUFLEN );
+			len = json_format_int64( buf->data + buf->len, DatumGetInt32( value ) );
+		break;
+
+		case INT8OID:
+			enlargeStringInfo( buf, JSON_NUMFMT_BUFLEN );
+			len = json_format_int64( buf->data + buf->len, DatumGetInt64( value ) );
+		break;
+
+		case FLOAT4OID:
+			enlargeStringInfo( buf, JSON_NUMFMT_BUFLEN );
+			len = json_format_float( buf->data + buf->len, DatumGetFloat4( value ) );
+		break;
+
+		case FLOAT8OID:
+			enlargeStringInfo( buf, JSON_NUMFMT_BUFLEN );
+			len = json_format_double( buf->data + buf->len, DatumGetFloat8( value ) );
+		break;
+
+		case NUMERICOID:
+		{
+			Numeric		num = DatumGetNumeric( value );
+			size_t		datalen = VARSIZE( num ) - VARHDRSZ;
+
+			enlargeStringInfo( buf, (int) json_format_numeric_maxlen( VARDATA( num ), datalen ) );
+			len = json_format_numeric( buf->data + buf->len, VARDATA( num ), datalen );
+		}
+		break;
+
+		default:
+			result = ConvertToText( value, &type->outfunc );
+
+			if (json_is_number( result ))
+				appendStringInfoString( buf, result );
+			else
+				appendStringInfoQuotedString( buf, result );
+
+			pfree( result );
+			return;
+	}
+
+	/* NaN and infinities have no JSON number, they are written as strings */
+	if (len < 0)
+		appendStringInfoString( buf, json_special_number( len ) );
+	else
+	{
+		buf->len += len;
+		buf->data[ buf->len ] = '\0';
+	}
+}
+
+void json_write_value( StringInfo buf, Datum value, JsonTypeInfo *type )
+{
+	char	   *result;
+
+	switch( type->category )
+	{
+		// http://www.postgresql.org/docs/current/static/catalog-pg-type.html#CATALOG-TYPCATEGORY-TABLE
+
+		case 'A': //array
+			json_write_array( buf, DatumGetArrayTypeP( value ), &type->child );
+		break;
+
+		case 'C': //composite
+			json_write_record( buf, DatumGetHeapTupleHeader( value ), &type->child );
+		break;
+
+		case 'N': //numeric
+			json_write_number( buf, value, type );
+		break;
+
+		case 'B': //boolean
+			appendStringInfoString( buf, DatumGetBool( value ) ? "true" : "false" );
+		break;
+
+		default: //another
+			if (type->typid == TEXTOID || type->typid == VARCHAROID || type->typid == BPCHAROID)
+			{
+				/* the output functions return the stored bytes as they are */
+				appendStringInfoChar( buf, '"' );
+				json_write_slices( buf, value, appendStringInfoEscapedBytes );
+				appendStringInfoChar( buf, '"' );
+				break;
+			}
+
+			if (type->typid == BYTEAOID && bytea_output == BYTEA_OUTPUT_HEX)
+			{
+				/* "\\x..." : the backslash of the hex format is escaped */
+				appendStringInfoString( buf, "\"\\\\x" );
+				json_write_slices( buf, value, json_write_hex );
+				appendStringInfoChar( buf, '"' );
+				break;
+			}
+
+			// get column text value, escaped while appending
+			result = ConvertToText( value, &type->outfunc );
+
+			appendStringInfoQuotedString( buf, result );
+			pfree( result );
+	}
+}
+
+/*
+ * Run ops over deformed values, writing the members of an object without
+ * its braces. Each op writes its key and value in one go: room for the key
+ * and any fixed-width value is reserved together and numbers are
+ * formatted in place. The comma comes with the key, skip is 1 until the
+ * first member is written. Returns whether anything was written.
+ */
+static bool json_write_ops( StringInfo buf, JsonOp *ops, int nops, Datum *values, bool *nulls )
+{
+	JsonOp	   *op;
+	JsonOp	   *end = ops + nops;
+	int			skip = 1;
+	instr_time	column_timer;
+
+	for (op = ops; op < end; op++)
+	{
+		JsonColumnPlan *column = op->column;
+		Datum		value;
+		int			column_start;
+		int			keylen;
+		int			len = 0;
+
+		/* null columns are left out */
+		if (nulls[ op->attno ])
+			continue;
+
+		value = values[ op->attno ];
+		keylen = op->keylen - skip;
+
+		JSON_STATS_TIMER_START( column_timer );
+
+		enlargeStringInfo( buf, keylen + JSON_NUMFMT_BUFLEN );
+		memcpy( buf->data + buf->len, op->key + skip, keylen );
+		buf->len += keylen;
+		skip = 0;
+
+		column_start = buf->len;
+
+		switch( op->code )
+		{
+			case JSON_OP_INT2:
+				len = json_format_int64( buf->data + buf->len, DatumGetInt16( value ) );
+			break;
+
+			case JSON_OP_INT4:
+				len = json_format_int64( buf->data + buf->len, DatumGetInt32( value ) );
+			break;
+
+			case JSON_OP_INT8:
+				len = json_format_int64( buf->data + buf->len, DatumGetInt64( value ) );
+			break;
+
+			case JSON_OP_FLOAT4:
+				len = json_format_float( buf->data + buf->len, DatumGetFloat4( value ) );
+			break;
+
+			case JSON_OP_FLOAT8:
+				len = json_format_double( buf->data + buf->len, DatumGetFloat8( value ) );
+			break;
+
+			case JSON_OP_NUMERIC:
+			{
+				Numeric		num = DatumGetNumeric( value );
+				size_t		datalen = VARSIZE( num ) - VARHDRSZ;
+
+				enlargeStringInfo( buf, (int) json_format_numeric_maxlen( VARDATA( num ), datalen ) );
+				len = json_format_numeric( buf->data + buf->len, VARDATA( num ), datalen );
+			}
+			break;
+
+			case JSON_OP_BOOL:
+				if (DatumGetBool( value ))
+				{
+					memcpy( buf->data + buf->len, "true", 4 );
+					len = 4;
+				}
+				else
+				{
+					memcpy( buf->data + buf->len, "false", 5 );
+					len = 5;
+				}
+			break;
+
+			case JSON_OP_TEXT:
+				buf->data[ buf->len++ ] = '"';
+				json_write_slices( buf, value, appendStringInfoEscapedBytes );
+				appendStringInfoChar( buf, '"' );
+			break;
+
+			case JSON_OP_RECORD:
+				json_write_record( buf, DatumGetHeapTupleHeader( value ), &column->type.child );
+			break;
+
+			case JSON_OP_ARRAY:
+				json_write_array( buf, DatumGetArrayTypeP( value ), &column->type.child );
+			break;
+
+			default:
+				json_write_value( buf, value, &column->type );
+		}
+
+		/* values formatted in place: NaN and infinities are written as strings */
+		if (len < 0)
+			appendStringInfoString( buf, json_special_number( len ) );
+		else
+		{
+			buf->len += len;
+			buf->data[ buf->len ] = '\0';
+		}
+
+		if (column->stats)
+		{
+			column->stats->counters.values++;
+			column->stats->counters.bytes += buf->len - column_start;
+			JSON_STATS_TIMER_ADD( column->stats->counters.time, column_timer );
+		}
+	}
+
+	return skip == 0;
+}
+
+/*
+ * Write a row through the ops of its plan, all of them when ops is
+ * plan->ops. tupdesc may be the plan's descriptor cut short after the last
+ * column needed, attributes past it are not deformed.
+ */
+static void json_write_columns( StringInfo buf, JsonPlan *plan, TupleDesc tupdesc,
+								JsonOp *ops, int nops, HeapTuple tuple )
+{
+	Datum	   *values;
+	bool	   *nulls;
+	int			row_start = buf->len;
+	instr_time	row_timer;
+
+	JSON_STATS_COUNT( rows, 1 );
+	JSON_STATS_TIMER_START( row_timer );
+
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
 
+	/* Break down the tuple into fields */
+	heap_deform_tuple(tuple, tupdesc, values, nulls);
+
+	appendStringInfoChar(buf, '{');
+
+	/* dropped columns are not part of the plan */
+	json_write_ops( buf, ops, nops, values, nulls );
+
+	appendStringInfoChar(buf, '}');
+
+	plan->stats->counters.values++;
+	plan->stats->counters.bytes += buf->len - row_start;
+	JSON_STATS_TIMER_ADD( plan->stats->counters.time, row_timer );
+
+	pfree(values);
+	pfree(nulls);
+}
+
+void json_write_tuple( StringInfo buf, JsonPlan *plan, HeapTuple tuple )
+{
+	json_write_columns( buf, plan, plan->tupdesc, plan->ops, plan->ncolumns, tuple );
+}
+
+void json_write_record( StringInfo buf, HeapTupleHeader rec, JsonPlanRef *ref )
+{
+	HeapTupleData tuple;
+
+	/* Extract type info from the tuple itself */
+	Oid tupType = HeapTupleHeaderGetTypeId(rec);
+	int32 tupTypmod = HeapTupleHeaderGetTypMod(rec);
+
+	/* column names, categories and output functions are cached per rowtype */
+	JsonPlan *plan = json_plan_get( ref, tupType, tupTypmod, JSON_PLAN_ROW );
+
+	/* Build a temporary HeapTuple control structure */
+	tuple.t_len = HeapTupleHeaderGetDatumLength(rec);
+	ItemPointerSetInvalid(&(tuple.t_self));
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = rec;
+
+	json_write_tuple( buf, plan, &tuple );
+}
+
+/*
+ * A column list resolved against one row plan. It is rebuilt when the
+ * list or the rowtype changes, or when any plan was invalidated since,
+ * because the ops point into the plan.
+ */
+typedef struct JsonProjection
+{
+	MemoryContext cxt;			/* everything below lives here */
+	JsonPlan   *plan;
+	uint32		generation;		/* json_plan_generation when built */
+	ArrayType  *names;			/* copy of the column list argument */
+	TupleDesc	tupdesc;		/* plan->tupdesc cut after the last listed column */
+	int			ncolumns;
+	JsonOp	   *ops;			/* copies of the plan's ops, in the order listed */
+} JsonProjection;
+
+static JsonProjection *json_projection_get( FmgrInfo *flinfo, JsonPlan *plan, ArrayType *names )
+{
+	JsonFnState *fn = json_fn_state( flinfo );
+	JsonProjection *proj = fn->projection;
+	MemoryContext cxt;
+	MemoryContext oldcontext;
+	JsonColumnPlan **columns;
+	Datum	   *elems;
+	bool	   *elem_nulls;
+	bool	   *listed;
+	int			nelems;
+	int			natts = 0;
+	int			hint = 0;
+	int			i;
+
+	if (proj != NULL && proj->plan == plan && proj->generation == json_plan_generation &&
+		VARSIZE( proj->names ) == VARSIZE( names ) &&
+		memcmp( proj->names, names, VARSIZE( names ) ) == 0)
+		return proj;
+
+	/* resolve the names first, nothing is kept when one is wrong */
+	deconstruct_array( names, TEXTOID, -1, false, 'i', &elems, &elem_nulls, &nelems );
+
+	columns = (JsonColumnPlan **) palloc( Max( nelems, 1 ) * sizeof( JsonColumnPlan * ) );
+	listed = (bool *) palloc0( Max( plan->ncolumns, 1 ) * sizeof( bool ) );
+
+	for (i = 0; i < nelems; i++)
+	{
+		JsonColumnPlan *column;
+		text	   *name;
+
+		if (elem_nulls[ i ])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("column names must not be null")));
+
+		name = DatumGetTextPP( elems[ i ] );
+		column = json_plan_find_column( plan, VARDATA_ANY( name ), VARSIZE_ANY_EXHDR( name ), &hint );
+
+		if (column == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" not found in record type %s",
+							text_to_cstring( name ), format_type_be( plan->typid ))));
+
+		if (listed[ column - plan->columns ])
+			ereport(ERROR,
+					(errcode(ERRCODE_DUPLICATE_COLUMN),
+					 errmsg("column \"%s\" listed more than once", column->name)));
+
+		listed[ column - plan->columns ] = true;
+		columns[ i ] = column;
+		natts = Max( natts, column->attno + 1 );
+	}
+
+	if (proj != NULL)
+		MemoryContextDelete( proj->cxt );
+
+	cxt = AllocSetContextCreate( flinfo->fn_mcxt,
+								 "json projection",
+								 ALLOCSET_SMALL_MINSIZE,
+								 ALLOCSET_SMALL_INITSIZE,
+								 ALLOCSET_SMALL_MAXSIZE );
+
+	proj = (JsonProjection *) MemoryContextAlloc( cxt, sizeof( JsonProjection ) );
+	proj->cxt = cxt;
+	proj->plan = plan;
+	proj->generation = json_plan_generation;
+	proj->names = (ArrayType *) MemoryContextAlloc( cxt, VARSIZE( names ) );
+	memcpy( proj->names, names, VARSIZE( names ) );
+	proj->ncolumns = nelems;
+	proj->ops = (JsonOp *) MemoryContextAlloc( cxt, Max( nelems, 1 ) * sizeof( JsonOp ) );
+	for (i = 0; i < nelems; i++)
+		proj->ops[ i ] = plan->ops[ columns[ i ] - plan->columns ];
+
+	/* shares the attributes of the plan's descriptor, only deforming needs it */
+	oldcontext = MemoryContextSwitchTo( cxt );
+	proj->tupdesc = CreateTupleDesc( natts, false, plan->tupdesc->attrs );
+	MemoryContextSwitchTo( oldcontext );
+
+	fn->projection = proj;
+
+	pfree( columns );
+	pfree( listed );
+
+	return proj;
+}
+
+/*
+ * to_json( record, text[] ): only the listed columns, in the order listed.
+ * The tuple is deformed up to the last of them, and columns left out are
+ * neither detoasted nor converted.
+ */
+void json_write_record_columns( StringInfo buf, HeapTupleHeader rec, FmgrInfo *flinfo, ArrayType *names )
+{
+	JsonFnState *fn = json_fn_state( flinfo );
+	JsonPlan   *plan = json_plan_get( &fn->ref, HeapTupleHeaderGetTypeId(rec),
+									  HeapTupleHeaderGetTypMod(rec), JSON_PLAN_ROW );
+	JsonProjection *proj = json_projection_get( flinfo, plan, names );
+	HeapTupleData tuple;
+
+	tuple.t_len = HeapTupleHeaderGetDatumLength(rec);
+	ItemPointerSetInvalid(&(tuple.t_self));
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = rec;
+
+	json_write_columns( buf, plan, proj->tupdesc, proj->ops, proj->ncolumns, &tuple );
+}
+
+/*
+ * Element width of the by-value fixed-width types formatted straight from
+ * the array data, 0 for types going through json_write_value
+ */
+static int json_array_fixed_width( Oid element_type )
+{
+	switch( element_type )
+	{
+		case BOOLOID:
+			return 1;
+		case INT2OID:
+			return 2;
+		case INT4OID:
+		case FLOAT4OID:
+			return 4;
+		case INT8OID:
+		case FLOAT8OID:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+static void json_write_fixed( StringInfo buf, const char *p, Oid element_type )
+{
+	int			len;
+
+	enlargeStringInfo( buf, JSON_NUMFMT_BUFLEN );
+
+	switch( element_type )
+	{
+		case BOOLOID:
+			if (*(const bool *) p)
+			{
+				memcpy( buf->data + buf->len, "true", 4 );
+				len = 4;
+			}
+			else
+			{
+				memcpy( buf->data + buf->len, "false", 5 );
+				len = 5;
+			}
+		break;
+
+		case INT2OID:
+			len = json_format_int64( buf->data + buf->len, *(const int16 *) p );
+		break;
+
+		case INT4OID:
+			len = json_format_int64( buf->data + buf->len, *(const int32 *) p );
+		break;
+
+		case INT8OID:
+			len = json_format_int64( buf->data + buf->len, *(const int64 *) p );
+		break;
+
+		case FLOAT4OID:
+			len = json_format_float( buf->data + buf->len, *(const float4 *) p );
+		break;
+
+		default: //float8
+			len = json_format_double( buf->data + buf->len, *(const float8 *) p );
+	}
+
+	if (len < 0)
+		appendStringInfoString( buf, json_special_number( len ) );
+	else
+	{
+		buf->len += len;
+		buf->data[ buf->len ] = '\0';
+	}
+}
+
+/*
+ * Multidimensional arrays become nested JSON arrays: indx[] walks the
+ * dimensions like an odometer, closing and reopening inner brackets.
+ */
+void json_write_array( StringInfo buf, ArrayType *v, JsonPlanRef *ref )
+{
+	Oid		 element_type = ARR_ELEMTYPE(v);
+	JsonPlan   *plan = NULL;
+	int16		typlen = 0;
+	bool		typbyval = false;
+	char		typalign = 'i';
+	char	   *p;
+	int			fixed;
+
+	bits8	  *bitmap;
+	int		 bitmask;
+	int		 nitems, i;
+	int		 ndim, *dims;
+	int		 indx[ MAXDIM ];
+	int		 d, k;
+
+	ndim = ARR_NDIM(v);
+	dims = ARR_DIMS(v);
+	nitems = ArrayGetNItems(ndim, dims);
+
+	if (nitems == 0)
+	{
+		appendStringInfoString(buf, "[]");
+		return;
+	}
+
+	p = ARR_DATA_PTR(v);
+	bitmap = ARR_NULLBITMAP(v);
+	bitmask = 1;
+
+	/* fixed-width elements without nulls need neither a plan nor fmgr calls */
+	fixed = (bitmap == NULL) ? json_array_fixed_width( element_type ) : 0;
+
+	if (!fixed)
+	{
+		/*
+		 * Get info about element type, including its output conversion proc
+		 */
+		plan = json_plan_get( ref, element_type, -1, JSON_PLAN_ARRAY );
+
+		typlen = plan->element.typlen;
+		typbyval = plan->element.typbyval;
+		typalign = plan->element.typalign;
+	}
+
+	for (d = 0; d < ndim; d++)
+	{
+		indx[ d ] = 0;
+		appendStringInfoChar(buf, '[');
+	}
+
+	for (i = 0; i < nitems; i++)
+	{
+		if (indx[ ndim - 1 ] > 0)
+			appendStringInfoChar(buf, ',');
+
+		if (fixed)
+		{
+			json_write_fixed( buf, p, element_type );
+			p += fixed;
+		}
+		/* Get source element, checking for NULL */
+		else if (bitmap && (*bitmap & bitmask) == 0)
+		{
+			// append null
+			appendStringInfoString(buf, "null");
+		}
+		else
+		{
+			/* get item value and advance array data pointer */
+			Datum itemvalue = fetch_att(p, typbyval, typlen);
+			p = att_addlength_pointer(p, typlen, p);
+			p = (char *) att_align_nominal(p, typalign);
+
+			json_write_value( buf, itemvalue, &plan->element );
+		}
+
+		/* advance bitmap pointer if any */
+		if (bitmap)
+		{
+			bitmask <<= 1;
+			if (bitmask == 0x100)
+			{
+				bitmap++;
+				bitmask = 1;
+			}
+		}
+
+		/* step the index, closing the dimensions that are complete */
+		for (d = ndim - 1; d >= 0; d--)
+		{
+			if (++indx[ d ] < dims[ d ])
+				break;
+
+			appendStringInfoChar(buf, ']');
+			indx[ d ] = 0;
+		}
+
+		/* and reopen them for the next element */
+		if (d >= 0 && d < ndim - 1)
+		{
+			appendStringInfoChar(buf, ',');
+			for (k = d + 1; k < ndim; k++)
+				appendStringInfoChar(buf, '[');
+		}
+	}
+}
+
+//----------------------------------------------------------
+
+PG_FUNCTION_INFO_V1( serialize_record );
+Datum serialize_record( PG_FUNCTION_ARGS )
+{
+	JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+	StringInfoData buf;
+	MemoryContext oldcontext;
+	instr_time	start;
+
+	JSON_STATS_COUNT( record_calls, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	json_text_init( &buf );
+
+	/* the argument is detoasted into scratch as well */
+	oldcontext = MemoryContextSwitchTo( fn->scratch );
+	json_write_record( &buf, PG_GETARG_HEAPTUPLEHEADER(0), &fn->ref );
+	MemoryContextSwitchTo( oldcontext );
+	MemoryContextReset( fn->scratch );
+
+	JSON_STATS_COUNT( output_bytes, buf.len - VARHDRSZ );
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	PG_RETURN_TEXT_P( json_text_finish( &buf ) );
+}
+
+PG_FUNCTION_INFO_V1( serialize_record_columns );
+Datum serialize_record_columns( PG_FUNCTION_ARGS )
+{
+	JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+	StringInfoData buf;
+	MemoryContext oldcontext;
+	instr_time	start;
+
+	JSON_STATS_COUNT( record_calls, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	json_text_init( &buf );
+
+	oldcontext = MemoryContextSwitchTo( fn->scratch );
+	json_write_record_columns( &buf, PG_GETARG_HEAPTUPLEHEADER(0), fcinfo->flinfo, PG_GETARG_ARRAYTYPE_P(1) );
+	MemoryContextSwitchTo( oldcontext );
+	MemoryContextReset( fn->scratch );
+
+	JSON_STATS_COUNT( output_bytes, buf.len - VARHDRSZ );
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	PG_RETURN_TEXT_P( json_text_finish( &buf ) );
+}
+
+PG_FUNCTION_INFO_V1( serialize_array );
+Datum serialize_array(PG_FUNCTION_ARGS)
+{
+	JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+	StringInfoData buf;
+	MemoryContext oldcontext;
+	instr_time	start;
+
+	JSON_STATS_COUNT( array_calls, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	json_text_init( &buf );
+
+	oldcontext = MemoryContextSwitchTo( fn->scratch );
+	json_write_array( &buf, PG_GETARG_ARRAYTYPE_P(0), &fn->ref );
+	MemoryContextSwitchTo( oldcontext );
+	MemoryContextReset( fn->scratch );
+
+	JSON_STATS_COUNT( output_bytes, buf.len - VARHDRSZ );
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	PG_RETURN_TEXT_P( json_text_finish( &buf ) );
+}
+
+//========================================================================================================================
+//=
+//= aggregate staff
+//=
+//========================================================================================================================
+
+/*
+ * The state only holds the serialized records, separated by commas. The
+ * array name and the top-level object are added by the final function,
+ * which lets partial states from parallel workers be concatenated.
+ */
+typedef struct JsonAggState
+{
+	JsonAggBuf	elements;
+	char	   *array_name;		/* NULL when no name was given */
+	int64		nelements;
+	struct JsonNestState *nest;	/* objects left open by json_agg_nested */
+} JsonAggState;
+
+static MemoryContext json_agg_context( FunctionCallInfo fcinfo )
+{
+	MemoryContext aggcontext;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+	{
+		/* cannot be called directly because of internal-type argument */
+		elog(ERROR, "json_agg_* called in non-aggregate context");
+	}
+
+	return aggcontext;
+}
+
+static JsonAggState *makeJsonAggState( MemoryContext aggcontext )
+{
+	JsonAggState *state;
+
+	/*
+	 * Create state in aggregate context.  It'll stay there across subsequent
+	 * calls.
+	 */
+	state = (JsonAggState *) MemoryContextAllocZero( aggcontext, sizeof( JsonAggState ) );
+	json_aggbuf_init( &state->elements, aggcontext );
+
+	return state;
+}
+
+Datum json_agg_common_transfn( PG_FUNCTION_ARGS )
+{
+	JsonAggState *state;
+	instr_time	start;
+
+	JSON_STATS_COUNT( agg_transitions, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	state = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
+
+	/* Append the value unless null. */
+	if (!PG_ARGISNULL(1))
+	{
+		JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+		MemoryContext oldcontext;
+
+		/* On the first time through, we ignore the delimiter. */
+		if (state == NULL)
+		{
+			MemoryContext aggcontext = json_agg_context( fcinfo );
+
+			state = makeJsonAggState( aggcontext );
+
+			if(!PG_ARGISNULL(2)) /* output array json-name */
+				state->array_name = MemoryContextStrdup( aggcontext, text_to_cstring( PG_GETARG_TEXT_PP(2) ) );
+		}
+		else
+			appendStringInfoChar(&state->elements.tail, ',');  /* delimiter */
+
+		/*
+		 * append value, the rowtype plan is kept across transition calls.
+		 * The state buffer lives in the aggregate context and sealed chunks
+		 * are allocated there, scratch holds the rest.
+		 */
+		oldcontext = MemoryContextSwitchTo( fn->scratch );
+
+		/* json_agg( record, text, text[] ) projects the records */
+		if (PG_NARGS() > 3 && !PG_ARGISNULL(3))
+			json_write_record_columns( &state->elements.tail, PG_GETARG_HEAPTUPLEHEADER(1),
+									   fcinfo->flinfo, PG_GETARG_ARRAYTYPE_P(3) );
+		else
+			json_write_record( &state->elements.tail, PG_GETARG_HEAPTUPLEHEADER(1), &fn->ref );
+
+		json_aggbuf_seal( &state->elements );
+		MemoryContextSwitchTo( oldcontext );
+		MemoryContextReset( fn->scratch );
+
+		state->nelements++;
+	}
+
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	/*
+	 * The transition type for json_agg() is declared to be "internal",
+	 * which is a pass-by-value type the same size as a pointer.
+	 */
 
-int printbuf_memappend(char* res, int* pos, const char *buf, int size)
-{
-	memcpy(res + *pos, buf, size);
-	*pos += size;
-	res[*pos]= '\0';
-	return size;
+	PG_RETURN_POINTER(state);
 }
 
-static char* json_escape_str(char** presult, char *str)
+Datum json_agg_common_finalfn( PG_FUNCTION_ARGS, bool top_object )
 {
-	int result_pos = 0;
-	int pos = 0, start_offset = 0;
-	unsigned char c;
+	JsonAggState *state;
+	StringInfoData head;
+	StringInfoData foot;
+	int64		size;
+	text	   *result;
+	char	   *p;
+	instr_time	start;
 
-	(*presult) = palloc(strlen(str) * 6);
-	(*presult)[0] = 0;
-	do {
-		c = str[pos];
-		switch(c) {
-		case '\0':
-			break;
-		case '\b':
-		case '\n':
-		case '\r':
-		case '\t':
-		case '"':
-		case '\\':
-//		case '/':
-			if(pos - start_offset > 0)
-			{
-				printbuf_memappend(*presult, &result_pos, str + start_offset, pos - start_offset);
-			}
-			if(c == '\b')
-			{
-				printbuf_memappend(*presult, &result_pos, "\\b", 2);
-			}
-			else if(c == '\n')
-			{
-				printbuf_memappend(*presult, &result_pos, "\\n", 2);
-			}
-			else if(c == '\r')
-			{
-				printbuf_memappend(*presult, &result_pos, "\\r", 2);
-			}
-			else if(c == '\t') printbuf_memappend(*presult, &result_pos, "\\t", 2);
-			else if(c == '"') printbuf_memappend(*presult, &result_pos, "\\\"", 2);
-			else if(c == '\\') printbuf_memappend(*presult, &result_pos, "\\\\", 2);
-//			else if(c == '/') printbuf_memappend(*presult, &result_pos, "\\/", 2);
-			start_offset = ++pos;
-			break;
-		default:
-			if(c < ' ') {
-				if(pos - start_offset > 0)
-					printbuf_memappend(*presult, &result_pos, str + start_offset, pos - start_offset);
-				sprintf((*presult)+result_pos, "\\u00%c%c",
-					json_hex_chars[c >> 4],
-					json_hex_chars[c & 0xf]);
-				result_pos += 6;
-				(*presult)[result_pos] = '\0';
-				start_offset = ++pos;
-			} else pos++;
-		}
-	} while(c);
-	if(pos - start_offset > 0)
-		printbuf_memappend(*presult, &result_pos, str + start_offset, pos - start_offset);
-	return *presult;
-}
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
 
+	JSON_STATS_COUNT( agg_finals, 1 );
+	JSON_STATS_TIMER_START( start );
 
-void appendStringInfoQuotedString( StringInfo buf, const char *string )
-{
-	appendStringInfoChar( buf, '"'); //enclose input strings with quotes
+	state = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
 
-	for( ; *string; ++ string )
+	if (state != NULL)
 	{
-//		switch( *string )
-//		{
-//			case '"': case '\\':
-//				appendStringInfoChar( buf, '\\');
-//			break;
-//		}
-
-		appendStringInfoChar( buf, *string);
-	}
+		initStringInfo(&head);
 
-	appendStringInfoChar( buf, '"');
-}
+		if( top_object )
+			appendStringInfoChar(&head, '{');  /* begin top-level json object */
 
-char *ConvertToText( Datum value, Oid column_type, MemoryContext fn_mcxt, char** pbuf )
-{
-	bool typIsVarlena;
-	Oid typiofunc;
-	FmgrInfo	proc;
-	char*		result;
-//	FILE* log;
+		if( state->array_name ) /* output array json-name */
+		{
+			appendStringInfoQuotedString(&head, state->array_name);
+			appendStringInfoChar(&head, ':');  /* array name delimiter */
+		}
+
+		appendStringInfoChar(&head, '[');  /* array begin */
+
+		/* objects json_agg_nested still has open are closed in the copy */
+		initStringInfo(&foot);
+		if( state->nest )
+			json_nest_close( &foot, state->nest, 0 );
+
+		/* assemble the result with one allocation of the exact size */
+		size = VARHDRSZ + head.len + json_aggbuf_size( &state->elements ) + foot.len + 2;
+		if (size > MaxAllocSize)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("json_agg result exceeds the maximum text size")));
+
+		result = (text *) palloc( size );
+		p = VARDATA( result );
+
+		memcpy( p, head.data, head.len );
+		p += head.len;
 
-//	log = fopen("/var/lib/postgresql/serializer.log", "a");
+		/* the state is left untouched, window aggregates call us repeatedly */
+		json_aggbuf_copy( &state->elements, p );
+		p += json_aggbuf_size( &state->elements );
 
-	getTypeOutputInfo(column_type, &typiofunc, &typIsVarlena);
-	fmgr_info_cxt( typiofunc, &proc, fn_mcxt );
+		memcpy( p, foot.data, foot.len );
+		p += foot.len;
 
-//	fprintf(log, "Oid of function: %i\n", proc.fn_oid);
+		*p++ = ']';  /* array end */
 
-	result =  OutputFunctionCall( &proc, value );
+		if( top_object )
+			*p++ = '}'; /* end top-level json object */
+
+		SET_VARSIZE( result, p - (char *) result );
+		pfree( head.data );
+		pfree( foot.data );
 
-	if((column_type != INT8OID) && (column_type != BOOLOID) &&
-           (column_type != INT4OID) && (column_type != FLOAT8OID) &&
-           (column_type != INT2OID) && (column_type != FLOAT4OID)) {
-//		fprintf(log, "WELL WELL\n");
-		result = json_escape_str(pbuf, result);
-//		fprintf(log, "result: %s\n", result);
-//		fclose(log);
-		return result;
+		JSON_STATS_COUNT( output_bytes, VARSIZE( result ) - VARHDRSZ );
+		JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+		PG_RETURN_TEXT_P( result );
+	}
+	else
+	{
+		if( top_object )
+			PG_RETURN_TEXT_P( cstring_to_text( "{}" ) );
+		else
+			PG_RETURN_NULL();
 	}
-//	fclose(log);
-	return result;
 }
 
-PG_FUNCTION_INFO_V1( serialize_record );
-Datum serialize_record( PG_FUNCTION_ARGS )
+/*
+ * Parallel aggregation: partial arrays built by workers are concatenated,
+ * with a comma in between for text states
+ */
+Datum json_agg_common_combinefn( PG_FUNCTION_ARGS, bool delimited )
 {
-//	FILE* log;
+	MemoryContext aggcontext = json_agg_context( fcinfo );
+	JsonAggState *state1;
+	JsonAggState *state2;
 
-//	log = fopen("/var/lib/postgresql/serializer.log", "a");
-	HeapTupleHeader rec = PG_GETARG_HEAPTUPLEHEADER(0);
+	state1 = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (JsonAggState *) PG_GETARG_POINTER(1);
 
-	HeapTupleData tuple;
-	bool		needComma = false;
-	int		 i;
-	Datum	  *values;
-	bool	   *nulls;
-	StringInfoData buf;
-	char *conversion_buf;
+	if (state2 == NULL)
+		PG_RETURN_POINTER(state1);
 
-	/* Extract type info from the tuple itself */
-	Oid tupType = HeapTupleHeaderGetTypeId(rec);
-	int32 tupTypmod = HeapTupleHeaderGetTypMod(rec);
-	TupleDesc tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
-	int ncolumns = tupdesc->natts;
+	if (state1 == NULL)
+	{
+		/* copy, state2 does not live in our aggregate context */
+		state1 = makeJsonAggState( aggcontext );
 
-	/* Build a temporary HeapTuple control structure */
-	tuple.t_len = HeapTupleHeaderGetDatumLength(rec);
-	ItemPointerSetInvalid(&(tuple.t_self));
-	tuple.t_tableOid = InvalidOid;
-	tuple.t_data = rec;
+		if (state2->array_name)
+			state1->array_name = MemoryContextStrdup( aggcontext, state2->array_name );
+	}
+	else
+	{
+		if (state1->array_name == NULL && state2->array_name != NULL)
+			state1->array_name = MemoryContextStrdup( aggcontext, state2->array_name );
 
-//	fprintf(log, "Doing serialize_record\n");
-//	fflush(log);
+		if (delimited && state1->nelements > 0 && state2->nelements > 0)
+			json_aggbuf_append( &state1->elements, ",", 1 );  /* delimiter */
+	}
 
-	values = (Datum *) palloc(ncolumns * sizeof(Datum));
-	nulls = (bool *) palloc(ncolumns * sizeof(bool));
+	json_aggbuf_append_buf( &state1->elements, &state2->elements );
+	state1->nelements += state2->nelements;
 
-	/* Break down the tuple into fields */
-	heap_deform_tuple(&tuple, tupdesc, values, nulls);
+	PG_RETURN_POINTER(state1);
+}
+
+PG_FUNCTION_INFO_V1( json_agg_combinefn );
+Datum json_agg_combinefn( PG_FUNCTION_ARGS )
+{
+	return json_agg_common_combinefn( fcinfo, true );
+}
 
-	/* And build the result string */
-	initStringInfo(&buf);
+PG_FUNCTION_INFO_V1( json_agg_serialfn );
+Datum json_agg_serialfn( PG_FUNCTION_ARGS )
+{
+	JsonAggState *state;
+	StringInfoData buf;
+	int64		size;
 
-	appendStringInfoChar(&buf, '{');
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
 
-	for (i = 0; i < ncolumns; i++)
-	{
-		Oid		 column_type = tupdesc->attrs[ i ]->atttypid;
-		char	   *value;
-		char	   *column_name;
-		char 		type_category;
-		HeapTuple 	type_tuple;
-		FmgrInfo flinfo;
-
-		/* Ignore dropped columns in datatype */
-		if (tupdesc->attrs[i]->attisdropped)
-			continue;
+	state = (JsonAggState *) PG_GETARG_POINTER(0);
 
-		if (nulls[i])
-		{
-			/* emit nothing... */
-			continue;
-		}
+	pq_begintypsend(&buf);
+
+	/* the name is sent as raw bytes, no client encoding conversion here */
+	pq_sendbyte(&buf, state->array_name != NULL);
+	if (state->array_name)
+	{
+		int			namelen = strlen(state->array_name);
 
-		if (needComma)
-			appendStringInfoChar(&buf, ',');
+		pq_sendint(&buf, namelen, 4);
+		pq_sendbytes(&buf, state->array_name, namelen);
+	}
 
-		needComma = true;
+	pq_sendint64(&buf, state->nelements);
 
+	size = json_aggbuf_size( &state->elements );
+	if (buf.len + size > MaxAllocSize)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("json_agg partial result exceeds the maximum bytea size")));
 
-		/* obtain column name */
-		column_name = SPI_fname( tupdesc, i + 1 );
+	enlargeStringInfo(&buf, (int) size);
+	json_aggbuf_copy( &state->elements, buf.data + buf.len );
+	buf.len += (int) size;
 
-		/* obtain type information from pg_catalog */
-		type_tuple = SearchSysCache1( TYPEOID, ObjectIdGetDatum(column_type) );
-		if (!HeapTupleIsValid( type_tuple ))
-			elog(ERROR, "cache lookup failed for relation %u", column_type);
+	PG_RETURN_BYTEA_P( pq_endtypsend(&buf) );
+}
 
-		type_category = ((Form_pg_type) GETSTRUCT( type_tuple ))->typcategory;
+PG_FUNCTION_INFO_V1( json_agg_deserialfn );
+Datum json_agg_deserialfn( PG_FUNCTION_ARGS )
+{
+	MemoryContext aggcontext = json_agg_context( fcinfo );
+	bytea	   *sstate = PG_GETARG_BYTEA_P(0);
+	JsonAggState *state;
+	StringInfoData buf;
+	int			len;
 
-		ReleaseSysCache( type_tuple );
+	/* read straight from the bytea, no need for a copy */
+	buf.data = VARDATA(sstate);
+	buf.len = VARSIZE(sstate) - VARHDRSZ;
+	buf.maxlen = buf.len;
+	buf.cursor = 0;
 
-		/* append column name */
-		appendStringInfoChar(&buf, '"');
-		appendStringInfoString(&buf, column_name);
-		appendStringInfoString(&buf, "\":");
+	state = makeJsonAggState( aggcontext );
 
-		switch( type_category )
-		{
-			// http://www.postgresql.org/docs/current/static/catalog-pg-type.html#CATALOG-TYPCATEGORY-TABLE
+	if (pq_getmsgbyte(&buf))
+	{
+		int			namelen = pq_getmsgint(&buf, 4);
+		const char *name = pq_getmsgbytes(&buf, namelen);
 
-			case 'A': //array
-				//call to serialize_array( ... )
+		state->array_name = (char *) MemoryContextAlloc( aggcontext, namelen + 1 );
+		memcpy( state->array_name, name, namelen );
+		state->array_name[ namelen ] = '\0';
+	}
 
-				MemSet( &flinfo, 0, sizeof( flinfo ) );
-				flinfo.fn_addr = serialize_array;
-				flinfo.fn_nargs = 1;
-				flinfo.fn_mcxt = fcinfo->flinfo->fn_mcxt;
+	state->nelements = pq_getmsgint64(&buf);
 
-				value = PG_TEXT_DATUM_GET_CSTR( FunctionCall1( &flinfo, values[ i ] ) );
+	len = buf.len - buf.cursor;
+	json_aggbuf_append( &state->elements, pq_getmsgbytes(&buf, len), len );
 
-				appendStringInfoString(&buf, value);
-			break;
+	pq_getmsgend(&buf);
 
-			case 'C': //composite
-				//recursive call to serialize_record( ... )
-				MemSet( &flinfo, 0, sizeof( flinfo ) );
-				flinfo.fn_addr = serialize_record;
-				flinfo.fn_nargs = 1;
-				flinfo.fn_mcxt = fcinfo->flinfo->fn_mcxt;
+	PG_RETURN_POINTER(state);
+}
 
-				value = PG_TEXT_DATUM_GET_CSTR( FunctionCall1( &flinfo, values[ i ] ) );
+PG_FUNCTION_INFO_V1( json_agg_finalfn );
+Datum json_agg_finalfn( PG_FUNCTION_ARGS )
+{
+	return json_agg_common_finalfn( fcinfo, true );
+}
 
-				appendStringInfoString(&buf, value);
-			break;
+PG_FUNCTION_INFO_V1( json_agg_plain_finalfn );
+Datum json_agg_plain_finalfn( PG_FUNCTION_ARGS )
+{
+	return json_agg_common_finalfn( fcinfo, false );
+}
 
-			case 'N': //numeric
+PG_FUNCTION_INFO_V1( json_agg_transfn );
+Datum json_agg_transfn( PG_FUNCTION_ARGS )
+{
+	return json_agg_common_transfn( fcinfo );
+}
 
-				conversion_buf = NULL;
-				// get column text value
-//				fprintf(log, "Calling ConvertToText\n");
-//				fflush(log);
-				value = ConvertToText( values[ i ], column_type, fcinfo->flinfo->fn_mcxt, &conversion_buf );
-//				fprintf(log, "ConvertToText succeded\n");
-//				fflush(log);
+PG_FUNCTION_INFO_V1( json_agg_plain_transfn );
+Datum json_agg_plain_transfn( PG_FUNCTION_ARGS )
+{
+	return json_agg_common_transfn( fcinfo );
+}
 
-				appendStringInfoString(&buf, value);
-//				fprintf(log, "append.... succeded\n");
-//				fflush(log);
+//----------------------------------------------------------
+//
+// json_agg_nested( record, key_columns text[], path text[] ) builds a
+// hierarchy out of a flat join sorted by the keys, in one pass. Level k
+// owns its key column and the columns after it, up to the key of the
+// next level (the first level also owns the columns before its key), and
+// holds the next level in an array named path[k]. An object stays open
+// while its key repeats; when a key changes the deeper objects are
+// closed and new ones opened. A null key means no element at that level,
+// as with the outer side of a left join.
+//
+//----------------------------------------------------------
 
-				if(conversion_buf != NULL) {
-					pfree(conversion_buf);
-					conversion_buf = NULL;
-				}
+typedef struct JsonNestLevel
+{
+	JsonOp		key;			/* key column, compared by its JSON text */
+	JsonOp	   *ops;			/* columns of the level, in the plan */
+	int			nops;
+	char	   *child;			/* ,"name":[ opening the next level, NULL for the last */
+	int			childlen;
+} JsonNestLevel;
 
-			break;
+/*
+ * The levels resolved against one row plan, rebuilt like JsonProjection
+ */
+typedef struct JsonNestLayout
+{
+	MemoryContext cxt;			/* everything below lives here */
+	JsonPlan   *plan;
+	uint32		generation;		/* json_plan_generation when built */
+	ArrayType  *keys;			/* copies of the arguments */
+	ArrayType  *path;
+	int			nlevels;
+	JsonNestLevel *levels;
+} JsonNestLayout;
+
+/* the open objects, kept in the aggregate context */
+typedef struct JsonNestState
+{
+	int			nlevels;
+	int			depth;			/* levels with an open object */
+	StringInfoData *keys;		/* key text of the open object of each level */
+	int64	   *counts;			/* elements in the open array of each level */
+} JsonNestState;
+
+static JsonNestLayout *json_nest_layout_get( FmgrInfo *flinfo, JsonPlan *plan,
+											 ArrayType *keys, ArrayType *path )
+{
+	JsonFnState *fn = json_fn_state( flinfo );
+	JsonNestLayout *layout = fn->nest;
+	MemoryContext cxt;
+	MemoryContext oldcontext;
+	JsonColumnPlan **key_columns;
+	Datum	   *key_elems;
+	Datum	   *path_elems;
+	bool	   *key_nulls;
+	bool	   *path_nulls;
+	int			nkeys;
+	int			npath;
+	int			hint = 0;
+	int			i;
+
+	if (layout != NULL && layout->plan == plan && layout->generation == json_plan_generation &&
+		VARSIZE( layout->keys ) == VARSIZE( keys ) &&
+		memcmp( layout->keys, keys, VARSIZE( keys ) ) == 0 &&
+		VARSIZE( layout->path ) == VARSIZE( path ) &&
+		memcmp( layout->path, path, VARSIZE( path ) ) == 0)
+		return layout;
+
+	deconstruct_array( keys, TEXTOID, -1, false, 'i', &key_elems, &key_nulls, &nkeys );
+	deconstruct_array( path, TEXTOID, -1, false, 'i', &path_elems, &path_nulls, &npath );
+
+	if (nkeys == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("at least one key column is required")));
+
+	if (npath != nkeys - 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("path must name one array for each key column after the first")));
+
+	key_columns = (JsonColumnPlan **) palloc( nkeys * sizeof( JsonColumnPlan * ) );
+
+	for (i = 0; i < nkeys; i++)
+	{
+		text	   *name;
+
+		if (key_nulls[ i ] || (i < npath && path_nulls[ i ]))
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("key column and path names must not be null")));
+
+		name = DatumGetTextPP( key_elems[ i ] );
+		key_columns[ i ] = json_plan_find_column( plan, VARDATA_ANY( name ), VARSIZE_ANY_EXHDR( name ), &hint );
+
+		if (key_columns[ i ] == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" not found in record type %s",
+							text_to_cstring( name ), format_type_be( plan->typid ))));
+
+		if (i > 0 && key_columns[ i ] <= key_columns[ i - 1 ])
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("key columns must be listed in column order"),
+					 errhint("Each level consists of its key column and the columns following it.")));
+	}
 
-			case 'B': //boolean
-				appendStringInfoString(&buf,
-					// get column boolean value
-					DatumGetBool( values[ i ] ) ? "true" : "false"
-				);
-			break;
+	if (layout != NULL)
+		MemoryContextDelete( layout->cxt );
+
+	cxt = AllocSetContextCreate( flinfo->fn_mcxt,
+								 "json nested layout",
+								 ALLOCSET_SMALL_MINSIZE,
+								 ALLOCSET_SMALL_INITSIZE,
+								 ALLOCSET_SMALL_MAXSIZE );
+
+	oldcontext = MemoryContextSwitchTo( cxt );
+
+	layout = (JsonNestLayout *) palloc( sizeof( JsonNestLayout ) );
+	layout->cxt = cxt;
+	layout->plan = plan;
+	layout->generation = json_plan_generation;
+	layout->keys = (ArrayType *) palloc( VARSIZE( keys ) );
+	memcpy( layout->keys, keys, VARSIZE( keys ) );
+	layout->path = (ArrayType *) palloc( VARSIZE( path ) );
+	memcpy( layout->path, path, VARSIZE( path ) );
+	layout->nlevels = nkeys;
+	layout->levels = (JsonNestLevel *) palloc( nkeys * sizeof( JsonNestLevel ) );
+
+	for (i = 0; i < nkeys; i++)
+	{
+		JsonNestLevel *level = &layout->levels[ i ];
+		int			first = i == 0 ? 0 : key_columns[ i ] - plan->columns;
+		int			last = i + 1 < nkeys ? key_columns[ i + 1 ] - plan->columns : plan->ncolumns;
 
-			default: //another
+		level->key = plan->ops[ key_columns[ i ] - plan->columns ];
+		level->ops = plan->ops + first;
+		level->nops = last - first;
+		level->child = NULL;
+		level->childlen = 0;
 
-				conversion_buf = NULL;
-				// get column text value
-//				fprintf(log, "Calling ConvertToText\n");
-//				fflush(log);
-				value = ConvertToText( values[ i ], column_type, fcinfo->flinfo->fn_mcxt, &conversion_buf );
-//				fprintf(log, "ConvertToText succeded\n");
-//				fflush(log);
+		if (i < npath)
+		{
+			text	   *name = DatumGetTextPP( path_elems[ i ] );
+			StringInfoData child;
 
-				appendStringInfoQuotedString(&buf, value);
-//				fprintf(log, "append.... succeded\n");
-//				fflush(log);
+			initStringInfo( &child );
+			appendStringInfoChar( &child, ',' );
+			appendStringInfoQuotedBytes( &child, VARDATA_ANY( name ), VARSIZE_ANY_EXHDR( name ) );
+			appendStringInfoString( &child, ":[" );
 
-				if(conversion_buf != NULL) {
-					pfree(conversion_buf);
-					conversion_buf = NULL;
-				}
+			level->child = child.data;
+			level->childlen = child.len;
 		}
 	}
 
-	appendStringInfoChar(&buf, '}');
+	MemoryContextSwitchTo( oldcontext );
 
-	pfree(values);
-	pfree(nulls);
-	ReleaseTupleDesc(tupdesc);
+	fn->nest = layout;
 
-//	fclose(log);
+	pfree( key_columns );
 
-	PG_RETURN_TEXT_P( PG_CSTR_GET_TEXT( buf.data ) );
+	return layout;
 }
 
-PG_FUNCTION_INFO_V1( serialize_array );
-Datum serialize_array(PG_FUNCTION_ARGS)
+/* close the open objects of the levels from depth on, innermost first */
+static void json_nest_close( StringInfo buf, JsonNestState *nest, int depth )
 {
-	ArrayType  *v = PG_GETARG_ARRAYTYPE_P(0);
-	Oid		 element_type = ARR_ELEMTYPE(v);
-	int16		typlen;
-	bool		typbyval;
-	char		typalign;
-	char		typdelim;
-	char	   *p, *value;
-	char 		type_category;
-	bool		needComma = false;
+	int			k;
 
-	bits8	  *bitmap;
-	int		 bitmask;
-	int		 nitems, i;
-	int		 ndim, *dims;
+	for (k = nest->depth - 1; k >= depth; k--)
+	{
+		if (k < nest->nlevels - 1)
+			appendStringInfoString( buf, "]}" );  /* child array and object */
+		else
+			appendStringInfoChar( buf, '}' );
+	}
+}
 
-	Oid			typioparam, typiofunc;
-	HeapTuple 	type_tuple;
-	FmgrInfo	proc, flinfo;
+PG_FUNCTION_INFO_V1( json_agg_nested_transfn );
+Datum json_agg_nested_transfn( PG_FUNCTION_ARGS )
+{
+	JsonAggState *state;
+	JsonNestState *nest;
+	instr_time	start;
 
-	StringInfoData buf;
+	JSON_STATS_COUNT( agg_transitions, 1 );
+	JSON_STATS_TIMER_START( start );
 
-//	FILE* log;
+	state = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
 
-//	log = fopen("/var/lib/postgresql/serializer.log", "a");
+	if (!PG_ARGISNULL(1))
+	{
+		JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+		HeapTupleHeader rec = PG_GETARG_HEAPTUPLEHEADER(1);
+		HeapTupleData tuple;
+		JsonNestLayout *layout;
+		JsonPlan   *plan;
+		StringInfo	out;
+		StringInfoData key;
+		MemoryContext oldcontext;
+		Datum	   *values;
+		bool	   *nulls;
+		int			level;
+		int			k;
+
+		if (PG_ARGISNULL(2) || PG_ARGISNULL(3))
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("key columns and path must not be null")));
+
+		/* everything but the output and the open keys is per row */
+		oldcontext = MemoryContextSwitchTo( fn->scratch );
+
+		plan = json_plan_get( &fn->ref, HeapTupleHeaderGetTypeId(rec),
+							  HeapTupleHeaderGetTypMod(rec), JSON_PLAN_ROW );
+		layout = json_nest_layout_get( fcinfo->flinfo, plan, PG_GETARG_ARRAYTYPE_P(2),
+									   PG_GETARG_ARRAYTYPE_P(3) );
 
-//	fprintf(log, "Doing serialize_array\n");
-//	fflush(log);
+		if (state == NULL)
+		{
+			MemoryContext aggcontext = json_agg_context( fcinfo );
 
-	/*
-	 * Get info about element type, including its output conversion proc
-	 */
-	get_type_io_data(element_type, IOFunc_output,
-					 &typlen, &typbyval,
-					 &typalign, &typdelim,
-					 &typioparam, &typiofunc);
+			state = makeJsonAggState( aggcontext );
 
-	fmgr_info_cxt( typiofunc, &proc, fcinfo->flinfo->fn_mcxt );
+			MemoryContextSwitchTo( aggcontext );
 
-	ndim = ARR_NDIM(v);
-	dims = ARR_DIMS(v);
-	nitems = ArrayGetNItems(ndim, dims);
+			nest = (JsonNestState *) palloc( sizeof( JsonNestState ) );
+			nest->nlevels = layout->nlevels;
+			nest->depth = 0;
+			nest->keys = (StringInfoData *) palloc( layout->nlevels * sizeof( StringInfoData ) );
+			nest->counts = (int64 *) palloc0( layout->nlevels * sizeof( int64 ) );
 
-	if( ndim > 1 )
-		elog( ERROR, "multidimensional arrays doesn't supported" );
+			for (k = 0; k < layout->nlevels; k++)
+				initStringInfo( &nest->keys[ k ] );
 
-	p = ARR_DATA_PTR(v);
-	bitmap = ARR_NULLBITMAP(v);
-	bitmask = 1;
+			state->nest = nest;
 
-	/* obtain type information from pg_catalog */
-	type_tuple = SearchSysCache1( TYPEOID, ObjectIdGetDatum(element_type) );
-	if (!HeapTupleIsValid( type_tuple ))
-		elog(ERROR, "cache lookup failed for relation %u", element_type);
+			MemoryContextSwitchTo( fn->scratch );
+		}
 
-	type_category = ((Form_pg_type) GETSTRUCT( type_tuple ))->typcategory;
+		nest = state->nest;
+		if (nest->nlevels != layout->nlevels)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("number of key columns changed within an aggregate")));
 
-	ReleaseSysCache( type_tuple );
+		tuple.t_len = HeapTupleHeaderGetDatumLength(rec);
+		ItemPointerSetInvalid(&(tuple.t_self));
+		tuple.t_tableOid = InvalidOid;
+		tuple.t_data = rec;
 
-	/* Build the result string */
-	initStringInfo(&buf);
+		values = (Datum *) palloc( plan->tupdesc->natts * sizeof( Datum ) );
+		nulls = (bool *) palloc( plan->tupdesc->natts * sizeof( bool ) );
 
-	appendStringInfoChar(&buf, '[');
-	for (i = 0; i < nitems; i++)
-	{
-		if (needComma)
-			appendStringInfoChar(&buf, ',');
-		needComma = true;
+		heap_deform_tuple( &tuple, plan->tupdesc, values, nulls );
 
-		/* Get source element, checking for NULL */
-		if (bitmap && (*bitmap & bitmask) == 0)
-		{
-			// append null
-			appendStringInfoString(&buf, "null");
-		}
-		else
+		JSON_STATS_COUNT( rows, 1 );
+
+		/* rows without a top-level key belong to no element */
+		if (!nulls[ layout->levels[ 0 ].key.attno ])
 		{
-			/* get item value and advance array data pointer */
-			Datum itemvalue = fetch_att(p, typbyval, typlen);
-			p = att_addlength_pointer(p, typlen, p);
-			p = (char *) att_align_nominal(p, typalign);
+			/* the first level whose key differs from the open object */
+			initStringInfo( &key );
 
-			//------------------------
-			switch( type_category )
+			for (level = 0; level < nest->depth; level++)
 			{
-				// http://www.postgresql.org/docs/current/static/catalog-pg-type.html#CATALOG-TYPCATEGORY-TABLE
+				JsonOp	   *op = &layout->levels[ level ].key;
 
-				case 'A': //array - impossible case
-				break;
+				if (nulls[ op->attno ])
+					break;
 
-				case 'C': //composite
-					//call to serialize_record( ... )
-					MemSet( &flinfo, 0, sizeof( flinfo ) );
-					flinfo.fn_addr = serialize_record;
-					flinfo.fn_nargs = 1;
-					flinfo.fn_mcxt = fcinfo->flinfo->fn_mcxt;
+				resetStringInfo( &key );
+				json_write_value( &key, values[ op->attno ], &op->column->type );
 
-					value = PG_TEXT_DATUM_GET_CSTR( FunctionCall1( &flinfo, itemvalue ) );
+				if (key.len != nest->keys[ level ].len ||
+					memcmp( key.data, nest->keys[ level ].data, key.len ) != 0)
+					break;
+			}
 
-					appendStringInfoString(&buf, value);
-				break;
+			out = &state->elements.tail;
 
-				case 'N': //numeric
+			json_nest_close( out, nest, level );
+			nest->depth = level;
 
-					// get column text value
-					value = OutputFunctionCall( &proc, itemvalue );
+			/* open the objects of this row down to the first null key */
+			for (; level < layout->nlevels; level++)
+			{
+				JsonNestLevel *l = &layout->levels[ level ];
 
-					appendStringInfoString(&buf, value);
-				break;
+				if (nulls[ l->key.attno ])
+					break;
 
-				default: //another
+				if (nest->counts[ level ]++ > 0)
+					appendStringInfoChar( out, ',' );  /* delimiter */
 
-					// get column text value
-					value = OutputFunctionCall( &proc, itemvalue );
+				appendStringInfoChar( out, '{' );
+				json_write_ops( out, l->ops, l->nops, values, nulls );
 
-					appendStringInfoQuotedString(&buf, value);
-			}
-		}
+				if (l->child)
+				{
+					appendBinaryStringInfo( out, l->child, l->childlen );
+					nest->counts[ level + 1 ] = 0;
+				}
 
-		/* advance bitmap pointer if any */
-		if (bitmap)
-		{
-			bitmask <<= 1;
-			if (bitmask == 0x100)
-			{
-				bitmap++;
-				bitmask = 1;
+				/* the key buffer stays in the aggregate context when grown */
+				resetStringInfo( &nest->keys[ level ] );
+				json_write_value( &nest->keys[ level ], values[ l->key.attno ], &l->key.column->type );
+
+				nest->depth = level + 1;
 			}
 		}
+
+		state->nelements = nest->counts[ 0 ];
+
+		json_aggbuf_seal( &state->elements );
+		MemoryContextSwitchTo( oldcontext );
+		MemoryContextReset( fn->scratch );
 	}
-	appendStringInfoChar(&buf, ']');
 
-//	fclose(log);
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
 
-	//PG_RETURN_CSTRING(retval);
-	PG_RETURN_TEXT_P( PG_CSTR_GET_TEXT( buf.data ) );
+	PG_RETURN_POINTER(state);
 }
 
-//========================================================================================================================
-//=
-//= aggregate staff
-//=
-//========================================================================================================================
-
-static StringInfo makeJsonAggState( FunctionCallInfo fcinfo )
+PG_FUNCTION_INFO_V1( json_agg_nested_finalfn );
+Datum json_agg_nested_finalfn( PG_FUNCTION_ARGS )
 {
-	StringInfo  state;
-	MemoryContext aggcontext;
-	MemoryContext oldcontext;
-
-	if (!AggCheckCallContext(fcinfo, &aggcontext))
-	{
-		/* cannot be called directly because of internal-type argument */
-		elog(ERROR, "json_agg_*_transfn called in non-aggregate context");
-	}
-
-	/*
-	 * Create state in aggregate context.  It'll stay there across subsequent
-	 * calls.
-	 */
-	oldcontext = MemoryContextSwitchTo(aggcontext);
-	state = makeStringInfo();
-	MemoryContextSwitchTo(oldcontext);
-
-	return state;
+	return json_agg_common_finalfn( fcinfo, false );
 }
 
-Datum json_agg_common_transfn( PG_FUNCTION_ARGS, bool top_object )
+//----------------------------------------------------------
+//
+// jsonb aggregates: the state holds the binary value of every record,
+// each padded to int alignment, concatenated without delimiters. Partial
+// states are serialized and combined like the text ones.
+//
+//----------------------------------------------------------
+
+PG_FUNCTION_INFO_V1( jsonb_agg_transfn );
+Datum jsonb_agg_transfn( PG_FUNCTION_ARGS )
 {
-	StringInfo state;
-	char *serialized_value;
-	FmgrInfo	flinfo;
+	static const char padding[ sizeof( int32 ) ] = { 0 };
+	JsonAggState *state;
+	instr_time	start;
 
-	state = PG_ARGISNULL(0) ? NULL : (StringInfo) PG_GETARG_POINTER(0);
+	JSON_STATS_COUNT( agg_transitions, 1 );
+	JSON_STATS_TIMER_START( start );
+
+	state = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
 
-	/* Append the value unless null. */
 	if (!PG_ARGISNULL(1))
 	{
-		/* On the first time through, we ignore the delimiter. */
+		JsonFnState *fn = json_fn_state( fcinfo->flinfo );
+		JsonbParseState *parse = NULL;
+		MemoryContext oldcontext;
+		Jsonb	   *element;
+
 		if (state == NULL)
 		{
-			state = makeJsonAggState(fcinfo);
+			MemoryContext aggcontext = json_agg_context( fcinfo );
 
-			if( top_object )
-				appendStringInfoChar(state, '{');  /* begin top-level json object */
+			state = makeJsonAggState( aggcontext );
 
-			if(!PG_ARGISNULL(2)) /* output array json-name */
-			{
-				appendStringInfoQuotedString(state, PG_TEXT_DATUM_GET_CSTR( PG_GETARG_DATUM(2) ));
-				appendStringInfoChar(state, ':');  /* array name delimiter */
-			}
-			appendStringInfoChar(state, '[');  /* array begin */
+			/* jsonb_agg_plain has no name argument */
+			if (PG_NARGS() > 2 && !PG_ARGISNULL(2))
+				state->array_name = MemoryContextStrdup( aggcontext, text_to_cstring( PG_GETARG_TEXT_PP(2) ) );
 		}
-		else
-			appendStringInfoChar(state, ',');  /* delimiter */
 
-		//call to serialize_record( ... )
-		MemSet( &flinfo, 0, sizeof( flinfo ) );
-		flinfo.fn_addr = serialize_record;
-		flinfo.fn_nargs = 1;
-		flinfo.fn_mcxt = fcinfo->flinfo->fn_mcxt;
+		oldcontext = MemoryContextSwitchTo( fn->scratch );
+
+		element = JsonbValueToJsonb( jsonb_push_record( &parse, PG_GETARG_HEAPTUPLEHEADER(1), &fn->ref ) );
+
+		json_aggbuf_append( &state->elements, (char *) element, VARSIZE( element ) );
+		json_aggbuf_append( &state->elements, padding, INTALIGN( VARSIZE( element ) ) - VARSIZE( element ) );
 
-		serialized_value = PG_TEXT_DATUM_GET_CSTR( FunctionCall1( &flinfo, PG_GETARG_DATUM(1) ) );
+		MemoryContextSwitchTo( oldcontext );
+		MemoryContextReset( fn->scratch );
 
-		appendStringInfoString(state, serialized_value);	  /* append value */
+		state->nelements++;
 	}
 
-	/*
-	 * The transition type for json_agg() is declared to be "internal",
-	 * which is a pass-by-value type the same size as a pointer.
-	 */
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
 
 	PG_RETURN_POINTER(state);
 }
 
-Datum json_agg_common_finalfn( PG_FUNCTION_ARGS, bool top_object )
+/*
+ * The elements are pushed as binary values into the result array, no text
+ * is parsed. With a name the array is wrapped in {"name": [...]}.
+ */
+Datum jsonb_agg_common_finalfn( PG_FUNCTION_ARGS, bool top_object )
 {
-	StringInfo state;
+	JsonAggState *state;
+	JsonbParseState *parse = NULL;
+	JsonbValue *result;
+	JsonbValue	key;
+	bool		named;
+	int64		size;
+	char	   *data;
+	char	   *p;
+	Jsonb	   *jsonb;
+	instr_time	start;
 
 	/* cannot be called directly because of internal-type argument */
 	Assert(AggCheckCallContext(fcinfo, NULL));
 
-	state = PG_ARGISNULL(0) ? NULL : (StringInfo) PG_GETARG_POINTER(0);
+	JSON_STATS_COUNT( agg_finals, 1 );
+	JSON_STATS_TIMER_START( start );
 
-	if (state != NULL)
+	state = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
+
+	if (state == NULL)
 	{
-		appendStringInfoChar(state, ']');  /* array end */
+		if (!top_object)
+			PG_RETURN_NULL();
 
-		if( top_object )
-			appendStringInfoChar(state, '}'); /* end top-level json object */
+		pushJsonbValue( &parse, WJB_BEGIN_OBJECT, NULL );
+		PG_RETURN_POINTER( JsonbValueToJsonb( pushJsonbValue( &parse, WJB_END_OBJECT, NULL ) ) );
+	}
+
+	size = json_aggbuf_size( &state->elements );
+	if (size > MaxAllocSize)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("jsonb_agg result exceeds the maximum jsonb size")));
+
+	/* the state is left untouched, window aggregates call us repeatedly */
+	data = palloc( size );
+	json_aggbuf_copy( &state->elements, data );
+
+	named = top_object && state->array_name != NULL;
+
+	if (named)
+	{
+		pushJsonbValue( &parse, WJB_BEGIN_OBJECT, NULL );
 
-		PG_RETURN_TEXT_P(cstring_to_text(state->data));
+		key.type = jbvString;
+		key.val.string.val = state->array_name;
+		key.val.string.len = strlen( state->array_name );
+		pushJsonbValue( &parse, WJB_KEY, &key );
 	}
-	else
+
+	pushJsonbValue( &parse, WJB_BEGIN_ARRAY, NULL );
+
+	for (p = data; p < data + size; p += INTALIGN( VARSIZE( p ) ))
 	{
-		if( top_object )
-			PG_RETURN_TEXT_P( PG_CSTR_GET_TEXT( "{}" ) );
-		else
-			PG_RETURN_NULL();
+		JsonbValue	element;
+
+		element.type = jbvBinary;
+		element.val.binary.data = &((Jsonb *) p)->root;
+		element.val.binary.len = VARSIZE( p ) - VARHDRSZ;
+
+		pushJsonbValue( &parse, WJB_ELEM, &element );
 	}
-}
 
-PG_FUNCTION_INFO_V1( json_agg_finalfn );
-Datum json_agg_finalfn( PG_FUNCTION_ARGS )
-{
-	return json_agg_common_finalfn( fcinfo, true );
+	result = pushJsonbValue( &parse, WJB_END_ARRAY, NULL );
+
+	if (named)
+		result = pushJsonbValue( &parse, WJB_END_OBJECT, NULL );
+
+	jsonb = JsonbValueToJsonb( result );
+	pfree( data );
+
+	JSON_STATS_COUNT( output_bytes, VARSIZE( jsonb ) - VARHDRSZ );
+	JSON_STATS_TIMER_ADD( json_stats.total_time, start );
+
+	PG_RETURN_POINTER( jsonb );
 }
 
-PG_FUNCTION_INFO_V1( json_agg_plain_finalfn );
-Datum json_agg_plain_finalfn( PG_FUNCTION_ARGS )
+PG_FUNCTION_INFO_V1( jsonb_agg_finalfn );
+Datum jsonb_agg_finalfn( PG_FUNCTION_ARGS )
 {
-	return json_agg_common_finalfn( fcinfo, false );
+	return jsonb_agg_common_finalfn( fcinfo, true );
 }
 
-PG_FUNCTION_INFO_V1( json_agg_transfn );
-Datum json_agg_transfn( PG_FUNCTION_ARGS )
+PG_FUNCTION_INFO_V1( jsonb_agg_plain_finalfn );
+Datum jsonb_agg_plain_finalfn( PG_FUNCTION_ARGS )
 {
-	return json_agg_common_transfn( fcinfo, true );
+	return jsonb_agg_common_finalfn( fcinfo, false );
 }
 
-PG_FUNCTION_INFO_V1( json_agg_plain_transfn );
-Datum json_agg_plain_transfn( PG_FUNCTION_ARGS )
+PG_FUNCTION_INFO_V1( jsonb_agg_combinefn );
+Datum jsonb_agg_combinefn( PG_FUNCTION_ARGS )
 {
-	return json_agg_common_transfn( fcinfo, false );
+	return json_agg_common_combinefn( fcinfo, false );
 }
@@ -0,0 +1,60 @@
+/*
+* @date 2026-10-17
+* @description pg-to-json-serializer internal JSON writer interface
+*/
+
+#ifndef SERIALIZER_H
+#define SERIALIZER_H
+
+#include "lib/stringinfo.h"
+#include "access/htup.h"
+#include "utils/array.h"
+#include "utils/jsonb.h"
+
+#include "json_plan.h"
+
+/*
+ * fn_extra of the serializing functions. Deformed values, detoasted
+ * arguments and output function results all go to scratch, which is reset
+ * once the record or array is written (for aggregates after every
+ * transition), so only the output bytes outlive a call. The output buffer
+ * itself is allocated outside and only grown by repalloc, which keeps it
+ * in its own context.
+ */
+typedef struct JsonFnState
+{
+	JsonPlanRef	ref;
+	MemoryContext scratch;
+	struct JsonProjection *projection;	/* column list of to_json( record, text[] ) */
+	struct JsonNestLayout *nest;		/* levels of json_agg_nested */
+} JsonFnState;
+
+extern JsonFnState *json_fn_state( FmgrInfo *flinfo );
+
+/*
+ * All serialization paths append into a single StringInfo. Buffers meant
+ * to be returned as text start with json_text_init, which reserves the
+ * varlena header, and end with json_text_finish.
+ */
+extern void json_text_init( StringInfo buf );
+extern text *json_text_finish( StringInfo buf );
+
+extern void appendStringInfoQuotedBytes( StringInfo buf, const char *str, int len );
+extern void appendStringInfoQuotedString( StringInfo buf, const char *string );
+
+extern char *ConvertToText( Datum value, FmgrInfo *proc );
+
+extern void json_write_value( StringInfo buf, Datum value, JsonTypeInfo *type );
+extern void json_write_tuple( StringInfo buf, JsonPlan *plan, HeapTuple tuple );
+extern void json_write_record( StringInfo buf, HeapTupleHeader rec, JsonPlanRef *ref );
+extern void json_write_array( StringInfo buf, ArrayType *v, JsonPlanRef *ref );
+extern void json_write_record_columns( StringInfo buf, HeapTupleHeader rec, FmgrInfo *flinfo, ArrayType *names );
+
+/*
+ * jsonb output: the same plans, pushed into a JsonbParseState instead of
+ * printed. Both return the finished top-level value.
+ */
+extern JsonbValue *jsonb_push_record( JsonbParseState **state, HeapTupleHeader rec, JsonPlanRef *ref );
+extern JsonbValue *jsonb_push_array( JsonbParseState **state, ArrayType *v, JsonPlanRef *ref );
+
+#endif /* SERIALIZER_H */